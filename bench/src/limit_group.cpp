@@ -0,0 +1,145 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include "MqttLimits.h"
+
+// 限制组查找的耗时测试
+// 生成包含若干限制组的配置文件, 每个组有精确匹配, 前缀和正则三种选择器, 对比
+// 每条消息都按配置顺序逐个匹配 (每次构造正则表达式) 和连接时查找一次两种方式
+// 用法: ./limit_group_Bench [限制组数量, 默认 50] [查找次数, 默认 100000]
+
+using bench_clock = std::chrono::steady_clock;
+
+struct legacy_group_t {
+    std::string name;
+    std::vector<std::string> client_id;
+    std::vector<std::string> client_id_prefix;
+    std::vector<std::string> client_id_regex;
+};
+
+// 按配置顺序逐个检查限制组, 和预编译之前的匹配方式相同
+static std::string legacy_group_name(const std::vector<legacy_group_t>& groups,
+                                     const std::string& client_id) {
+    for (const auto& group : groups) {
+        for (const auto& cid : group.client_id) {
+            if (client_id == cid) {
+                return group.name;
+            }
+        }
+
+        for (const auto& cid_prefix : group.client_id_prefix) {
+            if (client_id.starts_with(cid_prefix)) {
+                return group.name;
+            }
+        }
+
+        for (const auto& cid_regex : group.client_id_regex) {
+            if (std::regex_match(client_id, std::regex(cid_regex))) {
+                return group.name;
+            }
+        }
+    }
+
+    return "default";
+}
+
+template <typename F>
+static double measure_ns(uint32_t rounds, F&& f) {
+    auto start = bench_clock::now();
+    for (uint32_t i = 0; i < rounds; i++) {
+        f(i);
+    }
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start)
+               .count() /
+           rounds;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t group_count = argc > 1 ? std::atoi(argv[1]) : 50;
+    uint32_t rounds = argc > 2 ? std::atoi(argv[2]) : 100000;
+
+    spdlog::set_level(spdlog::level::warn);
+
+    std::vector<legacy_group_t> legacy_groups;
+    std::string path = "/tmp/limit_group_bench.yml";
+    std::ofstream out(path);
+
+    out << "limit_groups:\n"
+        << "  - name: 'default'\n"
+        << "    limit:\n"
+        << "      pub_rate: 1000000000\n";
+
+    for (uint32_t i = 0; i < group_count; i++) {
+        std::string n = std::to_string(i);
+        legacy_group_t group{"group-" + n,
+                             {"id-" + n + "-a", "id-" + n + "-b"},
+                             {"prefix-" + n + "/"},
+                             {".*-regex-" + n + "$"}};
+
+        out << "  - name: '" << group.name << "'\n"
+            << "    selector:\n"
+            << "      client_id: ['" << group.client_id[0] << "', '"
+            << group.client_id[1] << "']\n"
+            << "      client_id_prefix: ['" << group.client_id_prefix[0]
+            << "']\n"
+            << "      client_id_regex: ['" << group.client_id_regex[0] << "']\n"
+            << "    limit:\n"
+            << "      pub_rate: 1000000000\n";
+
+        legacy_groups.emplace_back(std::move(group));
+    }
+    out.close();
+
+    if (!MqttLimits::getInstance()->load_limits(path)) {
+        std::printf("load limits failed\n");
+        return 1;
+    }
+
+    std::string last = std::to_string(group_count - 1);
+    std::vector<std::pair<const char*, std::string>> cases = {
+        {"exact, first group", "id-0-a"},
+        {"prefix, last group", "prefix-" + last + "/device"},
+        {"regex, last group", "sensor-regex-" + last},
+        {"no match (default)", "unmatched-client"},
+    };
+
+    std::printf("groups: %u, rounds: %u\n\n", group_count, rounds);
+    std::printf("%-22s %18s %18s %18s\n", "client_id", "legacy (ns/msg)",
+                "connect (ns)", "cached (ns/msg)");
+
+    for (const auto& [title, client_id] : cases) {
+        std::string name;
+        double legacy_ns = measure_ns(rounds, [&](uint32_t) {
+            name = legacy_group_name(legacy_groups, client_id);
+        });
+
+        const mqtt_limit_group_t* group = nullptr;
+        double connect_ns = measure_ns(rounds, [&](uint32_t) {
+            group = MqttLimits::getInstance()->get_group(client_id);
+        });
+
+        if (group->name != name) {
+            std::printf("group mismatch: %s != %s\n", group->name.c_str(),
+                        name.c_str());
+            return 1;
+        }
+
+        mqtt_client_limit_t limit;
+        limit.group = group;
+
+        bool passed = true;
+        double cached_ns = measure_ns(rounds, [&](uint32_t) {
+            passed &= MqttLimits::getInstance()->check_pub_limit(limit);
+        });
+
+        MqttLimits::getInstance()->release(limit);
+
+        std::printf("%-22s %18.1f %18.1f %18.1f%s\n", title, legacy_ns,
+                    connect_ns, cached_ns, passed ? "" : " (limited)");
+    }
+
+    std::remove(path.c_str());
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MqttTokenBucket.h"
+
+// 多个线程共享一个限制组令牌桶时的耗时测试
+// 对比加锁并在每次调用时读取 steady_clock 的令牌桶和基于 CAS 的 GCRA 实现,
+// 再用较低的速率检查多个线程同时消耗时通过的数量是否符合速率
+// 用法: ./rate_limiter_Bench [最大线程数, 默认 8] [每种情况的测试时长 (毫秒), 默认 1000]
+
+using bench_clock = std::chrono::steady_clock;
+
+// 使用 GCRA 之前的令牌桶实现
+class mutex_bucket_t {
+public:
+    explicit mutex_bucket_t(double rate)
+        : rate_(rate),
+          max_tokens_(rate),
+          tokens_(rate),
+          last_time_(bench_clock::now()) {}
+
+    bool try_consume() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto now = bench_clock::now();
+        std::chrono::duration<double> elapsed = now - last_time_;
+        tokens_ = std::min(max_tokens_, tokens_ + elapsed.count() * rate_);
+        last_time_ = now;
+
+        if (tokens_ >= 1.0) {
+            tokens_ -= 1.0;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    double rate_;
+    double max_tokens_;
+    double tokens_;
+    bench_clock::time_point last_time_;
+    std::mutex mutex_;
+};
+
+struct bench_result_t {
+    uint64_t ops = 0;
+    uint64_t allowed = 0;
+    double seconds = 0;
+};
+
+template <typename F>
+static bench_result_t run(uint32_t threads, uint32_t millis, F&& try_consume) {
+    std::atomic<bool> start{false};
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> ops{0};
+    std::atomic<uint64_t> allowed{0};
+    std::vector<std::thread> workers;
+
+    for (uint32_t i = 0; i < threads; i++) {
+        workers.emplace_back([&] {
+            uint64_t local_ops = 0;
+            uint64_t local_allowed = 0;
+
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+
+            while (!stop.load(std::memory_order_relaxed)) {
+                // 每次检查停止标志之前调用多次, 减少标志本身的开销
+                for (int j = 0; j < 64; j++) {
+                    local_allowed += try_consume();
+                }
+                local_ops += 64;
+            }
+
+            ops += local_ops;
+            allowed += local_allowed;
+        });
+    }
+
+    auto begin = bench_clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+    stop.store(true);
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    bench_result_t result;
+    result.ops = ops;
+    result.allowed = allowed;
+    result.seconds =
+        std::chrono::duration<double>(bench_clock::now() - begin).count();
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t max_threads = argc > 1 ? std::atoi(argv[1]) : 8;
+    uint32_t millis = argc > 2 ? std::atoi(argv[2]) : 1000;
+
+    // 速率足够高时每次调用都会通过, 只比较调用本身的开销
+    constexpr double unlimited_rate = 1e12;
+    // 检查速率时使用的速率, 桶的容量为一秒的令牌数
+    constexpr double checked_rate = 100000;
+
+    std::printf("hardware threads: %u, duration: %u ms\n\n",
+                std::thread::hardware_concurrency(), millis);
+    std::printf("%-8s %16s %16s %20s\n", "threads", "mutex (ns/op)",
+                "gcra (ns/op)", "gcra allowed/expect");
+
+    for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+        mutex_bucket_t mutex_bucket(unlimited_rate);
+        auto mutex_result = run(threads, millis,
+                                [&] { return mutex_bucket.try_consume(); });
+
+        MqttTokenBucket gcra_bucket(unlimited_rate);
+        auto gcra_result =
+            run(threads, millis, [&] { return gcra_bucket.tryConsume(); });
+
+        MqttTokenBucket checked_bucket(checked_rate);
+        auto checked_result =
+            run(threads, millis, [&] { return checked_bucket.tryConsume(); });
+
+        // 开始时桶是满的, 之后按速率补充
+        double expect = checked_rate + checked_rate * checked_result.seconds;
+
+        std::printf("%-8u %16.1f %16.1f %20.3f\n", threads,
+                    mutex_result.seconds * 1e9 / mutex_result.ops,
+                    gcra_result.seconds * 1e9 / gcra_result.ops,
+                    checked_result.allowed / expect);
+    }
+
+    return 0;
+}
\ No newline at end of file
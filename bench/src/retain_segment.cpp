@@ -0,0 +1,129 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+#include "MqttRetainTree.h"
+
+// 从保留消息段启动和逐条重放保留消息启动的耗时与内存对比
+// 两种方式分别在单独的进程中运行, 内存的统计互不影响
+// 用法: ./retain_segment_Bench [保留消息数量, 默认 1000000] [segment | replay, 默认 segment]
+
+using bench_clock = std::chrono::steady_clock;
+
+static double elapsed_ms(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() -
+                                                     start)
+        .count();
+}
+
+// 当前进程的常驻内存, 包括被读入的映射页
+static double rss_mb() {
+    std::ifstream statm("/proc/self/statm");
+    std::size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * 4096.0 / 1024 / 1024;
+}
+
+static void report(const char* step, bench_clock::time_point start,
+                   double base_rss) {
+    std::printf("%-32s %12.2f %12.1f\n", step, elapsed_ms(start),
+                rss_mb() - base_rss);
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t retain_count = 1000000;
+    std::string mode = "segment";
+    if (argc > 1) {
+        retain_count = std::strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2) {
+        mode = argv[2];
+    }
+
+    std::string payload(256, 'x');
+
+    if (mode == "replay") {
+        std::printf("%-32s %12s %12s\n", "step", "time (ms)", "rss (MB)");
+
+        // 逐条重放相当于从日志中恢复, 全部消息在启动时就复制到堆内存中
+        MqttRetainTree retain_tree;
+        double base_rss = rss_mb();
+
+        auto start = bench_clock::now();
+        for (uint32_t i = 0; i < retain_count; i++) {
+            mqtt_packet_t packet;
+            packet.qos = 1;
+            packet.retain = 1;
+            packet.message = MqttMessage("device/" + std::to_string(i / 1000) +
+                                             "/" + std::to_string(i) + "/state",
+                                         payload);
+            retain_tree.add(packet);
+        }
+        report("replay: startup", start, base_rss);
+
+        return EXIT_SUCCESS;
+    }
+
+    auto path = std::filesystem::temp_directory_path() / "retained.bench";
+
+    // 模拟设备影子: device/<分组>/<设备编号>/state, 每组 1000 个设备
+    {
+        std::vector<std::string> topics;
+        std::vector<mqtt_retain_entry_t> entries;
+
+        topics.reserve(retain_count);
+        for (uint32_t i = 0; i < retain_count; i++) {
+            topics.push_back("device/" + std::to_string(i / 1000) + "/" +
+                             std::to_string(i) + "/state");
+        }
+
+        for (const auto& topic : topics) {
+            entries.push_back({topic, payload, 1});
+        }
+
+        auto start = bench_clock::now();
+        if (!MqttRetainSegment::write(path.string(), entries)) {
+            std::printf("failed to write %s\n", path.c_str());
+            return EXIT_FAILURE;
+        }
+
+        std::printf("retained topics: %u, write segment: %.1f ms, %.1f MB\n\n",
+                    retain_count, elapsed_ms(start),
+                    std::filesystem::file_size(path) / 1024.0 / 1024.0);
+    }
+
+    // 写入时的页缓存不计入之后的测量
+    std::printf("%-32s %12s %12s\n", "step", "time (ms)", "rss (MB)");
+
+    std::vector<const mqtt_packet_t*> matched;
+    double base_rss = rss_mb();
+
+    {
+        MqttRetainTree retain_tree;
+
+        auto start = bench_clock::now();
+        retain_tree.attach(MqttRetainSegment::open(path.string()));
+        report("segment: open", start, base_rss);
+
+        start = bench_clock::now();
+        matched.clear();
+        retain_tree.match("device/7/7007/state", matched);
+        report("segment: first subscribe", start, base_rss);
+
+        start = bench_clock::now();
+        matched.clear();
+        retain_tree.match("device/8/#", matched);
+        report("segment: subscribe 1000 topics", start, base_rss);
+
+        start = bench_clock::now();
+        matched.clear();
+        retain_tree.match("device/#", matched);
+        report("segment: subscribe all topics", start, base_rss);
+    }
+
+    std::filesystem::remove(path);
+
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "MqttRetainTree.h"
+
+// 新增订阅时获取保留消息的耗时测试
+// 用法: ./retain_subscribe_Bench [保留消息数量, 默认 1000000]
+
+using bench_clock = std::chrono::steady_clock;
+
+static double elapsed_us(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(bench_clock::now() -
+                                                     start)
+        .count();
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t retain_count = 1000000;
+    if (argc > 1) {
+        retain_count = std::strtoul(argv[1], nullptr, 10);
+    }
+
+    MqttRetainTree retain_tree;
+    std::unordered_map<std::string, mqtt_packet_t> retain_map;
+
+    // 模拟设备影子: device/<分组>/<设备编号>/state, 每组 1000 个设备
+    std::string payload(64, 'x');
+
+    auto start = bench_clock::now();
+    for (uint32_t i = 0; i < retain_count; i++) {
+        std::string topic_name = "device/" + std::to_string(i / 1000) + "/" +
+                                 std::to_string(i) + "/state";
+
+        mqtt_packet_t packet;
+        packet.qos = 1;
+        packet.retain = 1;
+        packet.message = MqttMessage(topic_name, payload);
+
+        retain_tree.add(packet);
+        retain_map.emplace(std::move(topic_name), std::move(packet));
+    }
+
+    std::printf("retained topics: %zu, build: %.1f ms\n\n", retain_tree.size(),
+                elapsed_us(start) / 1000);
+
+    const std::vector<std::pair<std::string, uint32_t>> filters = {
+        {"device/7/7007/state", 1000},
+        {"device/7/+/state", 100},
+        {"device/+/7007/state", 100},
+        {"device/7/#", 100},
+        {"device/#", 3},
+    };
+
+    std::printf("%-24s %10s %16s %16s\n", "filter", "matched", "trie (us)",
+                "scan (us)");
+
+    for (const auto& [filter, rounds] : filters) {
+        std::vector<const mqtt_packet_t*> matched;
+
+        start = bench_clock::now();
+        for (uint32_t r = 0; r < rounds; r++) {
+            matched.clear();
+            retain_tree.match(filter, matched);
+        }
+        double trie_us = elapsed_us(start) / rounds;
+
+        // 对比逐条匹配全部保留消息的方式
+        std::size_t scan_matched = 0;
+        uint32_t scan_rounds = std::min<uint32_t>(rounds, 3);
+
+        start = bench_clock::now();
+        for (uint32_t r = 0; r < scan_rounds; r++) {
+            scan_matched = 0;
+            for (const auto& [topic, _] : retain_map) {
+                if (utils::check_topic_match(topic, filter)) {
+                    scan_matched++;
+                }
+            }
+        }
+        double scan_us = elapsed_us(start) / scan_rounds;
+
+        if (scan_matched != matched.size()) {
+            std::printf("mismatch for %s: trie %zu, scan %zu\n",
+                        filter.c_str(), matched.size(), scan_matched);
+            return EXIT_FAILURE;
+        }
+
+        std::printf("%-24s %10zu %16.2f %16.2f\n", filter.c_str(),
+                    matched.size(), trie_us, scan_us);
+    }
+
+    return EXIT_SUCCESS;
+}
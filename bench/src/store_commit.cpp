@@ -0,0 +1,113 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+#include "MqttStore.h"
+
+// 日志模式下不同同步间隔的吞吐量和确认延迟测试
+// 每个发布者线程模拟一个客户端, 消息写入日志后等待同步完成才发送下一条
+// 用法: ./store_commit_Bench [发布者数量, 默认 64] [每个间隔的测试时长 (秒), 默认 3]
+
+using bench_clock = std::chrono::steady_clock;
+
+struct bench_result_t {
+    uint64_t messages = 0;
+    double latency_us = 0;
+};
+
+static bench_result_t run(const std::string& dir, uint32_t sync_interval,
+                          uint32_t publishers, uint32_t seconds) {
+    std::filesystem::remove_all(dir);
+
+    MqttStore store(dir, 64 * 1024 * 1024, sync_interval, 0, 1000);
+    store.open();
+
+    std::string payload(64, 'x');
+    std::vector<std::thread> threads;
+    std::vector<bench_result_t> results(publishers);
+    auto deadline = bench_clock::now() + std::chrono::seconds(seconds);
+
+    for (uint32_t i = 0; i < publishers; i++) {
+        threads.emplace_back([&, i] {
+            std::string client_id = "device-" + std::to_string(i);
+
+            mqtt_packet_t packet;
+            packet.qos = 1;
+            packet.message = MqttMessage("device/" + std::to_string(i) + "/cmd",
+                                         payload);
+
+            std::mutex mutex;
+            std::condition_variable cond;
+            double latency_us = 0;
+
+            while (bench_clock::now() < deadline) {
+                auto start = bench_clock::now();
+                bool done = false;
+
+                store.enqueue(client_id, packet);
+                store.commit([&] {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    done = true;
+                    cond.notify_one();
+                });
+
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&done] { return done; });
+
+                latency_us += std::chrono::duration<double, std::micro>(
+                                  bench_clock::now() - start)
+                                  .count();
+                results[i].messages++;
+            }
+
+            results[i].latency_us = latency_us;
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    bench_result_t total;
+    for (const auto& result : results) {
+        total.messages += result.messages;
+        total.latency_us += result.latency_us;
+    }
+
+    total.latency_us /= std::max<uint64_t>(total.messages, 1);
+    return total;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t publishers = 64;
+    uint32_t seconds = 3;
+    if (argc > 1) {
+        publishers = std::strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2) {
+        seconds = std::strtoul(argv[2], nullptr, 10);
+    }
+
+    spdlog::set_level(spdlog::level::warn);
+
+    auto dir = std::filesystem::temp_directory_path() / "mqtt_commit_bench";
+
+    std::printf("publishers: %u, duration: %u s\n\n", publishers, seconds);
+    std::printf("%-20s %14s %18s\n", "sync_interval (ms)", "messages/s",
+                "avg latency (us)");
+
+    // 0 表示不等待同步, 作为不开启日志模式时的对照
+    for (uint32_t sync_interval : {0U, 1U, 2U, 5U, 10U, 50U}) {
+        bench_result_t result =
+            run(dir.string(), sync_interval, publishers, seconds);
+
+        std::printf("%-20u %14.0f %18.1f\n", sync_interval,
+                    result.messages / double(seconds), result.latency_us);
+    }
+
+    std::filesystem::remove_all(dir);
+
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+#include "MqttStore.h"
+
+// 持久会话存储的写入和恢复耗时测试
+// 用法: ./store_recovery_Bench [持久会话数量, 默认 1000000]
+
+using bench_clock = std::chrono::steady_clock;
+
+static double elapsed_ms(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() -
+                                                     start)
+        .count();
+}
+
+static std::size_t dir_size(const std::filesystem::path& dir) {
+    std::size_t size = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        size += entry.file_size();
+    }
+    return size;
+}
+
+// 恢复一次并输出耗时, 返回恢复出的会话数量
+static std::size_t recover(const std::string& dir, const char* name) {
+    MqttStore store(dir, 64 * 1024 * 1024, 1000, 0, 1000);
+
+    auto start = bench_clock::now();
+    std::size_t sessions = store.open().sessions.size();
+
+    std::printf("%-24s %12zu %12.1f %12.2f\n", name, sessions,
+                elapsed_ms(start), dir_size(dir) / 1024.0 / 1024.0);
+
+    return sessions;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t session_count = 1000000;
+    if (argc > 1) {
+        session_count = std::strtoul(argv[1], nullptr, 10);
+    }
+
+    auto dir = std::filesystem::temp_directory_path() / "mqtt_store_bench";
+    std::filesystem::remove_all(dir);
+
+    std::string payload(64, 'x');
+
+    mqtt_packet_t packet;
+    packet.qos = 1;
+
+    spdlog::set_level(spdlog::level::warn);
+
+    // 每个设备上线、订阅自己的命令主题, 离线后收到一条消息
+    // 写入期间不换日志段, 第一次恢复时只有日志
+    {
+        MqttStore store(dir.string(), SIZE_MAX, 1000, 0, 1000);
+        store.open();
+
+        auto start = bench_clock::now();
+        for (uint32_t i = 0; i < session_count; i++) {
+            std::string client_id = "device-" + std::to_string(i);
+            std::string topic_filter = "device/" + std::to_string(i) + "/cmd";
+
+            MqttOfflineSession session;
+            session.sub_topic_map.emplace(topic_filter, 1);
+
+            store.open_session(client_id);
+            store.subscribe(client_id, topic_filter, 1);
+            store.put_session(client_id, session);
+
+            packet.message = MqttMessage(topic_filter, payload);
+            store.enqueue(client_id, packet);
+        }
+
+        double write_ms = elapsed_ms(start);
+        std::printf("sessions: %u, write: %.1f ms, %.0f records/s\n\n",
+                    session_count, write_ms,
+                    session_count * 4 / (write_ms / 1000));
+    }
+
+    std::printf("%-24s %12s %12s %12s\n", "recovery", "sessions", "time (ms)",
+                "disk (MB)");
+
+    // 只有日志, 启动时重放全部记录
+    recover(dir.string(), "log only");
+
+    // 合并成快照后, 启动时每个会话只有一条记录
+    {
+        MqttStore store(dir.string(), 64 * 1024 * 1024, 1000, 0, 1000);
+        store.open();
+        store.snapshot();
+    }
+    recover(dir.string(), "snapshot");
+
+    // 快照之后又有 10% 的设备重新上线并离线
+    {
+        MqttStore store(dir.string(), 64 * 1024 * 1024, 1000, 0, 1000);
+        store.open();
+        store.snapshot();
+
+        MqttOfflineSession session;
+        for (uint32_t i = 0; i < session_count / 10; i++) {
+            std::string client_id = "device-" + std::to_string(i);
+            store.open_session(client_id);
+            store.put_session(client_id, session);
+        }
+    }
+    std::size_t sessions = recover(dir.string(), "snapshot + 10% log");
+
+    std::filesystem::remove_all(dir);
+
+    return sessions == session_count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file
@@ -12,4 +12,9 @@ option(MQ_WITH_TLS "Enable SSL/TLS for mqtt server" OFF)
 # Unit testing
 #
 # Currently supporting: GoogleTest
-option(ENABLE_UNIT_TESTING "Enable unit tests for the projects (from the `test` subfolder)." OFF)
\ No newline at end of file
+option(ENABLE_UNIT_TESTING "Enable unit tests for the projects (from the `test` subfolder)." OFF)
+
+#
+# Benchmark
+#
+option(ENABLE_BENCHMARK "Enable micro benchmarks for the projects (from the `bench` subfolder)." OFF)
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include "MqttBacklog.h"
+
+#include "MqttConfig.h"
+
+MqttBacklog::MqttBacklog(std::size_t high_watermark,
+                         MqttBacklog* parent) noexcept
+    : high_watermark_(high_watermark),
+      low_watermark_(high_watermark / 2),
+      parent_(parent),
+      bytes_(0),
+      congested_(false) {}
+
+void MqttBacklog::add(std::size_t bytes) noexcept {
+    std::size_t total =
+        bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+    if (high_watermark_ > 0 && total >= high_watermark_) {
+        congested_.store(true, std::memory_order_relaxed);
+    }
+
+    if (parent_ != nullptr) {
+        parent_->add(bytes);
+    }
+}
+
+void MqttBacklog::release(std::size_t bytes) noexcept {
+    if (bytes == 0) {
+        return;
+    }
+
+    std::size_t total =
+        bytes_.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+
+    if (total <= low_watermark_) {
+        congested_.store(false, std::memory_order_relaxed);
+    }
+
+    if (parent_ != nullptr) {
+        parent_->release(bytes);
+    }
+}
+
+bool MqttBacklog::is_congested() const noexcept {
+    // add 和 release 在不同线程中同时更新标志时, 拥塞标志可能在积压已经降到
+    // 低水位以下之后才被设置, 因此还要再和低水位比较
+    return congested_.load(std::memory_order_relaxed) &&
+           bytes_.load(std::memory_order_relaxed) > low_watermark_;
+}
+
+MqttBacklog& MqttBacklog::global() {
+    static MqttBacklog backlog(
+        MqttConfig::getInstance()->queue_high_watermark());
+    return backlog;
+}
\ No newline at end of file
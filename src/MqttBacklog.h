@@ -0,0 +1,33 @@
+#pragma once
+
+#include "MqttCommon.h"
+
+// 待投递消息的积压字节数, 投递消息的线程增加, 会话所在的线程在消息发出或丢弃后减少
+// 超过高水位后处于拥塞状态, 降到高水位的一半以下才解除,
+// 避免积压在水位附近时发布者反复暂停和恢复
+// 每个在线会话一个, 同时计入全部在线会话共享的全局积压
+class MqttBacklog {
+public:
+    // 高水位为 0 时不会进入拥塞状态
+    explicit MqttBacklog(std::size_t high_watermark, MqttBacklog* parent = nullptr) noexcept;
+
+    ~MqttBacklog() = default;
+
+    void add(std::size_t bytes) noexcept;
+
+    void release(std::size_t bytes) noexcept;
+
+    inline std::size_t bytes() const noexcept { return bytes_.load(std::memory_order_relaxed); }
+
+    bool is_congested() const noexcept;
+
+    // 全部在线会话的积压, 第一次使用时按配置的水位创建
+    static MqttBacklog& global();
+
+private:
+    const std::size_t high_watermark_;
+    const std::size_t low_watermark_;
+    MqttBacklog* const parent_;
+    std::atomic<std::size_t> bytes_;
+    std::atomic<bool> congested_;
+};
\ No newline at end of file
@@ -1,10 +1,17 @@
 #pragma once
 
+#include "MqttBacklog.h"
 #include "MqttCommon.h"
+#include "MqttRetainTree.h"
+#include "MqttSessionState.h"
+#include "MqttStore.h"
+#include "MqttTopicTree.h"
 
 template <typename SocketType>
 class MqttSession;
 
+// broker 会被多个 I/O 线程同时访问, 所有共享状态都由 mutex 保护
+// 会话自身的状态只在会话所在的线程中访问, 向会话投递消息需要通过会话的 executor
 template <typename SocketType, typename SslSocketType = void>
 class MqttBroker {
 public:
@@ -12,35 +19,94 @@ public:
 
     ~MqttBroker() = default;
 
-    bool join_or_update(std::shared_ptr<MqttSession<SocketType>> session);
+    // 启用存储时恢复持久会话和保留消息, 需要在接受连接之前调用, 失败时抛出异常
+    void open_store();
 
-    void get_retain(std::shared_ptr<MqttSession<SocketType>> session, const std::string& topic_name);
+    // 返回被替换的旧会话, 不存在时返回 nullptr
+    // 存在离线记录时取出到 offline_session 中, 新会话不保留状态时直接丢弃
+    std::shared_ptr<MqttSession<SocketType>> join_or_update(std::shared_ptr<MqttSession<SocketType>> session, std::optional<MqttOfflineSession>& offline_session);
+
+    void get_retain(std::shared_ptr<MqttSession<SocketType>> session, const std::string& topic_filter, uint8_t qos);
+
+    void leave(std::shared_ptr<MqttSession<SocketType>> session);
 
 #ifdef MQ_WITH_TLS
-    bool join_or_update(std::shared_ptr<MqttSession<SslSocketType>> session);
+    std::shared_ptr<MqttSession<SslSocketType>> join_or_update(std::shared_ptr<MqttSession<SslSocketType>> session, std::optional<MqttOfflineSession>& offline_session);
+
+    void get_retain(std::shared_ptr<MqttSession<SslSocketType>> session, const std::string& topic_filter, uint8_t qos);
 
-    void get_retain(std::shared_ptr<MqttSession<SslSocketType>> session, const std::string& topic_name);
+    void leave(std::shared_ptr<MqttSession<SslSocketType>> session);
 #endif
 
-    void leave(const std::string& sid);
+    void subscribe(const std::string& sid, const std::list<std::pair<std::string, uint8_t>>& sub_topic_list);
+
+    void unsubscribe(const std::string& sid, const std::string& topic_filter);
+
+    void unsubscribe_all(const std::string& sid, const std::unordered_map<std::string, uint8_t>& sub_topic_map);
 
     void dispatch(const mqtt_packet_t& packet);
 
+    // 投递后积压超过水位的在线会话放入 congested, 由发布者决定是否暂停
+    void dispatch(const mqtt_packet_t& packet, std::vector<std::shared_ptr<MqttBacklog>>& congested);
+
     void dispatch_will(const mqtt_packet_t& packet, const std::string& sid);
 
+    // 会话离线或被替换之后才到达的消息, 重新投递给该客户端标识符当前的会话
+    void redeliver(const std::string& sid, const mqtt_packet_t& packet);
+
     void add_retain(const mqtt_packet_t& packet);
 
-    void remove_retain(const std::string& topic_name);
+    void remove_retain(std::string_view topic_name);
+
+    // 之前写入存储的记录全部同步到磁盘后调用 callback, 未启用存储时立即调用
+    void commit(std::function<void()> callback);
 
     std::string gen_session_id();
 
+    // 删除已经过期的离线会话, 由定时任务周期调用
+    void expire_offline(std::chrono::steady_clock::time_point now);
+
+private:
+    template <typename SessionType>
+    std::shared_ptr<SessionType> join_or_update(std::unordered_map<std::string, std::shared_ptr<SessionType>>& sessions, std::shared_ptr<SessionType> session, std::optional<MqttOfflineSession>& offline_session);
+
+    template <typename SessionType>
+    void leave(std::unordered_map<std::string, std::shared_ptr<SessionType>>& sessions, std::shared_ptr<SessionType> session);
+
+    template <typename SessionType>
+    void deliver_retain(std::shared_ptr<SessionType> session, const std::string& topic_filter, uint8_t qos);
+
+    void dispatch(const mqtt_packet_t& packet, const std::string& exclude_sid, std::vector<std::shared_ptr<MqttBacklog>>& congested);
+
+    // 在锁外向在线会话投递, drop 策略下跳过积压超过水位的会话
+    template <typename SessionType>
+    void deliver(const std::vector<std::pair<std::shared_ptr<SessionType>, uint8_t>>& targets, const mqtt_packet_t& packet, std::vector<std::shared_ptr<MqttBacklog>>& congested);
+
+    // 离线会话默认只缓存 Qos1 和 Qos2 的消息, 调用时需要持有 mutex
+    void store_offline(const std::string& sid, const mqtt_packet_t& packet, uint8_t qos);
+
+    // 从离线会话表中删除, 调用时需要持有 mutex
+    void erase_offline(typename std::unordered_map<std::string, MqttOfflineSession>::iterator iter);
+
+    // 在线会话是否保留状态, 只有持久会话的订阅需要写入存储, 调用时需要持有 mutex
+    bool is_persistent(const std::string& sid);
+
 private:
+    std::mutex mutex;
     uint32_t gen_sid_counter;
-    std::unordered_map<std::string, mqtt_packet_t> retain_map;
+    MqttTopicTree sub_tree;
+    MqttRetainTree retain_tree;
     std::unordered_map<std::string, std::shared_ptr<MqttSession<SocketType>>> session_map;
 #ifdef MQ_WITH_TLS
     std::unordered_map<std::string, std::shared_ptr<MqttSession<SslSocketType>>> ssl_session_map;
 #endif
+    // 已经断开连接的持久会话, 按客户端标识符保存
+    std::unordered_map<std::string, MqttOfflineSession> offline_map;
+    // 离线会话按离线的先后顺序排队, 过期时长相同因此队头最先过期
+    // 会话重新连接后队列中对应的项失效, 检查时和离线记录的过期时间比较
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> offline_expiry_queue;
+    // 未启用存储时为空, 日志在持有 mutex 时追加, 顺序和状态变化的顺序一致
+    std::unique_ptr<MqttStore> store;
 };
 
 #include "MqttBroker.ipp"
\ No newline at end of file
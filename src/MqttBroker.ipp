@@ -1,121 +1,631 @@
 #include "MqttBroker.h"
 
+#include "MqttConfig.h"
+#include "MqttExposer.h"
+
 template <typename SocketType, typename SslSocketType>
 MqttBroker<SocketType, SslSocketType>::MqttBroker() : gen_sid_counter(0) {}
 
 template <typename SocketType, typename SslSocketType>
-bool MqttBroker<SocketType, SslSocketType>::join_or_update(
-    std::shared_ptr<MqttSession<SocketType>> session) {
-    bool session_present = false;
-    std::string sid = session->get_session_id();
+void MqttBroker<SocketType, SslSocketType>::open_store() {
+    auto config = MqttConfig::getInstance();
+    if (!config->store_enable()) {
+        return;
+    }
 
-    auto iter = session_map.find(sid);
-    if (iter != session_map.end()) {
-        // 会话状态恢复
-        auto old_session = iter->second;
-        old_session->move_session_state(session);
-        session_present = true;
+    store = std::make_unique<MqttStore>(
+        config->store_dir(), config->store_max_log_size(),
+        config->store_sync_interval(), config->store_sync_bytes(),
+        config->max_queued_messages());
+
+    mqtt_store_image_t image = store->open();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto now = std::chrono::steady_clock::now();
+    int64_t now_seconds =
+        std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    uint32_t expiry_interval = config->session_expiry_interval();
+    std::vector<std::pair<std::chrono::steady_clock::time_point, std::string>>
+        expiry_list;
+
+    // 服务重启后所有持久会话都是离线的, 停止期间也计入离线时间
+    // 服务停止时还在线的会话从现在开始计算过期时间
+    for (auto& [sid, stored] : image.sessions) {
+        auto expiry_time = std::chrono::steady_clock::time_point::max();
+
+        if (expiry_interval > 0) {
+            int64_t offline_seconds =
+                stored.offline_time > 0
+                    ? std::max<int64_t>(0, now_seconds - stored.offline_time)
+                    : 0;
+            if (offline_seconds >= expiry_interval) {
+                store->erase_session(sid);
+                continue;
+            }
+
+            expiry_time = now + std::chrono::seconds(expiry_interval -
+                                                     offline_seconds);
+            expiry_list.emplace_back(expiry_time, sid);
+        }
+
+        MqttOfflineSession& offline_session = offline_map[sid];
+        offline_session.expiry_time = expiry_time;
+
+        for (const auto& [topic_filter, qos] : stored.subscriptions) {
+            sub_tree.subscribe(sid, topic_filter, qos);
+            offline_session.sub_topic_map.emplace(topic_filter, qos);
+        }
+
+        // 未确认的报文在重连后立即重发, 服务端接收的 Qos2 报文继续等待 PUBREL
+        for (const auto& waiting : stored.waiting) {
+            bool resend = waiting.state ==
+                              MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS1 ||
+                          waiting.state ==
+                              MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS2 ||
+                          waiting.state == MQTT_MSG_STATE::WAIT_RESEND_PUBREL ||
+                          waiting.state == MQTT_MSG_STATE::WAIT_RESEND_PUBCOMP;
+            if (!resend &&
+                waiting.state != MQTT_MSG_STATE::WAIT_RECEIVE_PUBREL) {
+                continue;
+            }
+
+            auto& waiting_packet =
+                offline_session.waiting_map.insert(waiting.packet_id);
+            waiting_packet.state = waiting.state;
+
+            if (waiting.state == MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS1 ||
+                waiting.state == MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS2) {
+                waiting_packet.packet.message = MqttMessage(
+                    waiting.message.topic, waiting.message.payload);
+                waiting_packet.packet.qos = waiting.message.qos;
+                waiting_packet.packet.dup = 1;
+            }
+
+            if (resend) {
+                waiting_packet.max_resend_count = config->max_resend_count();
+                offline_session.waiting_map.schedule(
+                    waiting_packet, mqtt_waiting_packet_t::timeout_t::RESEND,
+                    now);
+            } else {
+                offline_session.waiting_map.schedule(
+                    waiting_packet, mqtt_waiting_packet_t::timeout_t::WAITING,
+                    now + std::chrono::seconds(config->max_waiting_time()));
+            }
+        }
+
+        for (const auto& message : stored.queue) {
+            mqtt_packet_t packet;
+            packet.message = MqttMessage(message.topic, message.payload);
+            packet.qos = message.qos;
+            offline_session.inflight_queue.push(std::move(packet));
+        }
+
+        offline_session.inflight_queue.trim(config->max_queued_messages(),
+                                            config->max_queued_bytes(),
+                                            config->queue_full_policy());
+
+        MqttExposer::getInstance()->inc_mqtt_offline_sessions();
+    }
+
+    std::sort(expiry_list.begin(), expiry_list.end());
+    for (auto& item : expiry_list) {
+        offline_expiry_queue.push_back(std::move(item));
+    }
+
+    // 段中的保留消息在第一次订阅时才建立索引, 之后日志中的变化先暂存在保留消息树中
+    if (image.retained_segment) {
+        retain_tree.attach(std::move(image.retained_segment));
+    }
+
+    for (const auto& topic_name : image.erased_retained) {
+        retain_tree.remove(topic_name);
     }
 
-    session_map[sid] = session;
-    return session_present;
+    for (const auto& [_, message] : image.retained) {
+        mqtt_packet_t packet;
+        packet.message = MqttMessage(message.topic, message.payload);
+        packet.qos = message.qos;
+        packet.retain = 1;
+        retain_tree.add(packet);
+    }
+
+    SPDLOG_INFO("Store opened: offline sessions = [{}]", offline_map.size());
+}
+
+template <typename SocketType, typename SslSocketType>
+std::shared_ptr<MqttSession<SocketType>>
+MqttBroker<SocketType, SslSocketType>::join_or_update(
+    std::shared_ptr<MqttSession<SocketType>> session,
+    std::optional<MqttOfflineSession>& offline_session) {
+    return join_or_update(session_map, std::move(session), offline_session);
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::get_retain(
+    std::shared_ptr<MqttSession<SocketType>> session,
+    const std::string& topic_filter, uint8_t qos) {
+    deliver_retain(std::move(session), topic_filter, qos);
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::leave(
+    std::shared_ptr<MqttSession<SocketType>> session) {
+    leave(session_map, std::move(session));
 }
 
 #ifdef MQ_WITH_TLS
 template <typename SocketType, typename SslSocketType>
-bool MqttBroker<SocketType, SslSocketType>::join_or_update(
+std::shared_ptr<MqttSession<SslSocketType>>
+MqttBroker<SocketType, SslSocketType>::join_or_update(
+    std::shared_ptr<MqttSession<SslSocketType>> session,
+    std::optional<MqttOfflineSession>& offline_session) {
+    return join_or_update(ssl_session_map, std::move(session),
+                          offline_session);
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::get_retain(
+    std::shared_ptr<MqttSession<SslSocketType>> session,
+    const std::string& topic_filter, uint8_t qos) {
+    deliver_retain(std::move(session), topic_filter, qos);
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::leave(
     std::shared_ptr<MqttSession<SslSocketType>> session) {
-    bool session_present = false;
-    std::string sid = session->get_session_id();
+    leave(ssl_session_map, std::move(session));
+}
+#endif
+
+template <typename SocketType, typename SslSocketType>
+template <typename SessionType>
+std::shared_ptr<SessionType>
+MqttBroker<SocketType, SslSocketType>::join_or_update(
+    std::unordered_map<std::string, std::shared_ptr<SessionType>>& sessions,
+    std::shared_ptr<SessionType> session,
+    std::optional<MqttOfflineSession>& offline_session) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const std::string& sid = session->get_session_id();
+
+    // 离线记录和会话替换在同一把锁内完成, 分发的消息不会丢失
+    auto offline_iter = offline_map.find(sid);
+    bool has_offline = offline_iter != offline_map.end();
+    if (has_offline) {
+        if (session->is_clean_session()) {
+            for (const auto& [topic_filter, _] :
+                 offline_iter->second.sub_topic_map) {
+                sub_tree.unsubscribe(sid, topic_filter);
+            }
+        } else {
+            offline_session = std::move(offline_iter->second);
+        }
+        erase_offline(offline_iter);
+    }
+
+    // 旧会话的状态由新会话在旧会话所在的线程中取出, 这里只替换会话
+    auto& entry = sessions[sid];
+    std::shared_ptr<SessionType> old_session = std::move(entry);
+    entry = std::move(session);
 
-    auto iter = ssl_session_map.find(sid);
-    if (iter != ssl_session_map.end()) {
-        // 会话状态恢复
-        auto old_session = iter->second;
-        old_session->move_session_state(session);
-        session_present = true;
+    // 持久会话在线期间未投递的消息只保存在内存中, 存储中只保留订阅
+    if (store) {
+        if (!entry->is_clean_session()) {
+            store->open_session(sid);
+        } else if (has_offline ||
+                   (old_session && !old_session->is_clean_session())) {
+            store->erase_session(sid);
+        }
     }
 
-    ssl_session_map[sid] = session;
-    return session_present;
+    return old_session;
 }
 
 template <typename SocketType, typename SslSocketType>
-void MqttBroker<SocketType, SslSocketType>::get_retain(
-    std::shared_ptr<MqttSession<SslSocketType>> session,
-    const std::string& sub_topic) {
-    for (auto& [pub_topic, packet] : retain_map) {
-        // 指定保留消息要发送给哪个主题
-        packet.specified_topic_name = sub_topic;
-        session->push_packet(packet);
+template <typename SessionType>
+void MqttBroker<SocketType, SslSocketType>::leave(
+    std::unordered_map<std::string, std::shared_ptr<SessionType>>& sessions,
+    std::shared_ptr<SessionType> session) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto sid = session->get_session_id();
+
+    // 会话已经被同一个客户端标识符的新会话替换时, 会话状态由新会话接管
+    auto iter = sessions.find(sid);
+    if (iter == sessions.end() || iter->second != session) {
+        return;
     }
+
+    if (session->is_clean_session()) {
+        for (const auto& [topic_filter, _] : session->get_sub_topic_map()) {
+            sub_tree.unsubscribe(sid, topic_filter);
+        }
+    } else {
+        // 持久会话只保留离线记录, 释放连接占用的全部资源
+        auto [offline_iter, inserted] = offline_map.try_emplace(sid);
+        auto& offline_session = offline_iter->second;
+        offline_session = session->take_offline_session();
+        if (inserted) {
+            MqttExposer::getInstance()->inc_mqtt_offline_sessions();
+        }
+
+        uint32_t expiry_interval =
+            MqttConfig::getInstance()->session_expiry_interval();
+        if (expiry_interval > 0) {
+            offline_session.expiry_time = std::chrono::steady_clock::now() +
+                                          std::chrono::seconds(expiry_interval);
+            offline_expiry_queue.emplace_back(offline_session.expiry_time, sid);
+        }
+
+        if (store) {
+            store->put_session(sid, offline_session);
+        }
+    }
+
+    sessions.erase(iter);
 }
-#endif
 
 template <typename SocketType, typename SslSocketType>
-void MqttBroker<SocketType, SslSocketType>::leave(const std::string& sid) {
-    session_map.erase(sid);
-#ifdef MQ_WITH_TLS
-    ssl_session_map.erase(sid);
-#endif
+void MqttBroker<SocketType, SslSocketType>::subscribe(
+    const std::string& sid,
+    const std::list<std::pair<std::string, uint8_t>>& sub_topic_list) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    bool persistent = store && is_persistent(sid);
+
+    for (const auto& [topic_filter, qos] : sub_topic_list) {
+        sub_tree.subscribe(sid, topic_filter, qos);
+
+        if (persistent) {
+            store->subscribe(sid, topic_filter, qos);
+        }
+    }
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::unsubscribe(
+    const std::string& sid, const std::string& topic_filter) {
+    std::lock_guard<std::mutex> lock(mutex);
+    sub_tree.unsubscribe(sid, topic_filter);
+
+    if (store && is_persistent(sid)) {
+        store->unsubscribe(sid, topic_filter);
+    }
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::unsubscribe_all(
+    const std::string& sid,
+    const std::unordered_map<std::string, uint8_t>& sub_topic_map) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (const auto& [topic_filter, _] : sub_topic_map) {
+        sub_tree.unsubscribe(sid, topic_filter);
+    }
 }
 
 template <typename SocketType, typename SslSocketType>
 void MqttBroker<SocketType, SslSocketType>::dispatch(
     const mqtt_packet_t& packet) {
-    // 将消息分发给拥有订阅项的会话
-    for (auto& sid : MqttSession<SocketType>::active_sub_set) {
-        if (session_map.contains(sid)) {
-            session_map[sid]->push_packet(packet);
+    std::vector<std::shared_ptr<MqttBacklog>> congested;
+    dispatch(packet, "", congested);
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::dispatch(
+    const mqtt_packet_t& packet,
+    std::vector<std::shared_ptr<MqttBacklog>>& congested) {
+    dispatch(packet, "", congested);
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::dispatch_will(
+    const mqtt_packet_t& packet, const std::string& sid) {
+    // 遗嘱消息不发送给已经死去的会话, 虽然死了但还是可能保留了会话状态
+    // 会继续接收主题消息
+    std::vector<std::shared_ptr<MqttBacklog>> congested;
+    dispatch(packet, sid, congested);
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::dispatch(
+    const mqtt_packet_t& packet, const std::string& exclude_sid,
+    std::vector<std::shared_ptr<MqttBacklog>>& congested) {
+    std::unordered_map<std::string, uint8_t> matched;
+    std::vector<std::pair<std::shared_ptr<MqttSession<SocketType>>, uint8_t>>
+        targets;
+    bool journal = MqttConfig::getInstance()->store_journal();
+#ifdef MQ_WITH_TLS
+    std::vector<
+        std::pair<std::shared_ptr<MqttSession<SslSocketType>>, uint8_t>>
+        ssl_targets;
+#endif
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // 通过订阅树找到真正匹配的会话, 只将消息分发给这些会话
+        sub_tree.match(packet.message.topic_name(), matched);
+
+        for (const auto& [sid, qos] : matched) {
+            if (sid == exclude_sid) {
+                continue;
+            }
+
+            bool online = false;
+
+            auto iter = session_map.find(sid);
+            if (iter != session_map.end()) {
+                targets.emplace_back(iter->second, qos);
+                online = true;
+            }
+
+#ifdef MQ_WITH_TLS
+            auto ssl_iter = ssl_session_map.find(sid);
+            if (ssl_iter != ssl_session_map.end()) {
+                ssl_targets.emplace_back(ssl_iter->second, qos);
+                online = true;
+            }
+#endif
+
+            if (!online) {
+                store_offline(sid, packet, qos);
+            } else if (journal && std::min<uint8_t>(packet.qos, qos) > 0 &&
+                       is_persistent(sid)) {
+                // 日志模式下发给在线持久会话的消息也写入存储, 崩溃后重新投递
+                mqtt_packet_t journal_packet = packet;
+                journal_packet.qos = std::min<uint8_t>(packet.qos, qos);
+                store->enqueue(sid, journal_packet);
+            }
         }
     }
 
+    // 在锁外投递, 会话位于其它 I/O 线程时消息会被放入该线程的任务队列
+    deliver(targets, packet, congested);
+
 #ifdef MQ_WITH_TLS
-    for (auto& sid : MqttSession<SslSocketType>::active_sub_set) {
-        if (ssl_session_map.contains(sid)) {
-            ssl_session_map[sid]->push_packet(packet);
+    deliver(ssl_targets, packet, congested);
+#endif
+}
+
+template <typename SocketType, typename SslSocketType>
+template <typename SessionType>
+void MqttBroker<SocketType, SslSocketType>::deliver(
+    const std::vector<std::pair<std::shared_ptr<SessionType>, uint8_t>>&
+        targets,
+    const mqtt_packet_t& packet,
+    std::vector<std::shared_ptr<MqttBacklog>>& congested) {
+    bool drop = MqttConfig::getInstance()->overload_policy() ==
+                MQTT_OVERLOAD_POLICY::DROP;
+    std::size_t dropped = 0;
+
+    for (const auto& [session, qos] : targets) {
+        const auto& backlog = session->get_backlog();
+
+        if (drop && backlog->is_congested()) {
+            dropped++;
+            continue;
+        }
+
+        mqtt_packet_t sub_packet = packet;
+
+        // Qos 等级取两者最小值
+        sub_packet.qos = std::min<uint8_t>(packet.qos, qos);
+        session->push_packet(sub_packet);
+
+        if (backlog->is_congested()) {
+            congested.push_back(backlog);
         }
     }
+
+    MqttExposer::getInstance()->inc_mqtt_overload_dropped_count_metric(dropped);
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::redeliver(
+    const std::string& sid, const mqtt_packet_t& packet) {
+    std::shared_ptr<MqttSession<SocketType>> session;
+#ifdef MQ_WITH_TLS
+    std::shared_ptr<MqttSession<SslSocketType>> ssl_session;
+#endif
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto iter = session_map.find(sid);
+        if (iter != session_map.end()) {
+            session = iter->second;
+        }
+
+#ifdef MQ_WITH_TLS
+        auto ssl_iter = ssl_session_map.find(sid);
+        if (ssl_iter != ssl_session_map.end()) {
+            ssl_session = ssl_iter->second;
+        }
+
+        if (!session && !ssl_session) {
+            store_offline(sid, packet, packet.qos);
+        }
+#else
+        if (!session) {
+            store_offline(sid, packet, packet.qos);
+        }
+#endif
+    }
+
+    if (session) {
+        session->push_packet(packet);
+    }
+
+#ifdef MQ_WITH_TLS
+    if (ssl_session) {
+        ssl_session->push_packet(packet);
+    }
 #endif
 }
 
 template <typename SocketType, typename SslSocketType>
-void MqttBroker<SocketType, SslSocketType>::dispatch_will(
-    const mqtt_packet_t& packet, const std::string& sid) {
-    // 遗嘱消息不发送给已经死去的会话, 虽然死了但还是可能保留了会话状态
-    // 会继续接收主题消息
-    for (auto& session_id : MqttSession<SocketType>::active_sub_set) {
-        if (session_id != sid && session_map.contains(sid)) {
-            session_map[sid]->push_packet(packet);
+void MqttBroker<SocketType, SslSocketType>::store_offline(
+    const std::string& sid, const mqtt_packet_t& packet, uint8_t qos) {
+    auto config = MqttConfig::getInstance();
+
+    qos = std::min<uint8_t>(packet.qos, qos);
+    if (qos == 0 && !config->queue_qos0_messages()) {
+        return;
+    }
+
+    auto iter = offline_map.find(sid);
+    if (iter == offline_map.end()) {
+        return;
+    }
+
+    mqtt_packet_t offline_packet = packet;
+    offline_packet.qos = qos;
+
+    if (store) {
+        store->enqueue(sid, offline_packet);
+    }
+
+    auto& inflight_queue = iter->second.inflight_queue;
+    inflight_queue.push(std::move(offline_packet));
+
+    // 长期不上线的设备只保留最近的消息, 不会无限占用内存
+    std::size_t dropped =
+        inflight_queue.trim(config->max_queued_messages(),
+                            config->max_queued_bytes(),
+                            config->queue_full_policy());
+    MqttExposer::getInstance()->inc_mqtt_queue_dropped_count_metric(dropped);
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::erase_offline(
+    typename std::unordered_map<std::string, MqttOfflineSession>::iterator
+        iter) {
+    offline_map.erase(iter);
+    MqttExposer::getInstance()->dec_mqtt_offline_sessions();
+}
+
+template <typename SocketType, typename SslSocketType>
+bool MqttBroker<SocketType, SslSocketType>::is_persistent(
+    const std::string& sid) {
+    auto iter = session_map.find(sid);
+    if (iter != session_map.end()) {
+        return !iter->second->is_clean_session();
+    }
+
+#ifdef MQ_WITH_TLS
+    auto ssl_iter = ssl_session_map.find(sid);
+    if (ssl_iter != ssl_session_map.end()) {
+        return !ssl_iter->second->is_clean_session();
+    }
+#endif
+
+    return false;
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::expire_offline(
+    std::chrono::steady_clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    while (!offline_expiry_queue.empty() &&
+           offline_expiry_queue.front().first <= now) {
+        const auto& [expiry_time, sid] = offline_expiry_queue.front();
+
+        // 会话已经重新连接过的项直接跳过
+        auto iter = offline_map.find(sid);
+        if (iter != offline_map.end() &&
+            iter->second.expiry_time == expiry_time) {
+            for (const auto& [topic_filter, _] : iter->second.sub_topic_map) {
+                sub_tree.unsubscribe(sid, topic_filter);
+            }
+
+            std::size_t dropped = iter->second.inflight_queue.size() +
+                                  iter->second.waiting_map.size();
+
+            SPDLOG_INFO("offline session expired, client_id = [{}]", sid);
+
+            if (store) {
+                store->erase_session(sid);
+            }
+
+            erase_offline(iter);
+            MqttExposer::getInstance()->inc_mqtt_session_expired_count_metric(
+                dropped);
         }
+
+        offline_expiry_queue.pop_front();
     }
 }
 
 template <typename SocketType, typename SslSocketType>
 void MqttBroker<SocketType, SslSocketType>::add_retain(
     const mqtt_packet_t& packet) {
-    retain_map[*packet.topic_name] = packet;
+    std::lock_guard<std::mutex> lock(mutex);
+    retain_tree.add(packet);
+
+    if (store) {
+        store->put_retain(packet);
+    }
 }
 
 template <typename SocketType, typename SslSocketType>
-void MqttBroker<SocketType, SslSocketType>::get_retain(
-    std::shared_ptr<MqttSession<SocketType>> session,
-    const std::string& sub_topic) {
-    for (auto& [pub_topic, packet] : retain_map) {
-        // 指定保留消息要发送给哪个主题
-        packet.specified_topic_name = sub_topic;
-        session->push_packet(packet);
+template <typename SessionType>
+void MqttBroker<SocketType, SslSocketType>::deliver_retain(
+    std::shared_ptr<SessionType> session, const std::string& topic_filter,
+    uint8_t qos) {
+    std::vector<mqtt_packet_t> retain_packets;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::vector<const mqtt_packet_t*> matched;
+
+        // 只取出与新订阅匹配的保留消息, 保留消息本身不做修改
+        retain_tree.match(topic_filter, matched);
+
+        retain_packets.reserve(matched.size());
+        for (const auto* packet : matched) {
+            retain_packets.emplace_back(*packet);
+        }
+    }
+
+    for (auto& retain_packet : retain_packets) {
+        // Qos 等级取两者最小值
+        retain_packet.qos = std::min<uint8_t>(retain_packet.qos, qos);
+        session->push_packet(retain_packet);
     }
 }
 
 template <typename SocketType, typename SslSocketType>
 void MqttBroker<SocketType, SslSocketType>::remove_retain(
-    const std::string& topic_name) {
-    retain_map.erase(topic_name);
+    std::string_view topic_name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    retain_tree.remove(topic_name);
+
+    if (store) {
+        store->erase_retain(topic_name);
+    }
+}
+
+template <typename SocketType, typename SslSocketType>
+void MqttBroker<SocketType, SslSocketType>::commit(
+    std::function<void()> callback) {
+    if (!store) {
+        callback();
+        return;
+    }
+
+    store->commit(std::move(callback));
 }
 
 template <typename SocketType, typename SslSocketType>
 std::string MqttBroker<SocketType, SslSocketType>::gen_session_id() {
+    std::lock_guard<std::mutex> lock(mutex);
+
     std::string sid;
     do {
         sid = "MS_" + std::to_string(gen_sid_counter);
@@ -3,11 +3,16 @@
 #include <list>
 #include <regex>
 #include <queue>
+#include <deque>
 #include <array>
 #include <vector>
 #include <string>
+#include <mutex>
 #include <memory>
+#include <optional>
 #include <chrono>
+#include <thread>
+#include <condition_variable>
 #include <string_view>
 #include <type_traits>
 #include <unordered_set>
@@ -18,6 +23,7 @@
 #include "asio/experimental/channel.hpp"
 #include "ylt/metric/counter.hpp"
 #include "ylt/metric/gauge.hpp"
+#include "ylt/metric/histogram.hpp"
 #include "ylt/metric/metric_manager.hpp"
 #include "ylt/coro_http/coro_http_server.hpp"
 
@@ -28,6 +34,7 @@
 #endif
 
 #include "MqttLogger.h"
+#include "MqttMessage.h"
 
 enum class MQTT_PROTOCOL: uint8_t {
     MQTT,
@@ -75,8 +82,20 @@ enum class MQTT_RC_CODE: uint8_t {
     ERR_BAD_USERNAME_PASSWORD,
     ERR_BAD_CLIENT_ID,
     ERR_REFUSED_NOT_AUTHORIZED,
+    ERR_REFUSED_SERVER_UNAVAILABLE,
 };
 
+// 会话接收缓冲区大小, 超过该大小的报文不经过缓冲区直接读取
+// 缓冲区从最小值开始, 读满时按倍数扩容到最大值
+constexpr std::size_t MQTT_RECV_BUFFER_MIN_SIZE = 512;
+constexpr std::size_t MQTT_RECV_BUFFER_SIZE = 4096;
+
+// 发布者因积压暂停时检查积压的间隔, 以及一次暂停的最长时间
+// 超过最长时间后先读取一个报文再检查, 避免互相发布消息的客户端都停止读取后
+// 收不到确认报文, 积压永远降不下来
+constexpr auto MQTT_BACKLOG_CHECK_INTERVAL = std::chrono::milliseconds(10);
+constexpr auto MQTT_BACKLOG_MAX_PAUSE = std::chrono::seconds(1);
+
 struct MQTT_CMD {
     static constexpr uint8_t CONNECT = 0x10U;
     static constexpr uint8_t CONNACK = 0x20U;
@@ -104,32 +123,63 @@ struct MQTT_CONNACK {
     static constexpr uint8_t REFUSED_NOT_AUTHORIZED = 0x05U;
 };
 
+// 投递给订阅者的一条消息, 只包含消息引用、Qos 和标志位
+// 会话待投递队列中的每个元素就是一个 mqtt_packet_t, 需要尽量紧凑
 struct mqtt_packet_t {
+    MqttMessage message;
+
     struct {
         uint8_t qos: 2;
         uint8_t dup: 1;
         uint8_t retain: 1;
     };
-    
-    MQTT_MSG_STATE state;
-    uint16_t packet_id;
-    uint32_t max_resend_count;
-    std::string specified_topic_name;
-    std::shared_ptr<const std::string> topic_name;
-    std::shared_ptr<const std::string> payload;
-    std::chrono::time_point<std::chrono::steady_clock> expiry_time;
 
     mqtt_packet_t() :
         qos(0b11U),
         dup(0b00U),
-        retain(0b00U),
-        state(MQTT_MSG_STATE::INVALID),
-        max_resend_count(0U),
-        topic_name(std::make_shared<const std::string>("")),
-        payload(std::make_shared<const std::string>(""))
+        retain(0b00U)
         {}
 };
 
+// 会话发送队列中的一个报文, 按 head、固定报头、主题、报文标识符、消息内容
+// 的顺序写出, 只有 head 和报文标识符属于当前会话, 其余部分指向共享的消息
+struct mqtt_frame_t {
+    std::string head;
+    MqttMessage message;    // 持有消息的引用, 保证以下视图有效
+    std::string_view fixed_header;
+    std::string_view topic;
+    bool has_packet_id = false;
+    uint16_t packet_id = 0;    // 网络字节序
+    std::string_view body;
+
+    std::size_t size() const noexcept {
+        return head.length() + fixed_header.length() + topic.length() +
+               (has_packet_id ? sizeof(packet_id) : 0) + body.length();
+    }
+
+    void append_buffers(std::vector<asio::const_buffer>& buffers) const {
+        if (!head.empty()) {
+            buffers.push_back(asio::buffer(head));
+        }
+
+        if (!fixed_header.empty()) {
+            buffers.push_back(asio::buffer(fixed_header));
+        }
+
+        if (!topic.empty()) {
+            buffers.push_back(asio::buffer(topic));
+        }
+
+        if (has_packet_id) {
+            buffers.push_back(asio::buffer(&packet_id, sizeof(packet_id)));
+        }
+
+        if (!body.empty()) {
+            buffers.push_back(asio::buffer(body));
+        }
+    }
+};
+
 enum class MQTT_ACL_STATE: uint8_t {
     NONE,
     ALLOW,
@@ -169,6 +219,18 @@ struct mqtt_acl_rule_t {
         {}
 };
 
+// 会话的待投递队列超过上限时的丢弃策略
+enum class MQTT_QUEUE_POLICY: uint8_t {
+    DROP_OLDEST,        // 丢弃最早的消息
+    DROP_QOS0_FIRST,    // 先丢弃最早的 Qos0 消息, 没有时丢弃最早的消息
+};
+
+// 待投递消息的积压超过水位时的处理策略
+enum class MQTT_OVERLOAD_POLICY: uint8_t {
+    PAUSE,    // 暂停读取发布者的报文, 直到积压降下来
+    DROP,     // 不再向积压的会话投递新消息
+};
+
 enum class MQTT_SSL_VERSION: uint8_t {
     TLSv12,
     TLSv13,
@@ -204,13 +266,11 @@ struct mqtt_exposer_cfg_t {
     uint32_t thread_count;
 };
 
-struct mqtt_limit_selector_cfg_t {
-    std::vector<std::string> client_id;
-    std::vector<std::string> client_id_prefix;
-    std::vector<std::string> client_id_regex;
-};
-
-struct mqtt_limit_group_cfg_t {
-    std::string name;
-    std::unique_ptr<mqtt_limit_selector_cfg_t> selector;
+struct mqtt_store_cfg_t {
+    bool enable;
+    std::string dir;
+    uint32_t max_log_size;
+    uint32_t sync_interval;
+    uint32_t sync_bytes;
+    bool journal;
 };
\ No newline at end of file
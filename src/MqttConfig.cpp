@@ -6,15 +6,25 @@
 using namespace std::string_view_literals;
 
 MqttConfig::MqttConfig()
-    : connect_timeout_(10),
+    : io_threads_(1),
+      max_batch_bytes_(64 * 1024),
+      connect_timeout_(10),
       check_timeout_duration_(1),
-      check_waiting_map_duration_(1),
       max_resend_count_(3),
       resend_duration_(60),
       max_waiting_time_(60),
+      session_expiry_interval_(7200),
+      max_inflight_messages_(32),
       auth_(false),
       max_packet_size_(std::numeric_limits<uint32_t>::max()),
       max_subscriptions_(std::numeric_limits<uint32_t>::max()),
+      max_queued_messages_(1000),
+      max_queued_bytes_(std::numeric_limits<uint32_t>::max()),
+      queue_full_policy_(MQTT_QUEUE_POLICY::DROP_OLDEST),
+      queue_qos0_messages_(false),
+      queue_high_watermark_(0),
+      session_queue_high_watermark_(0),
+      overload_policy_(MQTT_OVERLOAD_POLICY::PAUSE),
       name_("logs/mqtt-server.log"),
       max_rotate_size_(1024 * 1024),
       max_rotate_count_(10),
@@ -27,6 +37,7 @@ MqttConfig::MqttConfig()
     default_ssl_cfg_.fail_if_no_peer_cert = false;
 
     exposer_cfg_.enable = false;
+    store_cfg_.enable = false;
 }
 
 bool MqttConfig::parse(const std::string& file_name) {
@@ -110,6 +121,46 @@ bool MqttConfig::parse(const std::string& file_name) {
             }
         }
 
+        store_cfg_ = {
+            .enable = false,
+            .dir = "../data",
+            .max_log_size = 64 * 1024 * 1024,
+            .sync_interval = 1000,
+            .sync_bytes = 0,
+            .journal = false,
+        };
+
+        if (root["store"].IsDefined()) {
+            auto nodeStore = root["store"];
+
+            if (nodeStore["enable"].IsDefined()) {
+                store_cfg_.enable = nodeStore["enable"].as<bool>();
+            }
+
+            if (nodeStore["dir"].IsDefined()) {
+                store_cfg_.dir = nodeStore["dir"].as<std::string>();
+            }
+
+            if (nodeStore["max_log_size"].IsDefined()) {
+                store_cfg_.max_log_size =
+                    utils::parse_size(nodeStore["max_log_size"].as<std::string>());
+            }
+
+            if (nodeStore["sync_interval"].IsDefined()) {
+                store_cfg_.sync_interval =
+                    nodeStore["sync_interval"].as<uint32_t>();
+            }
+
+            if (nodeStore["sync_bytes"].IsDefined()) {
+                store_cfg_.sync_bytes =
+                    utils::parse_size(nodeStore["sync_bytes"].as<std::string>());
+            }
+
+            if (nodeStore["journal"].IsDefined()) {
+                store_cfg_.journal = nodeStore["journal"].as<bool>();
+            }
+        }
+
         if (root["listeners"].IsDefined()) {
             parse_listeners(root["listeners"]);
         }
@@ -121,6 +172,20 @@ bool MqttConfig::parse(const std::string& file_name) {
         if (root["server"].IsDefined()) {
             auto nodeServer = root["server"];
 
+            if (nodeServer["io_threads"].IsDefined()) {
+                io_threads_ = nodeServer["io_threads"].as<uint32_t>();
+
+                // 为 0 时按照 CPU 核心数创建 I/O 线程
+                if (io_threads_ == 0) {
+                    io_threads_ =
+                        std::max(1U, std::thread::hardware_concurrency());
+                }
+            }
+
+            if (nodeServer["max_batch_bytes"].IsDefined()) {
+                max_batch_bytes_ = nodeServer["max_batch_bytes"].as<uint32_t>();
+            }
+
             if (nodeServer["protocol"].IsDefined()) {
                 auto nodeProtocol = nodeServer["protocol"];
 
@@ -134,12 +199,6 @@ bool MqttConfig::parse(const std::string& file_name) {
                         nodeProtocol["check_timeout_duration"].as<uint32_t>();
                 }
 
-                if (nodeProtocol["check_waiting_map_duration"].IsDefined()) {
-                    check_waiting_map_duration_ =
-                        nodeProtocol["check_waiting_map_duration"]
-                            .as<uint32_t>();
-                }
-
                 if (nodeProtocol["max_resend_count"].IsDefined()) {
                     max_resend_count_ =
                         nodeProtocol["max_resend_count"].as<uint32_t>();
@@ -155,6 +214,16 @@ bool MqttConfig::parse(const std::string& file_name) {
                         nodeProtocol["max_waiting_time"].as<uint32_t>();
                 }
 
+                if (nodeProtocol["session_expiry_interval"].IsDefined()) {
+                    session_expiry_interval_ =
+                        nodeProtocol["session_expiry_interval"].as<uint32_t>();
+                }
+
+                if (nodeProtocol["max_inflight_messages"].IsDefined()) {
+                    max_inflight_messages_ =
+                        nodeProtocol["max_inflight_messages"].as<uint32_t>();
+                }
+
                 if (nodeProtocol["auth"].IsDefined()) {
                     auth_ = nodeProtocol["auth"].as<bool>();
 
@@ -380,23 +449,8 @@ void MqttConfig::parse_limits(const YAML::Node& node) {
     }
 
     if (node["max_packet_size"].IsDefined()) {
-        std::string str_packet_size = node["max_packet_size"].as<std::string>();
-        std::string_view sv_packet_size = str_packet_size;
-
-        auto slen = sv_packet_size.length();
-
-        if (slen > 2 &&
-            utils::tolower_equal(sv_packet_size.substr(slen - 2, 2), "KB"sv)) {
-            max_packet_size_ =
-                atoi(str_packet_size.substr(0, slen - 2).c_str()) * 1024;
-        } else if (slen > 2 &&
-                   utils::tolower_equal(sv_packet_size.substr(slen - 2, 2),
-                                        "MB"sv)) {
-            max_packet_size_ =
-                atoi(str_packet_size.substr(0, slen - 2).c_str()) * 1024 * 1024;
-        } else {
-            max_packet_size_ = atoi(str_packet_size.c_str());
-        }
+        max_packet_size_ =
+            utils::parse_size(node["max_packet_size"].as<std::string>());
 
         SPDLOG_INFO("max_packet_size={}", max_packet_size_);
     }
@@ -404,4 +458,60 @@ void MqttConfig::parse_limits(const YAML::Node& node) {
     if (node["max_subscriptions"].IsDefined()) {
         max_subscriptions_ = node["max_subscriptions"].as<uint32_t>();
     }
+
+    if (node["max_queued_messages"].IsDefined()) {
+        max_queued_messages_ = node["max_queued_messages"].as<uint32_t>();
+
+        // 为 0 时不限制
+        if (max_queued_messages_ == 0) {
+            max_queued_messages_ = std::numeric_limits<uint32_t>::max();
+        }
+    }
+
+    if (node["max_queued_bytes"].IsDefined()) {
+        max_queued_bytes_ =
+            utils::parse_size(node["max_queued_bytes"].as<std::string>());
+
+        if (max_queued_bytes_ == 0) {
+            max_queued_bytes_ = std::numeric_limits<uint32_t>::max();
+        }
+    }
+
+    if (node["queue_full_policy"].IsDefined()) {
+        auto policy = node["queue_full_policy"].as<std::string>();
+
+        if (policy == "drop_oldest") {
+            queue_full_policy_ = MQTT_QUEUE_POLICY::DROP_OLDEST;
+        } else if (policy == "drop_qos0_first") {
+            queue_full_policy_ = MQTT_QUEUE_POLICY::DROP_QOS0_FIRST;
+        } else {
+            throw std::runtime_error("Unknown queue_full_policy: " + policy);
+        }
+    }
+
+    if (node["queue_qos0_messages"].IsDefined()) {
+        queue_qos0_messages_ = node["queue_qos0_messages"].as<bool>();
+    }
+
+    if (node["queue_high_watermark"].IsDefined()) {
+        queue_high_watermark_ =
+            utils::parse_size(node["queue_high_watermark"].as<std::string>());
+    }
+
+    if (node["session_queue_high_watermark"].IsDefined()) {
+        session_queue_high_watermark_ = utils::parse_size(
+            node["session_queue_high_watermark"].as<std::string>());
+    }
+
+    if (node["overload_policy"].IsDefined()) {
+        auto policy = node["overload_policy"].as<std::string>();
+
+        if (policy == "pause") {
+            overload_policy_ = MQTT_OVERLOAD_POLICY::PAUSE;
+        } else if (policy == "drop") {
+            overload_policy_ = MQTT_OVERLOAD_POLICY::DROP;
+        } else {
+            throw std::runtime_error("Unknown overload_policy: " + policy);
+        }
+    }
 }
\ No newline at end of file
@@ -23,24 +23,44 @@ public:
 
     bool acl_check(const mqtt_acl_rule_t& rule) const noexcept;
 
+    inline uint32_t io_threads() const noexcept { return io_threads_; }
+
+    inline uint32_t max_batch_bytes() const noexcept { return max_batch_bytes_; }
+
     inline uint32_t connect_timeout() const noexcept { return connect_timeout_; }
 
     inline uint32_t check_timeout_duration() const noexcept { return check_timeout_duration_; }
 
-    inline uint32_t check_waiting_map_duration() const noexcept { return check_waiting_map_duration_; }
-
     inline uint32_t max_resend_count() const noexcept { return max_resend_count_; }
 
     inline uint32_t resend_duration() const noexcept { return resend_duration_; }
 
     inline uint32_t max_waiting_time() const noexcept { return max_waiting_time_; }
 
+    inline uint32_t session_expiry_interval() const noexcept { return session_expiry_interval_; }
+
+    inline uint32_t max_inflight_messages() const noexcept { return max_inflight_messages_; }
+
     inline bool auth() const noexcept { return auth_; }
 
     inline uint32_t max_packet_size() const noexcept { return max_packet_size_; }
 
     inline uint32_t max_subscriptions() const noexcept { return max_subscriptions_; }
 
+    inline uint32_t max_queued_messages() const noexcept { return max_queued_messages_; }
+
+    inline uint32_t max_queued_bytes() const noexcept { return max_queued_bytes_; }
+
+    inline MQTT_QUEUE_POLICY queue_full_policy() const noexcept { return queue_full_policy_; }
+
+    inline bool queue_qos0_messages() const noexcept { return queue_qos0_messages_; }
+
+    inline uint32_t queue_high_watermark() const noexcept { return queue_high_watermark_; }
+
+    inline uint32_t session_queue_high_watermark() const noexcept { return session_queue_high_watermark_; }
+
+    inline MQTT_OVERLOAD_POLICY overload_policy() const noexcept { return overload_policy_; }
+
     inline std::string name() const noexcept { return name_; }
 
     inline uint32_t max_rotate_size() const noexcept { return max_rotate_size_; }
@@ -71,6 +91,19 @@ public:
         return exposer_cfg_.thread_count;
     }
 
+    inline bool store_enable() const noexcept { return store_cfg_.enable; }
+
+    inline std::string store_dir() const noexcept { return store_cfg_.dir; }
+
+    inline uint32_t store_max_log_size() const noexcept { return store_cfg_.max_log_size; }
+
+    inline uint32_t store_sync_interval() const noexcept { return store_cfg_.sync_interval; }
+
+    inline uint32_t store_sync_bytes() const noexcept { return store_cfg_.sync_bytes; }
+
+    // 日志模式只在启用存储时生效
+    inline bool store_journal() const noexcept { return store_cfg_.enable && store_cfg_.journal; }
+
 private:
     void parse_listeners(const YAML::Node& node);
 
@@ -79,15 +112,25 @@ private:
 private:
     mqtt_ssl_cfg_t default_ssl_cfg_;
     std::vector<mqtt_listener_cfg_t> listeners_;
+    uint32_t io_threads_;
+    uint32_t max_batch_bytes_;
     uint32_t connect_timeout_;
     uint32_t check_timeout_duration_;
-    uint32_t check_waiting_map_duration_;
     uint32_t max_resend_count_;
     uint32_t resend_duration_;
     uint32_t max_waiting_time_;
+    uint32_t session_expiry_interval_;
+    uint32_t max_inflight_messages_;
     bool auth_;
     uint32_t max_packet_size_;
     uint32_t max_subscriptions_;
+    uint32_t max_queued_messages_;
+    uint32_t max_queued_bytes_;
+    MQTT_QUEUE_POLICY queue_full_policy_;
+    bool queue_qos0_messages_;
+    uint32_t queue_high_watermark_;
+    uint32_t session_queue_high_watermark_;
+    MQTT_OVERLOAD_POLICY overload_policy_;
     std::string name_;
     uint32_t max_rotate_size_;
     uint32_t max_rotate_count_;
@@ -100,4 +143,5 @@ private:
     MqttAcl acl_;
     std::list<std::pair<std::string, uint8_t>> auto_subscribe_list_;
     mqtt_exposer_cfg_t exposer_cfg_;
+    mqtt_store_cfg_t store_cfg_;
 };
\ No newline at end of file
@@ -0,0 +1,392 @@
+#include "MqttDecoder.h"
+
+MQTT_RC_CODE MqttDecoder::read_byte(uint8_t& value) noexcept {
+    if (remaining() < 1) {
+        return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
+    }
+
+    value = static_cast<uint8_t>(buf_[pos_]);
+    pos_ += 1;
+
+    return MQTT_RC_CODE::ERR_SUCCESS;
+}
+
+MQTT_RC_CODE MqttDecoder::read_uint16(uint16_t& value) noexcept {
+    if (remaining() < 2) {
+        return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
+    }
+
+    uint8_t msb = static_cast<uint8_t>(buf_[pos_]);
+    uint8_t lsb = static_cast<uint8_t>(buf_[pos_ + 1]);
+
+    value = static_cast<uint16_t>((msb << 8) + lsb);
+    pos_ += 2;
+
+    return MQTT_RC_CODE::ERR_SUCCESS;
+}
+
+MQTT_RC_CODE MqttDecoder::read_bytes(std::string_view& bytes,
+                                     std::size_t n) noexcept {
+    if (remaining() < n) {
+        return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
+    }
+
+    bytes = buf_.substr(pos_, n);
+    pos_ += n;
+
+    return MQTT_RC_CODE::ERR_SUCCESS;
+}
+
+MQTT_RC_CODE MqttDecoder::read_binary(std::string_view& bytes) noexcept {
+    MQTT_RC_CODE rc;
+    uint16_t length;
+
+    rc = read_uint16(length);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    return read_bytes(bytes, length);
+}
+
+MQTT_RC_CODE MqttDecoder::read_utf8_string(std::string_view& str) noexcept {
+    MQTT_RC_CODE rc;
+
+    rc = read_binary(str);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    return check_validate_utf8(str);
+}
+
+MQTT_RC_CODE MqttDecoder::decode_connect(std::string_view buf,
+                                         mqtt_connect_packet_t& packet) {
+    MQTT_RC_CODE rc;
+    MqttDecoder decoder(buf);
+    std::string_view protocol_name;
+    uint8_t connect_flags;
+
+    rc = decoder.read_binary(protocol_name);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    if (protocol_name != "MQTT") {
+        SPDLOG_ERROR("protocol_name = [{}]", protocol_name);
+        return MQTT_RC_CODE::ERR_PROTOCOL;
+    }
+
+    rc = decoder.read_byte(packet.protocol_version);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    if (packet.protocol_version != 0x04) {
+        return MQTT_RC_CODE::ERR_SUCCESS;
+    }
+
+    rc = decoder.read_byte(connect_flags);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    packet.clean_session = connect_flags & 0x02;
+    packet.will = connect_flags & 0x04;
+    packet.will_qos = (connect_flags & 0x18) >> 3;
+    packet.will_retain = connect_flags & 0x20;
+    packet.password_flag = connect_flags & 0x40;
+    packet.username_flag = connect_flags & 0x80;
+
+    if (packet.will_qos == 3) {
+        return MQTT_RC_CODE::ERR_PROTOCOL;
+    }
+
+    if (!packet.will && (packet.will_qos != 0 || packet.will_retain)) {
+        return MQTT_RC_CODE::ERR_PROTOCOL;
+    }
+
+    rc = decoder.read_uint16(packet.keep_alive);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    rc = decoder.read_utf8_string(packet.client_id);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    // 遗嘱消息
+    if (packet.will) {
+        rc = decoder.read_utf8_string(packet.will_topic);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            return rc;
+        }
+
+        rc = check_sub_topic(packet.will_topic);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            return rc;
+        }
+
+        rc = decoder.read_binary(packet.will_payload);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            return rc;
+        }
+    }
+
+    if (packet.username_flag) {
+        rc = decoder.read_utf8_string(packet.username);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            return rc;
+        }
+    }
+
+    if (packet.password_flag) {
+        rc = decoder.read_utf8_string(packet.password);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            return rc;
+        }
+    }
+
+    return MQTT_RC_CODE::ERR_SUCCESS;
+}
+
+MQTT_RC_CODE MqttDecoder::decode_publish(std::string_view buf, uint8_t qos,
+                                         mqtt_publish_packet_t& packet) {
+    MQTT_RC_CODE rc;
+    MqttDecoder decoder(buf);
+
+    rc = decoder.read_utf8_string(packet.topic_name);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    rc = check_pub_topic(packet.topic_name);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    if (packet.topic_name.empty()) {
+        return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
+    }
+
+    if (qos > 0) {
+        rc = decoder.read_uint16(packet.packet_id);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            return rc;
+        }
+
+        if (packet.packet_id == 0) {
+            return MQTT_RC_CODE::ERR_PROTOCOL;
+        }
+    }
+
+    // 剩余部分都是消息内容, 允许为空
+    return decoder.read_bytes(packet.payload, decoder.remaining());
+}
+
+MQTT_RC_CODE MqttDecoder::decode_subscribe(std::string_view buf,
+                                           mqtt_subscribe_packet_t& packet) {
+    MQTT_RC_CODE rc;
+    MqttDecoder decoder(buf);
+    std::string_view topic_filter;
+    uint8_t qos;
+
+    rc = decoder.read_uint16(packet.packet_id);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    if (packet.packet_id == 0) {
+        return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
+    }
+
+    // 必须包含至少一对主题过滤器 和 QoS等级字段组合
+    if (decoder.remaining() == 0) {
+        return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
+    }
+
+    while (decoder.remaining() > 0) {
+        rc = decoder.read_utf8_string(topic_filter);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            return rc;
+        }
+
+        rc = check_sub_topic(topic_filter);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            return rc;
+        }
+
+        rc = decoder.read_byte(qos);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            return rc;
+        }
+
+        if (qos > 2) {
+            return MQTT_RC_CODE::ERR_PROTOCOL;
+        }
+
+        packet.topic_filters.emplace_back(topic_filter, qos);
+    }
+
+    return MQTT_RC_CODE::ERR_SUCCESS;
+}
+
+MQTT_RC_CODE MqttDecoder::decode_unsubscribe(
+    std::string_view buf, mqtt_unsubscribe_packet_t& packet) {
+    MQTT_RC_CODE rc;
+    MqttDecoder decoder(buf);
+    std::string_view topic_filter;
+
+    rc = decoder.read_uint16(packet.packet_id);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    while (decoder.remaining() > 0) {
+        rc = decoder.read_utf8_string(topic_filter);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            return rc;
+        }
+
+        packet.topic_filters.emplace_back(topic_filter);
+    }
+
+    return MQTT_RC_CODE::ERR_SUCCESS;
+}
+
+MQTT_RC_CODE MqttDecoder::decode_packet_id(std::string_view buf,
+                                           uint16_t& packet_id) {
+    MQTT_RC_CODE rc;
+    MqttDecoder decoder(buf);
+
+    rc = decoder.read_uint16(packet_id);
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
+    }
+
+    if (packet_id == 0) {
+        return MQTT_RC_CODE::ERR_PROTOCOL;
+    }
+
+    return MQTT_RC_CODE::ERR_SUCCESS;
+}
+
+MQTT_RC_CODE MqttDecoder::check_validate_utf8(std::string_view ustr) {
+    uint32_t len = ustr.length();
+    uint32_t i, j, codelen, codepoint;
+
+    if (len > 65536) return MQTT_RC_CODE::ERR_STR_LENGTH_UTF8;
+
+    // 按无符号字节处理, 否则大于 0x7F 的字节会被当作单字节字符
+    const auto* data = reinterpret_cast<const uint8_t*>(ustr.data());
+
+    for (i = 0; i < len; i++) {
+        if (data[i] == 0) {
+            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+        } else if (data[i] <= 0x7f) {
+            codelen = 1;
+            codepoint = data[i];
+        } else if ((data[i] & 0xE0) == 0xC0) {
+            if (data[i] == 0xC0 || data[i] == 0xC1) {
+                return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+            }
+            codelen = 2;
+            codepoint = (data[i] & 0x1F);
+        } else if ((data[i] & 0xF0) == 0xE0) {
+            codelen = 3;
+            codepoint = (data[i] & 0x0F);
+        } else if ((data[i] & 0xF8) == 0xF0) {
+            if (data[i] > 0xF4) {
+                return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+            }
+            codelen = 4;
+            codepoint = (data[i] & 0x07);
+        } else {
+            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+        }
+
+        if (i + codelen > len) {
+            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+        }
+
+        for (j = 0; j < codelen - 1; j++) {
+            if ((data[++i] & 0xC0) != 0x80) {
+                return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+            }
+            codepoint = (codepoint << 6) | (data[i] & 0x3F);
+        }
+
+        if (codepoint >= 0xD800 && codepoint <= 0xDFFF) {
+            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+        }
+
+        if (codelen == 3 && codepoint < 0x0800) {
+            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+        } else if (codelen == 4 &&
+                   (codepoint < 0x10000 || codepoint > 0x10FFFF)) {
+            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+        }
+
+        if (codepoint >= 0xFDD0 && codepoint <= 0xFDEF) {
+            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+        }
+        if ((codepoint & 0xFFFF) == 0xFFFE || (codepoint & 0xFFFF) == 0xFFFF) {
+            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+        }
+
+        if (codepoint <= 0x001F ||
+            (codepoint >= 0x007F && codepoint <= 0x009F)) {
+            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
+        }
+    }
+
+    return MQTT_RC_CODE::ERR_SUCCESS;
+}
+
+MQTT_RC_CODE MqttDecoder::check_sub_topic(std::string_view topic_name) {
+    if (topic_name.empty()) {
+        return MQTT_RC_CODE::ERR_SUB_TOPIC_NAME;
+    }
+
+    uint32_t slen = topic_name.length();
+
+    if (slen > 65535) {
+        return MQTT_RC_CODE::ERR_STR_LENGTH_UTF8;
+    }
+
+    for (uint32_t i = 0; i < slen; i++) {
+        if (topic_name[i] == '+') {
+            // 只能单独占一个主题层级
+            if ((i == 0 || topic_name[i - 1] == '/') &&
+                (i == slen - 1 || topic_name[i + 1] == '/')) {
+            } else {
+                return MQTT_RC_CODE::ERR_SUB_TOPIC_NAME;
+            }
+
+        } else if (topic_name[i] == '#') {
+            // 只能是最后一个且只有当没有其它字符时前面才能没有 '/'
+            if (i == slen - 1 && (i == 0 || topic_name[i - 1] == '/')) {
+            } else {
+                return MQTT_RC_CODE::ERR_SUB_TOPIC_NAME;
+            }
+        }
+    }
+
+    return MQTT_RC_CODE::ERR_SUCCESS;
+}
+
+MQTT_RC_CODE MqttDecoder::check_pub_topic(std::string_view topic_name) {
+    if (topic_name.length() > 65535) {
+        return MQTT_RC_CODE::ERR_STR_LENGTH_UTF8;
+    }
+
+    // 不能向包含通配符 #、+ 的主题发布消息
+    for (auto ch : topic_name) {
+        if (ch == '+' || ch == '#') {
+            return MQTT_RC_CODE::ERR_PUB_TOPIC_NAME;
+        }
+    }
+
+    return MQTT_RC_CODE::ERR_SUCCESS;
+}
\ No newline at end of file
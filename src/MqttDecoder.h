@@ -0,0 +1,80 @@
+#pragma once
+
+#include "MqttCommon.h"
+
+// 以下报文结构中的字符串均指向报文缓冲区, 缓冲区被修改或释放后不能再使用
+
+struct mqtt_connect_packet_t {
+    uint8_t protocol_version = 0;
+    bool clean_session = false;
+    bool will = false;
+    uint8_t will_qos = 0;
+    bool will_retain = false;
+    bool username_flag = false;
+    bool password_flag = false;
+    uint16_t keep_alive = 0;
+    std::string_view client_id;
+    std::string_view will_topic;
+    std::string_view will_payload;
+    std::string_view username;
+    std::string_view password;
+};
+
+struct mqtt_publish_packet_t {
+    std::string_view topic_name;
+    uint16_t packet_id = 0;
+    std::string_view payload;
+};
+
+struct mqtt_subscribe_packet_t {
+    uint16_t packet_id = 0;
+    std::vector<std::pair<std::string_view, uint8_t>> topic_filters;
+};
+
+struct mqtt_unsubscribe_packet_t {
+    uint16_t packet_id = 0;
+    std::vector<std::string_view> topic_filters;
+};
+
+// MQTT 3.1.1 报文解码, 在完整的可变报头和有效载荷上同步解析, 所有读取都做边界检查
+class MqttDecoder {
+public:
+    explicit MqttDecoder(std::string_view buf) noexcept : buf_(buf), pos_(0) {}
+
+    ~MqttDecoder() = default;
+
+    MQTT_RC_CODE read_byte(uint8_t& value) noexcept;
+
+    MQTT_RC_CODE read_uint16(uint16_t& value) noexcept;
+
+    MQTT_RC_CODE read_bytes(std::string_view& bytes, std::size_t n) noexcept;
+
+    // 读取两字节长度前缀的二进制数据
+    MQTT_RC_CODE read_binary(std::string_view& bytes) noexcept;
+
+    MQTT_RC_CODE read_utf8_string(std::string_view& str) noexcept;
+
+    inline std::size_t remaining() const noexcept { return buf_.length() - pos_; }
+
+    // 协议版本不是 3.1.1 时只解析到协议版本, 由调用方回复 CONNACK
+    static MQTT_RC_CODE decode_connect(std::string_view buf, mqtt_connect_packet_t& packet);
+
+    static MQTT_RC_CODE decode_publish(std::string_view buf, uint8_t qos, mqtt_publish_packet_t& packet);
+
+    static MQTT_RC_CODE decode_subscribe(std::string_view buf, mqtt_subscribe_packet_t& packet);
+
+    static MQTT_RC_CODE decode_unsubscribe(std::string_view buf, mqtt_unsubscribe_packet_t& packet);
+
+    // PUBACK、PUBREC、PUBREL、PUBCOMP 只包含报文标识符
+    static MQTT_RC_CODE decode_packet_id(std::string_view buf, uint16_t& packet_id);
+
+    static MQTT_RC_CODE check_validate_utf8(std::string_view ustr);
+
+    static MQTT_RC_CODE check_sub_topic(std::string_view topic_name);
+
+    static MQTT_RC_CODE check_pub_topic(std::string_view topic_name);
+
+private:
+    std::string_view buf_;
+    std::size_t pos_;
+};
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include "MqttEncoder.h"
+
+MQTT_RC_CODE MqttEncoder::encode_fixed_header(std::string& packet, uint8_t cmd,
+                                              uint32_t remaining_length) {
+    uint8_t remaining_bytes[5], byte;
+    uint8_t remaining_count = 0;
+
+    do {
+        byte = remaining_length % 0x80;
+        remaining_length /= 0x80;
+
+        if (remaining_length > 0) {
+            byte |= 0x80;
+        }
+
+        remaining_bytes[remaining_count] = byte;
+
+        remaining_count++;
+
+    } while (remaining_length > 0 && remaining_count < 5);
+
+    if (remaining_count == 5) {
+        return MQTT_RC_CODE::ERR_PAYLOAD_SIZE;
+    }
+
+    packet.reserve(packet.length() + 1 + remaining_count);
+    packet.push_back(cmd);
+
+    // remaining_count 至少为 1
+    for (uint8_t idx = 0; idx < remaining_count; idx++) {
+        packet.push_back(remaining_bytes[idx]);
+    }
+
+    return MQTT_RC_CODE::ERR_SUCCESS;
+}
\ No newline at end of file
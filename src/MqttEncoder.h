@@ -0,0 +1,10 @@
+#pragma once
+
+#include "MqttCommon.h"
+
+// MQTT 3.1.1 报文编码
+class MqttEncoder {
+public:
+    // 在 packet 末尾追加固定报头, 剩余长度超过协议上限时返回 ERR_PAYLOAD_SIZE
+    static MQTT_RC_CODE encode_fixed_header(std::string& packet, uint8_t cmd, uint32_t remaining_length);
+};
\ No newline at end of file
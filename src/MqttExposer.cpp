@@ -8,11 +8,21 @@ MqttExposer::MqttExposer() : is_running_(false) {}
 
 // clang-format off
 const static std::string s_mqtt_active_connections      = "mqtt_active_connections";
+const static std::string s_mqtt_accept_connections_count = "mqtt_accept_connections_count";
+const static std::string s_mqtt_write_batch_packets     = "mqtt_write_batch_packets";
+const static std::string s_mqtt_write_batch_bytes       = "mqtt_write_batch_bytes";
 const static std::string s_mqtt_pub_topic_count         = "mqtt_pub_topic_count";
 const static std::string s_mqtt_sub_topic_count         = "mqtt_sub_topic_count";
 const static std::string s_mqtt_unsub_topic_count       = "mqtt_unsub_topic_count";
 const static std::string s_mqtt_pub_topic_limit_count   = "mqtt_pub_topic_limit_count";
 const static std::string s_mqtt_sub_topic_limit_count   = "mqtt_sub_topic_limit_count";
+const static std::string s_mqtt_pub_bytes_limit_count   = "mqtt_pub_bytes_limit_count";
+const static std::string s_mqtt_conn_rate_limit_count   = "mqtt_conn_rate_limit_count";
+const static std::string s_mqtt_max_connections_limit_count = "mqtt_max_connections_limit_count";
+const static std::string s_mqtt_offline_sessions         = "mqtt_offline_sessions";
+const static std::string s_mqtt_dropped_messages_count   = "mqtt_dropped_messages_count";
+const static std::string s_mqtt_expired_sessions_count   = "mqtt_expired_sessions_count";
+const static std::string s_mqtt_paused_publishers_count  = "mqtt_paused_publishers_count";
 // clang-format on
 
 // use RVO
@@ -73,11 +83,21 @@ bool MqttExposer::run() {
     }
 
     init_mqtt_active_connections_metric();
+    init_mqtt_accept_connections_count_metric();
+    init_mqtt_write_batch_packets_metric();
+    init_mqtt_write_batch_bytes_metric();
     init_mqtt_pub_topic_count_metric();
     init_mqtt_sub_topic_count_metric();
     init_mqtt_unsub_topic_count_metric();
     init_mqtt_pub_topic_limit_count_metric();
     init_mqtt_sub_topic_limit_count_metric();
+    init_mqtt_pub_bytes_limit_count_metric();
+    init_mqtt_conn_rate_limit_count_metric();
+    init_mqtt_max_connections_limit_count_metric();
+    init_mqtt_offline_sessions_metric();
+    init_mqtt_dropped_messages_count_metric();
+    init_mqtt_expired_sessions_count_metric();
+    init_mqtt_paused_publishers_count_metric();
 
     http_server_ = std::make_unique<coro_http_server>(
         MqttConfig::getInstance()->exposer_thread_count(),
@@ -150,6 +170,41 @@ void MqttExposer::init_mqtt_active_connections_metric() {
         {s_get_mqtt_protocol_str(MQTT_PROTOCOL::WSS)}, 0);
 }
 
+void MqttExposer::init_mqtt_accept_connections_count_metric() {
+    auto [_, m] = mqtt_dynamic_metric_manager::instance()
+                      ->create_metric_dynamic<ylt::metric::dynamic_counter_3t>(
+                          s_mqtt_accept_connections_count,
+                          "Number of accepted MQTT connections per acceptor",
+                          std::array<std::string, 3>{"protocol", "port",
+                                                     "acceptor"});
+
+    mqtt_accept_connections_count_metric_.swap(m);
+}
+
+void MqttExposer::init_mqtt_write_batch_packets_metric() {
+    auto [_, m] =
+        mqtt_dynamic_metric_manager::instance()
+            ->create_metric_dynamic<ylt::metric::dynamic_histogram_1t>(
+                s_mqtt_write_batch_packets,
+                "Number of MQTT packets coalesced into one write",
+                std::vector<double>{1, 2, 4, 8, 16, 32, 64, 128, 256},
+                std::array<std::string, 1>{"protocol"});
+
+    mqtt_write_batch_packets_metric_.swap(m);
+}
+
+void MqttExposer::init_mqtt_write_batch_bytes_metric() {
+    auto [_, m] =
+        mqtt_dynamic_metric_manager::instance()
+            ->create_metric_dynamic<ylt::metric::dynamic_histogram_1t>(
+                s_mqtt_write_batch_bytes,
+                "Number of bytes coalesced into one write",
+                std::vector<double>{64, 256, 1024, 4096, 16384, 65536, 262144},
+                std::array<std::string, 1>{"protocol"});
+
+    mqtt_write_batch_bytes_metric_.swap(m);
+}
+
 void MqttExposer::init_mqtt_pub_topic_count_metric() {
     auto [_, m] =
         mqtt_dynamic_metric_manager::instance()
@@ -202,6 +257,78 @@ void MqttExposer::init_mqtt_sub_topic_limit_count_metric() {
     mqtt_sub_topic_limit_count_metric_.swap(m);
 }
 
+void MqttExposer::init_mqtt_pub_bytes_limit_count_metric() {
+    auto [_, m] =
+        mqtt_dynamic_metric_manager::instance()
+            ->create_metric_dynamic<ylt::metric::dynamic_counter_1t>(
+                s_mqtt_pub_bytes_limit_count,
+                "Number of times MQTT publishers were paused by byte rate",
+                std::array<std::string, 1>{"limit_group"});
+
+    mqtt_pub_bytes_limit_count_metric_.swap(m);
+}
+
+void MqttExposer::init_mqtt_conn_rate_limit_count_metric() {
+    auto [_, m] =
+        mqtt_dynamic_metric_manager::instance()
+            ->create_metric_dynamic<ylt::metric::dynamic_counter_1t>(
+                s_mqtt_conn_rate_limit_count,
+                "Number of MQTT connections limited by connection rate",
+                std::array<std::string, 1>{"scope"});
+
+    mqtt_conn_rate_limit_count_metric_.swap(m);
+}
+
+void MqttExposer::init_mqtt_max_connections_limit_count_metric() {
+    auto [_, m] =
+        mqtt_dynamic_metric_manager::instance()
+            ->create_metric_dynamic<ylt::metric::dynamic_counter_1t>(
+                s_mqtt_max_connections_limit_count,
+                "Number of MQTT connections refused by max connections",
+                std::array<std::string, 1>{"limit_group"});
+
+    mqtt_max_connections_limit_count_metric_.swap(m);
+}
+
+void MqttExposer::init_mqtt_offline_sessions_metric() {
+    auto [_, m] = mqtt_static_metric_manager::instance()
+                      ->create_metric_static<ylt::metric::gauge_t>(
+                          s_mqtt_offline_sessions,
+                          "Number of offline persistent MQTT sessions");
+
+    mqtt_offline_sessions_metric_.swap(m);
+}
+
+void MqttExposer::init_mqtt_dropped_messages_count_metric() {
+    auto [_, m] =
+        mqtt_dynamic_metric_manager::instance()
+            ->create_metric_dynamic<ylt::metric::dynamic_counter_1t>(
+                s_mqtt_dropped_messages_count,
+                "Number of MQTT messages dropped before delivery",
+                std::array<std::string, 1>{"reason"});
+
+    mqtt_dropped_messages_count_metric_.swap(m);
+}
+
+void MqttExposer::init_mqtt_expired_sessions_count_metric() {
+    auto [_, m] = mqtt_static_metric_manager::instance()
+                      ->create_metric_static<ylt::metric::counter_t>(
+                          s_mqtt_expired_sessions_count,
+                          "Number of expired persistent MQTT sessions");
+
+    mqtt_expired_sessions_count_metric_.swap(m);
+}
+
+void MqttExposer::init_mqtt_paused_publishers_count_metric() {
+    auto [_, m] =
+        mqtt_static_metric_manager::instance()
+            ->create_metric_static<ylt::metric::counter_t>(
+                s_mqtt_paused_publishers_count,
+                "Number of times MQTT publishers were paused by backlog");
+
+    mqtt_paused_publishers_count_metric_.swap(m);
+}
+
 void MqttExposer::inc_mqtt_active_connections(MQTT_PROTOCOL protocol) {
     if (!mqtt_active_connections_metric_) {
         return;
@@ -218,6 +345,30 @@ void MqttExposer::dec_mqtt_active_connections(MQTT_PROTOCOL protocol) {
     mqtt_active_connections_metric_->dec({s_get_mqtt_protocol_str(protocol)});
 }
 
+void MqttExposer::inc_mqtt_accept_connections_count_metric(
+    MQTT_PROTOCOL protocol, uint16_t port, std::size_t acceptor_id) {
+    if (!mqtt_accept_connections_count_metric_) {
+        return;
+    }
+
+    mqtt_accept_connections_count_metric_->inc(
+        {s_get_mqtt_protocol_str(protocol), std::to_string(port),
+         std::to_string(acceptor_id)});
+}
+
+void MqttExposer::observe_mqtt_write_batch_metric(MQTT_PROTOCOL protocol,
+                                                  std::size_t packets,
+                                                  std::size_t bytes) {
+    if (!mqtt_write_batch_packets_metric_ || !mqtt_write_batch_bytes_metric_) {
+        return;
+    }
+
+    std::array<std::string, 1> labels{s_get_mqtt_protocol_str(protocol)};
+
+    mqtt_write_batch_packets_metric_->observe(labels, packets);
+    mqtt_write_batch_bytes_metric_->observe(labels, bytes);
+}
+
 void MqttExposer::inc_mqtt_pub_topic_count_metric(std::string client_id,
                                                   MQTT_QUALITY qos) {
     if (!mqtt_pub_topic_count_metric_) {
@@ -270,4 +421,91 @@ void MqttExposer::inc_mqtt_sub_topic_limit_count_metric(std::string limit_group,
     mqtt_sub_topic_limit_count_metric_->inc({std::move(limit_group),
                                              std::move(client_id),
                                              s_get_mqtt_qos_str(qos)});
+}
+
+void MqttExposer::inc_mqtt_pub_bytes_limit_count_metric(
+    std::string limit_group) {
+    if (!mqtt_pub_bytes_limit_count_metric_) {
+        return;
+    }
+
+    mqtt_pub_bytes_limit_count_metric_->inc({std::move(limit_group)});
+}
+
+void MqttExposer::inc_mqtt_ip_conn_rate_limit_count_metric() {
+    if (!mqtt_conn_rate_limit_count_metric_) {
+        return;
+    }
+
+    mqtt_conn_rate_limit_count_metric_->inc({"ip"});
+}
+
+void MqttExposer::inc_mqtt_global_conn_rate_limit_count_metric() {
+    if (!mqtt_conn_rate_limit_count_metric_) {
+        return;
+    }
+
+    mqtt_conn_rate_limit_count_metric_->inc({"global"});
+}
+
+void MqttExposer::inc_mqtt_max_connections_limit_count_metric(
+    std::string limit_group) {
+    if (!mqtt_max_connections_limit_count_metric_) {
+        return;
+    }
+
+    mqtt_max_connections_limit_count_metric_->inc({std::move(limit_group)});
+}
+
+void MqttExposer::inc_mqtt_offline_sessions() {
+    if (!mqtt_offline_sessions_metric_) {
+        return;
+    }
+
+    mqtt_offline_sessions_metric_->inc();
+}
+
+void MqttExposer::dec_mqtt_offline_sessions() {
+    if (!mqtt_offline_sessions_metric_) {
+        return;
+    }
+
+    mqtt_offline_sessions_metric_->dec();
+}
+
+void MqttExposer::inc_mqtt_queue_dropped_count_metric(std::size_t count) {
+    if (!mqtt_dropped_messages_count_metric_ || count == 0) {
+        return;
+    }
+
+    mqtt_dropped_messages_count_metric_->inc({"queue_full"}, count);
+}
+
+void MqttExposer::inc_mqtt_session_expired_count_metric(std::size_t dropped) {
+    if (!mqtt_expired_sessions_count_metric_ ||
+        !mqtt_dropped_messages_count_metric_) {
+        return;
+    }
+
+    mqtt_expired_sessions_count_metric_->inc();
+
+    if (dropped > 0) {
+        mqtt_dropped_messages_count_metric_->inc({"session_expired"}, dropped);
+    }
+}
+
+void MqttExposer::inc_mqtt_overload_dropped_count_metric(std::size_t count) {
+    if (!mqtt_dropped_messages_count_metric_ || count == 0) {
+        return;
+    }
+
+    mqtt_dropped_messages_count_metric_->inc({"overload"}, count);
+}
+
+void MqttExposer::inc_mqtt_paused_publishers_count_metric() {
+    if (!mqtt_paused_publishers_count_metric_) {
+        return;
+    }
+
+    mqtt_paused_publishers_count_metric_->inc();
 }
\ No newline at end of file
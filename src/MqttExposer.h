@@ -24,6 +24,10 @@ public:
 
     void dec_mqtt_active_connections(MQTT_PROTOCOL protocol);
 
+    void inc_mqtt_accept_connections_count_metric(MQTT_PROTOCOL protocol, uint16_t port, std::size_t acceptor_id);
+
+    void observe_mqtt_write_batch_metric(MQTT_PROTOCOL protocol, std::size_t packets, std::size_t bytes);
+
     void inc_mqtt_pub_topic_count_metric(std::string client_id, MQTT_QUALITY qos);
 
     void inc_mqtt_sub_topic_count_metric(std::string client_id, MQTT_QUALITY qos);
@@ -34,9 +38,42 @@ public:
 
     void inc_mqtt_sub_topic_limit_count_metric(std::string limit_group, std::string client_id, MQTT_QUALITY qos);
 
+    // 超出字节速率暂停读取
+    void inc_mqtt_pub_bytes_limit_count_metric(std::string limit_group);
+
+    // 同一个 IP 超出连接速率被关闭的连接
+    void inc_mqtt_ip_conn_rate_limit_count_metric();
+
+    // 超出全局连接速率暂停接受连接
+    void inc_mqtt_global_conn_rate_limit_count_metric();
+
+    // 限制组的连接数达到上限被拒绝的连接
+    void inc_mqtt_max_connections_limit_count_metric(std::string limit_group);
+
+    void inc_mqtt_offline_sessions();
+
+    void dec_mqtt_offline_sessions();
+
+    // 会话的待投递队列超过上限时丢弃的消息
+    void inc_mqtt_queue_dropped_count_metric(std::size_t count);
+
+    // 离线会话过期, dropped 为随会话一起删除的消息数
+    void inc_mqtt_session_expired_count_metric(std::size_t dropped);
+
+    // 积压超过水位时按 drop 策略丢弃的消息
+    void inc_mqtt_overload_dropped_count_metric(std::size_t count);
+
+    void inc_mqtt_paused_publishers_count_metric();
+
 private:
     void init_mqtt_active_connections_metric();
 
+    void init_mqtt_accept_connections_count_metric();
+
+    void init_mqtt_write_batch_packets_metric();
+
+    void init_mqtt_write_batch_bytes_metric();
+
     void init_mqtt_pub_topic_count_metric();
 
     void init_mqtt_sub_topic_count_metric();
@@ -47,6 +84,20 @@ private:
 
     void init_mqtt_sub_topic_limit_count_metric();
 
+    void init_mqtt_pub_bytes_limit_count_metric();
+
+    void init_mqtt_conn_rate_limit_count_metric();
+
+    void init_mqtt_max_connections_limit_count_metric();
+
+    void init_mqtt_offline_sessions_metric();
+
+    void init_mqtt_dropped_messages_count_metric();
+
+    void init_mqtt_expired_sessions_count_metric();
+
+    void init_mqtt_paused_publishers_count_metric();
+
 private:
     bool is_running_;
     std::unique_ptr<coro_http::coro_http_server> http_server_;
@@ -54,9 +105,21 @@ private:
 
     // dynamic metrics
     std::shared_ptr<ylt::metric::dynamic_gauge_1t> mqtt_active_connections_metric_;
+    std::shared_ptr<ylt::metric::dynamic_counter_3t> mqtt_accept_connections_count_metric_;
+    std::shared_ptr<ylt::metric::dynamic_histogram_1t> mqtt_write_batch_packets_metric_;
+    std::shared_ptr<ylt::metric::dynamic_histogram_1t> mqtt_write_batch_bytes_metric_;
     std::shared_ptr<ylt::metric::dynamic_counter_2t> mqtt_pub_topic_count_metric_;
     std::shared_ptr<ylt::metric::dynamic_counter_2t> mqtt_sub_topic_count_metric_;
     std::shared_ptr<ylt::metric::dynamic_counter_2t> mqtt_unsub_topic_count_metric_;
     std::shared_ptr<ylt::metric::dynamic_counter_3t> mqtt_pub_topic_limit_count_metric_;
     std::shared_ptr<ylt::metric::dynamic_counter_3t> mqtt_sub_topic_limit_count_metric_;
+    std::shared_ptr<ylt::metric::dynamic_counter_1t> mqtt_pub_bytes_limit_count_metric_;
+    std::shared_ptr<ylt::metric::dynamic_counter_1t> mqtt_conn_rate_limit_count_metric_;
+    std::shared_ptr<ylt::metric::dynamic_counter_1t> mqtt_max_connections_limit_count_metric_;
+    std::shared_ptr<ylt::metric::dynamic_counter_1t> mqtt_dropped_messages_count_metric_;
+
+    // static metrics
+    std::shared_ptr<ylt::metric::gauge_t> mqtt_offline_sessions_metric_;
+    std::shared_ptr<ylt::metric::counter_t> mqtt_expired_sessions_count_metric_;
+    std::shared_ptr<ylt::metric::counter_t> mqtt_paused_publishers_count_metric_;
 };
\ No newline at end of file
@@ -1,74 +1,161 @@
 #include "MqttLimits.h"
 
+#include "MqttUtils.h"
 #include "yaml-cpp/yaml.h"
 
-MqttLimits::MqttLimits() : enable_(false) {}
+// 令牌已经补满的 IP 连接速率记录的清理间隔
+constexpr auto IP_CONN_SWEEP_INTERVAL = std::chrono::seconds(10);
+
+MqttLimits::MqttLimits()
+    : enable_(false),
+      match_all_group_(NO_GROUP),
+      ip_conn_rate_(0),
+      ip_conn_sweep_time_(std::chrono::steady_clock::now()) {
+    default_group_.name = "default";
+}
 
 bool MqttLimits::load_limits(const std::string& limits_file) {
     try {
         YAML::Node root = YAML::LoadFile(limits_file);
 
+        if (root["global"].IsDefined() && root["global"]["limit"].IsDefined()) {
+            const auto& nodeLimit = root["global"]["limit"];
+
+            if (nodeLimit["pub_rate"].IsDefined()) {
+                global_pub_rate_limitor_ = std::make_unique<MqttTokenBucket>(
+                    nodeLimit["pub_rate"].as<double>());
+            }
+
+            if (nodeLimit["sub_rate"].IsDefined()) {
+                global_sub_rate_limitor_ = std::make_unique<MqttTokenBucket>(
+                    nodeLimit["sub_rate"].as<double>());
+            }
+
+            if (nodeLimit["pub_bytes_rate"].IsDefined()) {
+                global_pub_bytes_rate_limitor_ =
+                    std::make_unique<MqttTokenBucket>(utils::parse_size(
+                        nodeLimit["pub_bytes_rate"].as<std::string>()));
+            }
+
+            if (nodeLimit["conn_rate"].IsDefined()) {
+                global_conn_rate_limitor_ = std::make_unique<MqttTokenBucket>(
+                    nodeLimit["conn_rate"].as<double>());
+            }
+
+            if (nodeLimit["ip_conn_rate"].IsDefined()) {
+                ip_conn_rate_ = nodeLimit["ip_conn_rate"].as<double>();
+            }
+        }
+
         std::unordered_set<std::string> group_name_set;
 
         for (const auto& limit_group : root["limit_groups"]) {
-            mqtt_limit_group_cfg_t limit_group_cfg;
+            std::string name = limit_group["name"].as<std::string>();
+
+            if (name.empty() || !group_name_set.insert(name).second) {
+                throw std::runtime_error("invalid limit group name: " + name);
+            }
 
-            limit_group_cfg.name = limit_group["name"].as<std::string>();
+            mqtt_limit_group_t* group = &default_group_;
+            std::size_t group_index = groups_.size();
 
-            if (limit_group_cfg.name.empty() ||
-                group_name_set.contains(limit_group_cfg.name)) {
-                throw std::runtime_error("invalid limit group name: " +
-                                         limit_group_cfg.name);
+            if (name != "default") {
+                groups_.emplace_back(std::make_unique<mqtt_limit_group_t>());
+                group = groups_.back().get();
+                group->name = name;
             }
 
-            if (limit_group["selector"].IsDefined()) {
-                const auto& nodeSelector = limit_group["selector"];
+            if (limit_group["limit"].IsDefined()) {
+                const auto& nodeLimit = limit_group["limit"];
+
+                if (nodeLimit["pub_rate"].IsDefined()) {
+                    group->pub_rate_limitor = std::make_unique<MqttTokenBucket>(
+                        nodeLimit["pub_rate"].as<double>());
+                }
 
-                mqtt_limit_selector_cfg_t limit_selector_cfg;
+                if (nodeLimit["sub_rate"].IsDefined()) {
+                    group->sub_rate_limitor = std::make_unique<MqttTokenBucket>(
+                        nodeLimit["sub_rate"].as<double>());
+                }
 
-                if (nodeSelector["client_id"].IsDefined()) {
-                    limit_selector_cfg.client_id =
-                        nodeSelector["client_id"]
-                            .as<std::vector<std::string>>();
+                if (nodeLimit["client_pub_rate"].IsDefined()) {
+                    group->client_pub_rate =
+                        nodeLimit["client_pub_rate"].as<double>();
                 }
 
-                if (nodeSelector["client_id_prefix"].IsDefined()) {
-                    limit_selector_cfg.client_id_prefix =
-                        nodeSelector["client_id_prefix"]
-                            .as<std::vector<std::string>>();
+                if (nodeLimit["client_sub_rate"].IsDefined()) {
+                    group->client_sub_rate =
+                        nodeLimit["client_sub_rate"].as<double>();
                 }
 
-                if (nodeSelector["client_id_regex"].IsDefined()) {
-                    limit_selector_cfg.client_id_regex =
-                        nodeSelector["client_id_regex"]
-                            .as<std::vector<std::string>>();
+                if (nodeLimit["pub_bytes_rate"].IsDefined()) {
+                    group->pub_bytes_rate_limitor =
+                        std::make_unique<MqttTokenBucket>(utils::parse_size(
+                            nodeLimit["pub_bytes_rate"].as<std::string>()));
                 }
 
-                if (limit_group_cfg.name != "default") {
-                    limit_group_cfg.selector =
-                        std::make_unique<mqtt_limit_selector_cfg_t>(
-                            limit_selector_cfg);
+                if (nodeLimit["client_pub_bytes_rate"].IsDefined()) {
+                    group->client_pub_bytes_rate = utils::parse_size(
+                        nodeLimit["client_pub_bytes_rate"].as<std::string>());
+                }
+
+                if (nodeLimit["max_connections"].IsDefined()) {
+                    group->max_connections =
+                        nodeLimit["max_connections"].as<uint32_t>();
                 }
             }
 
-            if (limit_group["limit"].IsDefined()) {
-                const auto& nodeLimit = limit_group["limit"];
+            // default 组的选择器不起作用
+            if (group == &default_group_) {
+                continue;
+            }
 
-                if (nodeLimit["pub_rate"].IsDefined()) {
-                    double pub_rate = nodeLimit["pub_rate"].as<double>();
-                    pub_rate_limitor_[limit_group_cfg.name] =
-                        std::make_unique<MqttTokenBucket>(pub_rate);
+            if (!limit_group["selector"].IsDefined()) {
+                match_all_group_ = std::min(match_all_group_, group_index);
+                continue;
+            }
+
+            const auto& nodeSelector = limit_group["selector"];
+
+            // 同一个选择器出现在多个组中时, 只保留第一个组
+            if (nodeSelector["client_id"].IsDefined()) {
+                for (auto& cid :
+                     nodeSelector["client_id"].as<std::vector<std::string>>()) {
+                    client_id_groups_.try_emplace(std::move(cid), group_index);
                 }
+            }
 
-                if (nodeLimit["sub_rate"].IsDefined()) {
-                    double sub_rate = nodeLimit["sub_rate"].as<double>();
-                    sub_rate_limitor_[limit_group_cfg.name] =
-                        std::make_unique<MqttTokenBucket>(sub_rate);
+            if (nodeSelector["client_id_prefix"].IsDefined()) {
+                for (const auto& cid_prefix :
+                     nodeSelector["client_id_prefix"]
+                         .as<std::vector<std::string>>()) {
+                    prefix_node_t* node = &client_id_prefix_root_;
+                    for (char c : cid_prefix) {
+                        auto& child = node->children[c];
+                        if (!child) {
+                            child = std::make_unique<prefix_node_t>();
+                        }
+                        node = child.get();
+                    }
+
+                    node->group_index =
+                        std::min(node->group_index, group_index);
                 }
             }
 
-            if (limit_group_cfg.name != "default") {
-                limit_groups_cfg_.emplace_back(std::move(limit_group_cfg));
+            if (nodeSelector["client_id_regex"].IsDefined()) {
+                for (const auto& cid_regex :
+                     nodeSelector["client_id_regex"]
+                         .as<std::vector<std::string>>()) {
+                    try {
+                        client_id_regex_groups_.emplace_back(
+                            group_index,
+                            std::regex(cid_regex, std::regex::optimize));
+                    } catch (const std::exception& e) {
+                        SPDLOG_ERROR("client_id_regex [{}] error: [{}]",
+                                     cid_regex, e.what());
+                    }
+                }
             }
         }
 
@@ -80,77 +167,221 @@ bool MqttLimits::load_limits(const std::string& limits_file) {
     return true;
 }
 
-bool MqttLimits::check_pub_limit(const std::string& client_id,
-                                 std::string& limit_group) {
+const mqtt_limit_group_t* MqttLimits::get_group(
+    const std::string& client_id) const {
     if (!enable_) {
-        limit_group = "default";
-        return true;
+        return &default_group_;
     }
 
-    limit_group = get_group_name(client_id);
+    // 各类选择器分别找到序号最小的组, 结果和按配置顺序逐个检查相同
+    std::size_t group_index = match_all_group_;
 
-    auto it = pub_rate_limitor_.find(limit_group);
-    if (it == pub_rate_limitor_.end() || it->second == nullptr) {
-        return true;
+    auto iter = client_id_groups_.find(client_id);
+    if (iter != client_id_groups_.end()) {
+        group_index = std::min(group_index, iter->second);
+    }
+
+    const prefix_node_t* node = &client_id_prefix_root_;
+    group_index = std::min(group_index, node->group_index);
+    for (char c : client_id) {
+        auto child = node->children.find(c);
+        if (child == node->children.end()) {
+            break;
+        }
+        node = child->second.get();
+        group_index = std::min(group_index, node->group_index);
+    }
+
+    // 正则表达式按组的顺序存放, 只需要检查排在已匹配的组之前的
+    for (const auto& [index, cid_regex] : client_id_regex_groups_) {
+        if (index >= group_index) {
+            break;
+        }
+
+        if (std::regex_match(client_id, cid_regex)) {
+            group_index = index;
+            break;
+        }
+    }
+
+    if (group_index == NO_GROUP) {
+        return &default_group_;
     }
 
-    return it->second->tryConsume();
+    return groups_[group_index].get();
 }
 
-bool MqttLimits::check_sub_limit(const std::string& client_id,
-                                 std::string& limit_group) {
-    if (!enable_) {
-        limit_group = "default";
-        return true;
+bool MqttLimits::check_pub_limit(mqtt_client_limit_t& limit) {
+    return check_limit(limit.pub_rate_limitor, limit.group->client_pub_rate,
+                       limit.group->pub_rate_limitor.get(),
+                       global_pub_rate_limitor_.get());
+}
+
+bool MqttLimits::check_sub_limit(mqtt_client_limit_t& limit) {
+    return check_limit(limit.sub_rate_limitor, limit.group->client_sub_rate,
+                       limit.group->sub_rate_limitor.get(),
+                       global_sub_rate_limitor_.get());
+}
+
+std::chrono::steady_clock::duration MqttLimits::consume_pub_bytes(
+    mqtt_client_limit_t& limit, std::size_t bytes) {
+    double client_rate = limit.group->client_pub_bytes_rate;
+
+    if (client_rate > 0 && !limit.pub_bytes_rate_limitor) {
+        limit.pub_bytes_rate_limitor = acquire_bucket(client_rate);
     }
 
-    limit_group = get_group_name(client_id);
+    // 三级都记入这条消息, 暂停到最慢的一级恢复为止
+    double seconds = 0;
 
-    auto it = sub_rate_limitor_.find(limit_group);
-    if (it == sub_rate_limitor_.end() || it->second == nullptr) {
+    for (MqttTokenBucket* limitor : {limit.pub_bytes_rate_limitor.get(),
+                                     limit.group->pub_bytes_rate_limitor.get(),
+                                     global_pub_bytes_rate_limitor_.get()}) {
+        if (limitor) {
+            seconds = std::max(seconds, limitor->consume(bytes));
+        }
+    }
+
+    return to_duration(seconds);
+}
+
+bool MqttLimits::add_connection(mqtt_client_limit_t& limit) {
+    const mqtt_limit_group_t* group = limit.group;
+
+    uint32_t connections = group->connections.fetch_add(1);
+
+    if (group->max_connections > 0 && connections >= group->max_connections) {
+        group->connections.fetch_sub(1);
+        return false;
+    }
+
+    limit.connected = true;
+    return true;
+}
+
+void MqttLimits::release(mqtt_client_limit_t& limit) {
+    if (limit.pub_rate_limitor) {
+        release_bucket(std::move(limit.pub_rate_limitor));
+    }
+
+    if (limit.sub_rate_limitor) {
+        release_bucket(std::move(limit.sub_rate_limitor));
+    }
+
+    if (limit.pub_bytes_rate_limitor) {
+        release_bucket(std::move(limit.pub_bytes_rate_limitor));
+    }
+
+    if (limit.connected) {
+        limit.group->connections.fetch_sub(1);
+        limit.connected = false;
+    }
+}
+
+bool MqttLimits::check_ip_conn_limit(const asio::ip::address& address) {
+    if (ip_conn_rate_ <= 0) {
         return true;
     }
 
-    return it->second->tryConsume();
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(ip_conn_mutex_);
+
+    // 补满令牌的记录和没有记录的 IP 等价, 可以删除
+    if (now - ip_conn_sweep_time_ >= IP_CONN_SWEEP_INTERVAL) {
+        std::erase_if(ip_conn_buckets_, [&](const auto& item) {
+            std::chrono::duration<double> elapsed =
+                now - item.second.refill_time;
+            return item.second.tokens + elapsed.count() * ip_conn_rate_ >=
+                   ip_conn_rate_;
+        });
+        ip_conn_sweep_time_ = now;
+    }
+
+    auto [iter, inserted] = ip_conn_buckets_.try_emplace(
+        address, ip_conn_bucket_t{ip_conn_rate_, now});
+    auto& bucket = iter->second;
+
+    if (!inserted) {
+        std::chrono::duration<double> elapsed = now - bucket.refill_time;
+        bucket.tokens = std::min(
+            ip_conn_rate_, bucket.tokens + elapsed.count() * ip_conn_rate_);
+        bucket.refill_time = now;
+    }
+
+    if (bucket.tokens < 1.0) {
+        return false;
+    }
+
+    bucket.tokens -= 1.0;
+    return true;
+}
+
+std::chrono::steady_clock::duration MqttLimits::consume_conn() {
+    if (!global_conn_rate_limitor_) {
+        return std::chrono::steady_clock::duration::zero();
+    }
+
+    return to_duration(global_conn_rate_limitor_->consume(1));
 }
 
-std::string MqttLimits::get_group_name(const std::string& client_id) {
-    std::string name = "default";
+bool MqttLimits::check_limit(std::unique_ptr<MqttTokenBucket>& client_limitor,
+                             double client_rate, MqttTokenBucket* group_limitor,
+                             MqttTokenBucket* global_limitor) {
+    if (client_rate > 0 && !client_limitor) {
+        client_limitor = acquire_bucket(client_rate);
+    }
 
-    for (const auto& limit_group_cfg : limit_groups_cfg_) {
-        if (limit_group_cfg.selector) {
-            for (const auto& cid : limit_group_cfg.selector->client_id) {
-                if (client_id == cid) {
-                    name = limit_group_cfg.name;
-                    return name;
-                }
-            }
+    // 从最小的范围开始检查, 单个客户端超出速率时不会消耗组内和全局的令牌
+    if (client_limitor && !client_limitor->tryConsume()) {
+        return false;
+    }
 
-            for (const auto& cid_prefix :
-                 limit_group_cfg.selector->client_id_prefix) {
-                if (client_id.starts_with(cid_prefix)) {
-                    name = limit_group_cfg.name;
-                    return name;
-                }
-            }
+    if (group_limitor && !group_limitor->tryConsume()) {
+        if (client_limitor) {
+            client_limitor->refund();
+        }
+        return false;
+    }
 
-            for (const auto& cid_regex :
-                 limit_group_cfg.selector->client_id_regex) {
-                try {
-                    if (std::regex_match(client_id, std::regex(cid_regex))) {
-                        name = limit_group_cfg.name;
-                        return name;
-                    }
-                } catch (std::exception& e) {
-                    SPDLOG_ERROR("client_id_regex match error: [{}]", e.what());
-                }
-            }
+    if (global_limitor && !global_limitor->tryConsume()) {
+        if (group_limitor) {
+            group_limitor->refund();
+        }
+        if (client_limitor) {
+            client_limitor->refund();
+        }
+        return false;
+    }
+
+    return true;
+}
 
-        } else {
-            name = limit_group_cfg.name;
-            return name;
+std::unique_ptr<MqttTokenBucket> MqttLimits::acquire_bucket(double rate) {
+    std::unique_ptr<MqttTokenBucket> bucket;
+
+    {
+        std::lock_guard<std::mutex> lock(bucket_pool_mutex_);
+        if (!bucket_pool_.empty()) {
+            bucket = std::move(bucket_pool_.back());
+            bucket_pool_.pop_back();
         }
     }
 
-    return name;
+    if (!bucket) {
+        return std::make_unique<MqttTokenBucket>(rate);
+    }
+
+    bucket->reset(rate);
+    return bucket;
+}
+
+void MqttLimits::release_bucket(std::unique_ptr<MqttTokenBucket> bucket) {
+    std::lock_guard<std::mutex> lock(bucket_pool_mutex_);
+    bucket_pool_.emplace_back(std::move(bucket));
+}
+
+std::chrono::steady_clock::duration MqttLimits::to_duration(double seconds) {
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(seconds));
 }
\ No newline at end of file
@@ -4,6 +4,32 @@
 #include "MqttSingleton.h"
 #include "MqttTokenBucket.h"
 
+// 限制组在加载后不再改变, 会话在 CONNECT 时取得所属限制组的指针并一直使用
+// 组内的令牌桶由组内所有客户端共享, client_*_rate 为组内每个客户端单独的速率, 为 0 时不限制
+struct mqtt_limit_group_t {
+    std::string name;
+    std::unique_ptr<MqttTokenBucket> pub_rate_limitor;
+    std::unique_ptr<MqttTokenBucket> sub_rate_limitor;
+    std::unique_ptr<MqttTokenBucket> pub_bytes_rate_limitor;
+    double client_pub_rate = 0;
+    double client_sub_rate = 0;
+    double client_pub_bytes_rate = 0;
+    // 组内同时在线的连接数上限, 为 0 时不限制
+    uint32_t max_connections = 0;
+    mutable std::atomic<uint32_t> connections{0};
+};
+
+// 一个客户端的限制, 由会话持有
+// 客户端级别的令牌桶在第一次检查时从池中分配, 会话销毁时归还到池中
+struct mqtt_client_limit_t {
+    const mqtt_limit_group_t* group = nullptr;
+    std::unique_ptr<MqttTokenBucket> pub_rate_limitor;
+    std::unique_ptr<MqttTokenBucket> sub_rate_limitor;
+    std::unique_ptr<MqttTokenBucket> pub_bytes_rate_limitor;
+    // 是否计入了限制组的连接数
+    bool connected = false;
+};
+
 class MqttLimits : public MqttSingleton<MqttLimits> {
     friend class MqttSingleton<MqttLimits>;
 protected:
@@ -13,16 +39,75 @@ protected:
 public:
     bool load_limits(const std::string& limits_file);
 
-    bool check_pub_limit(const std::string& client_id, std::string& limit_group);
+    // 按选择器找到 client_id 所属的第一个限制组, 没有匹配时属于 default 组
+    // 只在 CONNECT 时调用一次, 返回的指针一直有效
+    const mqtt_limit_group_t* get_group(const std::string& client_id) const;
+
+    // 依次检查客户端, 限制组和全局三级的令牌桶, 全部通过才消耗令牌, 没有配置的级别总是通过
+    bool check_pub_limit(mqtt_client_limit_t& limit);
+
+    bool check_sub_limit(mqtt_client_limit_t& limit);
+
+    // 按字节数限制发布的速率, 消息总是被接受, 超出速率时返回需要暂停读取的时间
+    std::chrono::steady_clock::duration consume_pub_bytes(mqtt_client_limit_t& limit, std::size_t bytes);
+
+    // 限制组的连接数没有达到上限时计入连接数
+    bool add_connection(mqtt_client_limit_t& limit);
+
+    // 归还客户端级别的令牌桶和占用的连接数
+    void release(mqtt_client_limit_t& limit);
+
+    // 在接受连接后, TLS 握手之前检查同一个 IP 的连接速率, 超出时应关闭连接
+    bool check_ip_conn_limit(const asio::ip::address& address);
 
-    bool check_sub_limit(const std::string& client_id, std::string& limit_group);
+    // 消耗全局的连接速率, 超出时返回监听套接字需要暂停接受连接的时间
+    std::chrono::steady_clock::duration consume_conn();
 
 private:
-    std::string get_group_name(const std::string& client_id);
+    bool check_limit(std::unique_ptr<MqttTokenBucket>& client_limitor, double client_rate, MqttTokenBucket* group_limitor, MqttTokenBucket* global_limitor);
+
+    std::unique_ptr<MqttTokenBucket> acquire_bucket(double rate);
+
+    void release_bucket(std::unique_ptr<MqttTokenBucket> bucket);
+
+    static std::chrono::steady_clock::duration to_duration(double seconds);
+
+private:
+    static constexpr std::size_t NO_GROUP = SIZE_MAX;
+
+    // client_id 前缀按字符组成的前缀树, 节点记录以该前缀开头时所属的限制组
+    struct prefix_node_t {
+        std::unordered_map<char, std::unique_ptr<prefix_node_t>> children;
+        std::size_t group_index = NO_GROUP;
+    };
+
+    struct ip_conn_bucket_t {
+        double tokens;
+        std::chrono::steady_clock::time_point refill_time;
+    };
 
 private:
     bool enable_;
-    std::vector<mqtt_limit_group_cfg_t> limit_groups_cfg_;
-    std::unordered_map<std::string, std::unique_ptr<MqttTokenBucket>> pub_rate_limitor_;
-    std::unordered_map<std::string, std::unique_ptr<MqttTokenBucket>> sub_rate_limitor_;
+    mqtt_limit_group_t default_group_;
+    // 除 default 以外的限制组按配置的顺序存放, 同时匹配多个组时取序号最小的
+    std::vector<std::unique_ptr<mqtt_limit_group_t>> groups_;
+    // 以下选择器在加载时编译, 匹配时不再遍历全部的限制组
+    std::unordered_map<std::string, std::size_t> client_id_groups_;
+    prefix_node_t client_id_prefix_root_;
+    std::vector<std::pair<std::size_t, std::regex>> client_id_regex_groups_;
+    // 第一个没有 selector 的限制组, 匹配所有的 client_id
+    std::size_t match_all_group_;
+    // 所有客户端共享的令牌桶
+    std::unique_ptr<MqttTokenBucket> global_pub_rate_limitor_;
+    std::unique_ptr<MqttTokenBucket> global_sub_rate_limitor_;
+    std::unique_ptr<MqttTokenBucket> global_pub_bytes_rate_limitor_;
+    std::unique_ptr<MqttTokenBucket> global_conn_rate_limitor_;
+    // 空闲的客户端级别令牌桶, 会话在不同的线程中分配和归还
+    std::mutex bucket_pool_mutex_;
+    std::vector<std::unique_ptr<MqttTokenBucket>> bucket_pool_;
+    // 每个 IP 的连接速率, 令牌已经补满的 IP 定期删除
+    double ip_conn_rate_;
+    std::mutex ip_conn_mutex_;
+    std::unordered_map<asio::ip::address, ip_conn_bucket_t> ip_conn_buckets_;
+    std::chrono::steady_clock::time_point ip_conn_sweep_time_;
 };
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "MqttMessage.h"
+
+#include <cstring>
+#include <new>
+
+#include "MqttEncoder.h"
+
+MqttMessage::empty_block_t MqttMessage::s_empty_block_{};
+
+MqttMessage::MqttMessage() noexcept : block_(&s_empty_block_.block) {}
+
+MqttMessage::MqttMessage(std::string_view topic_name,
+                         std::string_view payload) {
+    uint16_t topic_length = topic_name.length();
+    std::size_t data_length = 2 + topic_length + payload.length();
+
+    void* memory = ::operator new(sizeof(block_t) + data_length);
+
+    block_ = new (memory) block_t{};
+    block_->ref_count.store(1, std::memory_order_relaxed);
+    block_->topic_length = topic_length;
+    block_->payload_length = payload.length();
+
+    char* data = reinterpret_cast<char*>(block_ + 1);
+    data[0] = static_cast<char>(topic_length >> 8);
+    data[1] = static_cast<char>(topic_length & 0xFF);
+    std::memcpy(data + 2, topic_name.data(), topic_length);
+    std::memcpy(data + 2 + topic_length, payload.data(), payload.length());
+
+    // 固定报头按 Qos 分别编码, Qos1 和 Qos2 多出两字节的报文标识符
+    for (uint8_t qos = 0; qos < 3; qos++) {
+        std::string header;
+        uint8_t command = static_cast<uint8_t>(
+            MQTT_CMD::PUBLISH | static_cast<uint8_t>(qos << 1));
+
+        if (MqttEncoder::encode_fixed_header(
+                header, command, remaining_length() + (qos > 0 ? 2 : 0)) !=
+            MQTT_RC_CODE::ERR_SUCCESS) {
+            continue;
+        }
+
+        std::memcpy(block_->fixed_header[qos], header.data(), header.length());
+        block_->fixed_header_length[qos] = header.length();
+    }
+}
+
+
+MqttMessage::MqttMessage(const MqttMessage& other) noexcept
+    : block_(other.block_) {
+    add_ref();
+}
+
+MqttMessage::MqttMessage(MqttMessage&& other) noexcept : block_(other.block_) {
+    other.block_ = &s_empty_block_.block;
+}
+
+MqttMessage& MqttMessage::operator=(const MqttMessage& other) noexcept {
+    if (block_ != other.block_) {
+        release();
+        block_ = other.block_;
+        add_ref();
+    }
+
+    return *this;
+}
+
+MqttMessage& MqttMessage::operator=(MqttMessage&& other) noexcept {
+    if (this != &other) {
+        release();
+        block_ = other.block_;
+        other.block_ = &s_empty_block_.block;
+    }
+
+    return *this;
+}
+
+MqttMessage::~MqttMessage() { release(); }
+
+void MqttMessage::add_ref() noexcept {
+    if (block_ != &s_empty_block_.block) {
+        block_->ref_count.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void MqttMessage::release() noexcept {
+    if (block_ == &s_empty_block_.block) {
+        return;
+    }
+
+    if (block_->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        block_->~block_t();
+        ::operator delete(block_);
+    }
+}
\ No newline at end of file
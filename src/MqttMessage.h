@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+// 不可变的主题消息, 引用计数、预编码的 PUBLISH 报头、主题和消息内容
+// 放在同一次内存分配中, 拷贝只增加引用计数, 可以在线程之间共享
+// 默认构造的空消息指向静态的空内存块, 不分配内存
+class MqttMessage {
+public:
+    MqttMessage() noexcept;
+
+    MqttMessage(std::string_view topic_name, std::string_view payload);
+
+    MqttMessage(const MqttMessage& other) noexcept;
+
+    MqttMessage(MqttMessage&& other) noexcept;
+
+    MqttMessage& operator=(const MqttMessage& other) noexcept;
+
+    MqttMessage& operator=(MqttMessage&& other) noexcept;
+
+    ~MqttMessage();
+
+    inline std::string_view topic_name() const noexcept {
+        return {data() + 2, block_->topic_length};
+    }
+
+    inline std::string_view payload() const noexcept {
+        return {data() + 2 + block_->topic_length, block_->payload_length};
+    }
+
+    // 两字节长度前缀加主题名, 即 PUBLISH 可变报头中的主题部分
+    inline std::string_view encoded_topic() const noexcept {
+        return {data(), 2 + std::size_t(block_->topic_length)};
+    }
+
+    // dup 和 retain 为 0 时的固定报头, 剩余长度超过协议上限时为空
+    inline std::string_view fixed_header(uint8_t qos) const noexcept {
+        return {reinterpret_cast<const char*>(block_->fixed_header[qos]),
+                block_->fixed_header_length[qos]};
+    }
+
+    // 不含报文标识符的剩余长度
+    inline uint32_t remaining_length() const noexcept {
+        return 2 + block_->topic_length + block_->payload_length;
+    }
+
+private:
+    struct block_t {
+        std::atomic<uint32_t> ref_count;
+        uint32_t topic_length;
+        uint32_t payload_length;
+        uint8_t fixed_header[3][5];
+        uint8_t fixed_header_length[3];
+    };
+
+    inline const char* data() const noexcept {
+        return reinterpret_cast<const char*>(block_ + 1);
+    }
+
+    void add_ref() noexcept;
+
+    void release() noexcept;
+
+    // 空消息的数据区为两字节的主题长度 0, 紧跟在内存块之后
+    struct empty_block_t {
+        block_t block;
+        char data[2];
+    };
+
+private:
+    block_t* block_;
+
+    static empty_block_t s_empty_block_;
+};
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include "MqttPacketIdAllocator.h"
+
+MqttPacketIdAllocator::MqttPacketIdAllocator(
+    MqttPacketIdAllocator&& other) noexcept
+    : words_(std::move(other.words_)),
+      max_id_(std::exchange(other.max_id_, 0)),
+      size_(std::exchange(other.size_, 0)),
+      next_(std::exchange(other.next_, 0)) {}
+
+MqttPacketIdAllocator& MqttPacketIdAllocator::operator=(
+    MqttPacketIdAllocator&& other) noexcept {
+    if (this != &other) {
+        words_ = std::move(other.words_);
+        max_id_ = std::exchange(other.max_id_, 0);
+        size_ = std::exchange(other.size_, 0);
+        next_ = std::exchange(other.next_, 0);
+    }
+
+    return *this;
+}
+
+void MqttPacketIdAllocator::release(uint16_t packet_id) noexcept {
+    if (packet_id == 0 || packet_id > max_id_) {
+        return;
+    }
+
+    std::size_t bit = packet_id - 1;
+    uint64_t mask = uint64_t(1) << (bit % 64);
+
+    if ((words_[bit / 64] & mask) == 0) {
+        return;
+    }
+
+    words_[bit / 64] &= ~mask;
+    size_--;
+
+    if (size_ == 0 && words_.size() > MAX_IDLE_WORDS) {
+        std::vector<uint64_t>().swap(words_);
+        max_id_ = 0;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <bit>
+
+#include "MqttCommon.h"
+
+// 服务端发出的 Qos1 和 Qos2 报文的标识符分配器, 用位图记录正在使用的标识符
+// 从上一次分配的位置向后查找, 每次检查 64 个标识符, 刚释放的标识符不会马上被重用
+// 可分配的范围由发送窗口决定, 窗口较小时位图只有几个字
+class MqttPacketIdAllocator {
+public:
+    MqttPacketIdAllocator() noexcept = default;
+
+    MqttPacketIdAllocator(MqttPacketIdAllocator&& other) noexcept;
+
+    MqttPacketIdAllocator& operator=(MqttPacketIdAllocator&& other) noexcept;
+
+    ~MqttPacketIdAllocator() = default;
+
+    // 在 [1, max_id] 中分配一个空闲的标识符, skip 返回 true 的标识符不会被分配
+    // 位图在第一次分配时按 max_id 创建, 没有可用的标识符时返回 0
+    template <typename Skip>
+    uint16_t allocate(uint16_t max_id, Skip&& skip);
+
+    // 标识符没有被分配时什么也不做
+    void release(uint16_t packet_id) noexcept;
+
+    // 正在使用的标识符数量
+    inline std::size_t size() const noexcept { return size_; }
+
+private:
+    // 全部释放后超过该大小的位图会被回收
+    static constexpr std::size_t MAX_IDLE_WORDS = 16;
+
+    std::vector<uint64_t> words_;
+    uint16_t max_id_ = 0;
+    uint16_t size_ = 0;
+    // 下一次开始查找的位置, 对应标识符减 1
+    uint16_t next_ = 0;
+};
+
+template <typename Skip>
+uint16_t MqttPacketIdAllocator::allocate(uint16_t max_id, Skip&& skip) {
+    if (words_.empty()) {
+        if (max_id == 0) {
+            return 0;
+        }
+
+        max_id_ = max_id;
+        next_ %= max_id_;
+        words_.assign((max_id_ + 63) / 64, 0);
+    }
+
+    if (size_ >= max_id_) {
+        return 0;
+    }
+
+    std::size_t first = next_ / 64;
+
+    // 第一个字只查找 next_ 之后的位, 绕回一圈后再查找之前的位
+    for (std::size_t n = 0; n <= words_.size(); n++) {
+        std::size_t w = (first + n) % words_.size();
+        uint64_t free_bits = ~words_[w];
+
+        if (n == 0) {
+            free_bits &= ~uint64_t(0) << (next_ % 64);
+        } else if (n == words_.size()) {
+            free_bits &= ~(~uint64_t(0) << (next_ % 64));
+        }
+
+        if (w == words_.size() - 1 && max_id_ % 64 != 0) {
+            free_bits &= (uint64_t(1) << (max_id_ % 64)) - 1;
+        }
+
+        while (free_bits != 0) {
+            std::size_t bit = std::countr_zero(free_bits);
+            free_bits &= free_bits - 1;
+
+            uint16_t packet_id = static_cast<uint16_t>(w * 64 + bit + 1);
+            if (skip(packet_id)) {
+                continue;
+            }
+
+            words_[w] |= uint64_t(1) << bit;
+            size_++;
+            next_ = static_cast<uint16_t>(packet_id % max_id_);
+
+            return packet_id;
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
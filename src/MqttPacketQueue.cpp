@@ -0,0 +1,109 @@
+#include "MqttPacketQueue.h"
+
+MqttPacketQueue::MqttPacketQueue(MqttPacketQueue&& other) noexcept
+    : buf_(std::move(other.buf_)),
+      head_(std::exchange(other.head_, 0)),
+      size_(std::exchange(other.size_, 0)),
+      bytes_(std::exchange(other.bytes_, 0)) {}
+
+MqttPacketQueue& MqttPacketQueue::operator=(MqttPacketQueue&& other) noexcept {
+    if (this != &other) {
+        buf_ = std::move(other.buf_);
+        head_ = std::exchange(other.head_, 0);
+        size_ = std::exchange(other.size_, 0);
+        bytes_ = std::exchange(other.bytes_, 0);
+    }
+
+    return *this;
+}
+
+void MqttPacketQueue::push(const mqtt_packet_t& packet) {
+    if (size_ == buf_.size()) {
+        grow();
+    }
+
+    buf_[(head_ + size_) & (buf_.size() - 1)] = packet;
+    size_++;
+    bytes_ += packet.message.remaining_length();
+}
+
+void MqttPacketQueue::push(mqtt_packet_t&& packet) {
+    if (size_ == buf_.size()) {
+        grow();
+    }
+
+    bytes_ += packet.message.remaining_length();
+    buf_[(head_ + size_) & (buf_.size() - 1)] = std::move(packet);
+    size_++;
+}
+
+void MqttPacketQueue::pop() noexcept {
+    bytes_ -= buf_[head_].message.remaining_length();
+    drop_front();
+}
+
+std::size_t MqttPacketQueue::trim(std::size_t max_count, std::size_t max_bytes,
+                                  MQTT_QUEUE_POLICY policy) noexcept {
+    std::size_t dropped = 0;
+
+    while (size_ > max_count || bytes_ > max_bytes) {
+        if (policy != MQTT_QUEUE_POLICY::DROP_QOS0_FIRST ||
+            !erase_first_qos0()) {
+            pop();
+        }
+        dropped++;
+    }
+
+    return dropped;
+}
+
+bool MqttPacketQueue::erase_first_qos0() noexcept {
+    std::size_t mask = buf_.size() - 1;
+
+    std::size_t i = 0;
+    while (i < size_ && buf_[(head_ + i) & mask].qos != 0) {
+        i++;
+    }
+
+    if (i == size_) {
+        return false;
+    }
+
+    bytes_ -= buf_[(head_ + i) & mask].message.remaining_length();
+
+    for (; i > 0; i--) {
+        buf_[(head_ + i) & mask] = std::move(buf_[(head_ + i - 1) & mask]);
+    }
+
+    drop_front();
+
+    return true;
+}
+
+void MqttPacketQueue::drop_front() noexcept {
+    // 重置出队的元素, 及时释放对消息的引用
+    buf_[head_] = mqtt_packet_t{};
+    head_ = (head_ + 1) & (buf_.size() - 1);
+    size_--;
+
+    if (size_ == 0) {
+        head_ = 0;
+
+        if (buf_.size() > MAX_IDLE_CAPACITY) {
+            std::vector<mqtt_packet_t>().swap(buf_);
+        }
+    }
+}
+
+void MqttPacketQueue::grow() {
+    std::vector<mqtt_packet_t> buf(
+        std::max<std::size_t>(MIN_CAPACITY, buf_.size() * 2));
+
+    // 按队列顺序搬到新缓冲区的开头
+    for (std::size_t i = 0; i < size_; i++) {
+        buf[i] = std::move(buf_[(head_ + i) & (buf_.size() - 1)]);
+    }
+
+    buf_ = std::move(buf);
+    head_ = 0;
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "MqttCommon.h"
+
+// 会话待投递的消息队列, 元素连续存放在环形缓冲区中, 容量按 2 的幂增长
+// 离线会话堆积大量消息时不会像链表或 deque 那样为每个元素单独分配内存
+class MqttPacketQueue {
+public:
+    MqttPacketQueue() noexcept = default;
+
+    MqttPacketQueue(MqttPacketQueue&& other) noexcept;
+
+    MqttPacketQueue& operator=(MqttPacketQueue&& other) noexcept;
+
+    ~MqttPacketQueue() = default;
+
+    void push(const mqtt_packet_t& packet);
+
+    void push(mqtt_packet_t&& packet);
+
+    inline const mqtt_packet_t& front() const noexcept { return buf_[head_]; }
+
+    void pop() noexcept;
+
+    inline bool empty() const noexcept { return size_ == 0; }
+
+    inline std::size_t size() const noexcept { return size_; }
+
+    // 队列中全部消息的主题和内容的字节数
+    inline std::size_t bytes() const noexcept { return bytes_; }
+
+    // 消息数或字节数超过上限时按策略丢弃消息, 返回丢弃的消息数
+    std::size_t trim(std::size_t max_count, std::size_t max_bytes,
+                     MQTT_QUEUE_POLICY policy) noexcept;
+
+    inline std::size_t capacity() const noexcept { return buf_.size(); }
+
+    // 从队头到队尾依次访问队列中的消息
+    template <typename Func>
+    void for_each(Func&& func) const {
+        for (std::size_t i = 0; i < size_; i++) {
+            func(buf_[(head_ + i) & (buf_.size() - 1)]);
+        }
+    }
+
+private:
+    void grow();
+
+    void drop_front() noexcept;
+
+    // 删除最早的一条 Qos0 消息, 它之前的消息整体后移一位
+    bool erase_first_qos0() noexcept;
+
+private:
+    static constexpr std::size_t MIN_CAPACITY = 16;
+
+    // 队列清空后超过该容量的缓冲区会被释放, 避免一次堆积长期占用内存
+    static constexpr std::size_t MAX_IDLE_CAPACITY = 1024;
+
+    std::vector<mqtt_packet_t> buf_;
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+    std::size_t bytes_ = 0;
+};
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include "MqttRetainSegment.h"
+
+#include <filesystem>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 文件头和索引项按本机字节序存放
+constexpr uint32_t MQTT_RETAIN_SEGMENT_MAGIC = 0x5352514D;    // "MQRS"
+constexpr uint32_t MQTT_RETAIN_SEGMENT_VERSION = 1;
+
+struct mqtt_retain_segment_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+};
+
+struct mqtt_retain_segment_index_t {
+    uint64_t topic_offset;
+    uint64_t payload_offset;
+    uint32_t payload_length;
+    uint16_t topic_length;
+    uint8_t qos;
+    uint8_t reserved;
+};
+
+static_assert(sizeof(mqtt_retain_segment_header_t) == 16);
+static_assert(sizeof(mqtt_retain_segment_index_t) == 24);
+
+MqttRetainSegment::~MqttRetainSegment() {
+#ifdef _WIN32
+    if (data_ != nullptr) {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_handle_ != nullptr) {
+        CloseHandle(mapping_handle_);
+    }
+    if (file_handle_ != nullptr) {
+        CloseHandle(file_handle_);
+    }
+#else
+    if (data_ != nullptr) {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+}
+
+std::shared_ptr<MqttRetainSegment> MqttRetainSegment::open(
+    const std::string& path) {
+    std::shared_ptr<MqttRetainSegment> segment(new MqttRetainSegment());
+
+#ifdef _WIN32
+    // 允许合并快照时删除正在映射的旧文件
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open retain segment: " + path);
+    }
+    segment->file_handle_ = file;
+
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    segment->size_ = static_cast<std::size_t>(file_size.QuadPart);
+
+    if (segment->size_ > 0) {
+        segment->mapping_handle_ =
+            CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (segment->mapping_handle_ != nullptr) {
+            segment->data_ = static_cast<const char*>(MapViewOfFile(
+                segment->mapping_handle_, FILE_MAP_READ, 0, 0, 0));
+        }
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open retain segment: " + path);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        segment->size_ = static_cast<std::size_t>(st.st_size);
+
+        void* data =
+            ::mmap(nullptr, segment->size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            segment->data_ = static_cast<const char*>(data);
+        }
+    }
+
+    // 映射建立后文件描述符就不再需要, 文件被删除后映射仍然有效
+    ::close(fd);
+#endif
+
+    mqtt_retain_segment_header_t header;
+    if (segment->data_ == nullptr || segment->size_ < sizeof(header)) {
+        throw std::runtime_error("Retain segment is corrupted: " + path);
+    }
+
+    std::memcpy(&header, segment->data_, sizeof(header));
+    if (header.magic != MQTT_RETAIN_SEGMENT_MAGIC ||
+        header.version != MQTT_RETAIN_SEGMENT_VERSION ||
+        header.count > (segment->size_ - sizeof(header)) /
+                           sizeof(mqtt_retain_segment_index_t)) {
+        throw std::runtime_error("Retain segment is corrupted: " + path);
+    }
+
+    segment->count_ = header.count;
+
+    return segment;
+}
+
+bool MqttRetainSegment::write(const std::string& path,
+                              const std::vector<mqtt_retain_entry_t>& entries) {
+    std::string tmp_path = path + ".tmp";
+    std::FILE* file = std::fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    mqtt_retain_segment_header_t header{
+        .magic = MQTT_RETAIN_SEGMENT_MAGIC,
+        .version = MQTT_RETAIN_SEGMENT_VERSION,
+        .count = entries.size(),
+    };
+
+    // 主题紧跟在索引之后, 消息内容放在全部主题之后
+    uint64_t topic_offset =
+        sizeof(header) + entries.size() * sizeof(mqtt_retain_segment_index_t);
+    uint64_t payload_offset = topic_offset;
+    for (const auto& entry : entries) {
+        payload_offset += entry.topic_name.size();
+    }
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (const auto& entry : entries) {
+        mqtt_retain_segment_index_t index{
+            .topic_offset = topic_offset,
+            .payload_offset = payload_offset,
+            .payload_length = static_cast<uint32_t>(entry.payload.size()),
+            .topic_length = static_cast<uint16_t>(entry.topic_name.size()),
+            .qos = entry.qos,
+            .reserved = 0,
+        };
+
+        ok = ok && std::fwrite(&index, sizeof(index), 1, file) == 1;
+
+        topic_offset += entry.topic_name.size();
+        payload_offset += entry.payload.size();
+    }
+
+    for (const auto& entry : entries) {
+        ok = ok && std::fwrite(entry.topic_name.data(), 1,
+                               entry.topic_name.size(),
+                               file) == entry.topic_name.size();
+    }
+
+    for (const auto& entry : entries) {
+        ok = ok && std::fwrite(entry.payload.data(), 1, entry.payload.size(),
+                               file) == entry.payload.size();
+    }
+
+    ok = ok && std::fflush(file) == 0;
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    ::fsync(fileno(file));
+#endif
+    std::fclose(file);
+
+    std::error_code ec;
+    if (ok) {
+        std::filesystem::rename(tmp_path, path, ec);
+    }
+
+    if (!ok || ec) {
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+
+    return true;
+}
+
+bool MqttRetainSegment::entry(std::size_t index,
+                              mqtt_retain_entry_t& entry) const noexcept {
+    if (index >= count_) {
+        return false;
+    }
+
+    mqtt_retain_segment_index_t item;
+    std::memcpy(&item,
+                data_ + sizeof(mqtt_retain_segment_header_t) +
+                    index * sizeof(mqtt_retain_segment_index_t),
+                sizeof(item));
+
+    if (item.topic_offset > size_ ||
+        item.topic_length > size_ - item.topic_offset ||
+        item.payload_offset > size_ ||
+        item.payload_length > size_ - item.payload_offset) {
+        return false;
+    }
+
+    entry.topic_name = {data_ + item.topic_offset, item.topic_length};
+    entry.payload = {data_ + item.payload_offset, item.payload_length};
+    entry.qos = item.qos;
+
+    return true;
+}
\ No newline at end of file
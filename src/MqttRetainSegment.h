@@ -0,0 +1,44 @@
+#pragma once
+
+#include "MqttCommon.h"
+
+struct mqtt_retain_entry_t {
+    std::string_view topic_name;
+    std::string_view payload;
+    uint8_t qos;
+};
+
+// 保留消息段文件, 由存储在合并快照时写入, 启动时只映射文件并检查文件头, 不解析内容
+// 文件由文件头、定长的索引项、主题区和消息内容区组成, 遍历索引只会访问索引和主题所在的页,
+// 消息内容所在的页在第一次投递时才被读入
+class MqttRetainSegment {
+public:
+    ~MqttRetainSegment();
+
+    MqttRetainSegment(const MqttRetainSegment&) = delete;
+
+    MqttRetainSegment& operator=(const MqttRetainSegment&) = delete;
+
+    // 映射段文件, 文件不完整时抛出异常
+    static std::shared_ptr<MqttRetainSegment> open(const std::string& path);
+
+    // 先写到临时文件, 同步后改名, 返回是否成功
+    static bool write(const std::string& path, const std::vector<mqtt_retain_entry_t>& entries);
+
+    inline std::size_t size() const noexcept { return count_; }
+
+    // 索引项指向文件以外的位置时返回 false
+    bool entry(std::size_t index, mqtt_retain_entry_t& entry) const noexcept;
+
+private:
+    MqttRetainSegment() = default;
+
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t count_ = 0;
+#ifdef _WIN32
+    void* file_handle_ = nullptr;
+    void* mapping_handle_ = nullptr;
+#endif
+};
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include "MqttRetainTree.h"
+
+void MqttRetainTree::attach(std::shared_ptr<MqttRetainSegment> segment) {
+    segment_ = std::move(segment);
+    indexed_ = false;
+}
+
+void MqttRetainTree::add(const mqtt_packet_t& packet) {
+    if (!indexed_) {
+        pending_.insert_or_assign(std::string(packet.message.topic_name()),
+                                  packet);
+        return;
+    }
+
+    insert(packet);
+}
+
+void MqttRetainTree::remove(std::string_view topic_name) {
+    if (!indexed_) {
+        pending_.insert_or_assign(std::string(topic_name), std::nullopt);
+        return;
+    }
+
+    std::vector<std::string_view> levels;
+    utils::split_topic_levels(topic_name, levels);
+
+    remove(&root_, levels, 0);
+}
+
+void MqttRetainTree::match(const std::string& topic_filter,
+                           std::vector<const mqtt_packet_t*>& result) {
+    ensure_index();
+
+    std::vector<std::string_view> levels;
+    utils::split_topic_levels(topic_filter, levels);
+
+    match_levels(&root_, levels, 0, result);
+}
+
+std::size_t MqttRetainTree::size() {
+    ensure_index();
+    return retain_count_;
+}
+
+void MqttRetainTree::ensure_index() {
+    if (indexed_) {
+        return;
+    }
+
+    indexed_ = true;
+
+    // 只读取索引项和主题, 段在写入时已经按主题去重
+    for (std::size_t i = 0; i < segment_->size(); i++) {
+        mqtt_retain_entry_t entry;
+        if (!segment_->entry(i, entry)) {
+            SPDLOG_WARN("Retain segment entry is corrupted: index = [{}]", i);
+            continue;
+        }
+
+        node_t* node = find_or_create(entry.topic_name);
+        if (!node->packet && node->segment_index == NO_SEGMENT_INDEX) {
+            retain_count_++;
+        }
+        node->segment_index = static_cast<uint32_t>(i);
+    }
+
+    for (auto& [topic_name, packet] : pending_) {
+        if (packet) {
+            insert(*packet);
+        } else {
+            remove(topic_name);
+        }
+    }
+
+    pending_.clear();
+}
+
+MqttRetainTree::node_t* MqttRetainTree::find_or_create(
+    std::string_view topic_name) {
+    std::vector<std::string_view> levels;
+    utils::split_topic_levels(topic_name, levels);
+
+    node_t* node = &root_;
+    for (auto level : levels) {
+        auto iter = node->children.find(level);
+        if (iter == node->children.end()) {
+            iter = node->children
+                       .emplace(std::string(level), std::make_unique<node_t>())
+                       .first;
+        }
+        node = iter->second.get();
+    }
+
+    return node;
+}
+
+void MqttRetainTree::insert(const mqtt_packet_t& packet) {
+    node_t* node = find_or_create(packet.message.topic_name());
+
+    // 同一个主题只保留最新的一条消息
+    if (node->packet) {
+        *node->packet = packet;
+    } else {
+        node->packet = std::make_unique<mqtt_packet_t>(packet);
+        if (node->segment_index == NO_SEGMENT_INDEX) {
+            retain_count_++;
+        }
+    }
+
+    node->segment_index = NO_SEGMENT_INDEX;
+}
+
+const mqtt_packet_t* MqttRetainTree::load(node_t* node) {
+    if (node->packet || node->segment_index == NO_SEGMENT_INDEX) {
+        return node->packet.get();
+    }
+
+    // 第一次被匹配时从映射中复制出来, 之后和新增的保留消息一样处理
+    mqtt_retain_entry_t entry;
+    if (segment_->entry(node->segment_index, entry)) {
+        node->packet = std::make_unique<mqtt_packet_t>();
+        node->packet->message = MqttMessage(entry.topic_name, entry.payload);
+        node->packet->qos = entry.qos;
+        node->packet->retain = 1;
+    }
+
+    node->segment_index = NO_SEGMENT_INDEX;
+
+    return node->packet.get();
+}
+
+void MqttRetainTree::collect(node_t* node,
+                             std::vector<const mqtt_packet_t*>& result) {
+    if (const mqtt_packet_t* packet = load(node)) {
+        result.emplace_back(packet);
+    }
+
+    for (const auto& [_, child] : node->children) {
+        collect(child.get(), result);
+    }
+}
+
+void MqttRetainTree::match_levels(node_t* node,
+                                  const std::vector<std::string_view>& levels,
+                                  std::size_t depth,
+                                  std::vector<const mqtt_packet_t*>& result) {
+    if (depth == levels.size()) {
+        if (const mqtt_packet_t* packet = load(node)) {
+            result.emplace_back(packet);
+        }
+        return;
+    }
+
+    auto level = levels[depth];
+
+    // '#' 匹配父级本身以及剩余的所有层级
+    if (level == "#") {
+        collect(node, result);
+        return;
+    }
+
+    // '+' 匹配当前层级的所有主题
+    if (level == "+") {
+        for (const auto& [_, child] : node->children) {
+            match_levels(child.get(), levels, depth + 1, result);
+        }
+        return;
+    }
+
+    auto iter = node->children.find(level);
+    if (iter != node->children.end()) {
+        match_levels(iter->second.get(), levels, depth + 1, result);
+    }
+}
+
+bool MqttRetainTree::remove(node_t* node,
+                            const std::vector<std::string_view>& levels,
+                            std::size_t depth) {
+    if (depth == levels.size()) {
+        if (node->packet || node->segment_index != NO_SEGMENT_INDEX) {
+            node->packet.reset();
+            node->segment_index = NO_SEGMENT_INDEX;
+            retain_count_--;
+        }
+        return node->empty();
+    }
+
+    // 子节点为空时回收
+    auto iter = node->children.find(levels[depth]);
+    if (iter != node->children.end() &&
+        remove(iter->second.get(), levels, depth + 1)) {
+        node->children.erase(iter);
+    }
+
+    return node->empty();
+}
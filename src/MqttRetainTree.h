@@ -0,0 +1,71 @@
+#pragma once
+
+#include "MqttCommon.h"
+#include "MqttRetainSegment.h"
+#include "MqttUtils.h"
+
+// 保留消息树, 按主题层级保存保留消息, 新增订阅时根据主题过滤器
+// 只遍历可能匹配的分支, 不需要扫描全部的保留消息
+// 可以挂载存储恢复出的保留消息段, 第一次查找时才按段的索引建树, 在此之前的修改先暂存
+// 段中的消息第一次被匹配时才从映射中复制出来, 没有被订阅过的消息不占用堆内存
+class MqttRetainTree {
+public:
+    MqttRetainTree() = default;
+
+    ~MqttRetainTree() = default;
+
+    // 只能在树为空时调用
+    void attach(std::shared_ptr<MqttRetainSegment> segment);
+
+    void add(const mqtt_packet_t& packet);
+
+    void remove(std::string_view topic_name);
+
+    // 查找与主题过滤器匹配的保留消息, 返回的指针在下一次修改前有效
+    void match(const std::string& topic_filter, std::vector<const mqtt_packet_t*>& result);
+
+    std::size_t size();
+
+private:
+    static constexpr uint32_t NO_SEGMENT_INDEX = std::numeric_limits<uint32_t>::max();
+
+    struct node_t {
+        std::unordered_map<std::string, std::unique_ptr<node_t>,
+                           utils::string_hash, std::equal_to<>>
+            children;
+        std::unique_ptr<mqtt_packet_t> packet;
+        // 保留消息还在段中时为索引项的序号
+        uint32_t segment_index = NO_SEGMENT_INDEX;
+
+        inline bool empty() const noexcept {
+            return children.empty() && !packet &&
+                   segment_index == NO_SEGMENT_INDEX;
+        }
+    };
+
+    // 按段的索引建树, 再重放暂存的修改
+    void ensure_index();
+
+    node_t* find_or_create(std::string_view topic_name);
+
+    void insert(const mqtt_packet_t& packet);
+
+    const mqtt_packet_t* load(node_t* node);
+
+    void collect(node_t* node, std::vector<const mqtt_packet_t*>& result);
+
+    void match_levels(node_t* node, const std::vector<std::string_view>& levels, std::size_t depth, std::vector<const mqtt_packet_t*>& result);
+
+    bool remove(node_t* node, const std::vector<std::string_view>& levels, std::size_t depth);
+
+private:
+    node_t root_;
+    std::size_t retain_count_ = 0;
+    // 挂载的段在树的整个生命周期内保持映射
+    std::shared_ptr<MqttRetainSegment> segment_;
+    bool indexed_ = true;
+    // 建树之前的修改, 同一个主题只保留最后一次, 为空表示删除
+    std::unordered_map<std::string, std::optional<mqtt_packet_t>,
+                       utils::string_hash, std::equal_to<>>
+        pending_;
+};
@@ -2,19 +2,63 @@
 
 #include "MqttSession.h"
 
-MqttServer::MqttServer() : io_context(1), signals(io_context) {}
+#ifdef SO_REUSEPORT
+// 多个监听套接字绑定同一个端口, 由内核将新连接分散到各个监听套接字上
+using reuse_port =
+    asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+static std::vector<std::unique_ptr<asio::io_context>> s_make_io_contexts() {
+    std::vector<std::unique_ptr<asio::io_context>> io_contexts;
+
+    // 每个 io_context 只会在一个线程中运行
+    for (uint32_t i = 0; i < MqttConfig::getInstance()->io_threads(); i++) {
+        io_contexts.emplace_back(std::make_unique<asio::io_context>(1));
+    }
+
+    return io_contexts;
+}
+
+MqttServer::MqttServer()
+    : io_contexts(s_make_io_contexts()),
+#ifdef SO_REUSEPORT
+      acceptor_count(io_contexts.size()),
+#else
+      acceptor_count(1),
+#endif
+      next_io_context(0),
+      signals(*io_contexts.front()) {}
 
 MqttServer::~MqttServer() {}
 
 void MqttServer::run() noexcept {
+    std::vector<std::thread> threads;
+
     try {
         init();
 
-        SPDLOG_INFO("Mqtt Server started successfully");
+        // 保证没有任务时事件循环也不会退出
+        for (auto& io_context : io_contexts) {
+            work_guards.emplace_back(asio::make_work_guard(*io_context));
+        }
+
+        for (std::size_t i = 1; i < io_contexts.size(); i++) {
+            threads.emplace_back([io_context = io_contexts[i].get()] {
+                io_context->run();
+            });
+        }
+
+        SPDLOG_INFO("Mqtt Server started successfully, io_threads = [{}]",
+                    io_contexts.size());
 
-        io_context.run();
+        io_contexts.front()->run();
     } catch (const std::exception& e) {
         SPDLOG_ERROR("Mqtt Server failed to start : ERR_MSG = [{}])", e.what());
+        stop();
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
     }
 }
 
@@ -26,6 +70,14 @@ void MqttServer::init() {
 #endif
     signals.async_wait(std::bind(&MqttServer::stop, this));
 
+    // 先恢复持久会话, 再开始接受连接
+    broker.open_store();
+
+    if (MqttConfig::getInstance()->session_expiry_interval() > 0) {
+        asio::co_spawn(*io_contexts.front(), handle_session_expiry(),
+                       asio::detached);
+    }
+
     for (const auto& cfg : MqttConfig::getInstance()->listeners()) {
         if (cfg.proto == MQTT_PROTOCOL::MQTTS ||
             cfg.proto == MQTT_PROTOCOL::WSS) {
@@ -37,24 +89,90 @@ void MqttServer::init() {
         auto listen_endpoint = asio::ip::tcp::endpoint(
             asio::ip::make_address(cfg.address), cfg.port);
 
-        asio::ip::tcp::acceptor acceptor(this->io_context);
-        acceptor.open(listen_endpoint.protocol());
-        acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
-        acceptor.bind(listen_endpoint);
-        acceptor.listen();
+        for (std::size_t i = 0; i < this->acceptor_count; i++) {
+            asio::ip::tcp::acceptor acceptor(*this->io_contexts[i]);
+            acceptor.open(listen_endpoint.protocol());
+            acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+            acceptor.set_option(reuse_port(true));
+#endif
+            acceptor.bind(listen_endpoint);
+            acceptor.listen();
 
-        asio::co_spawn(acceptor.get_executor(),
-                       handle_accept(std::move(acceptor), cfg), asio::detached);
+            asio::co_spawn(acceptor.get_executor(),
+                           handle_accept(std::move(acceptor), cfg, i),
+                           asio::detached);
+        }
     }
 }
 
 void MqttServer::stop() {
-    io_context.stop();
+    work_guards.clear();
+
+    for (auto& io_context : io_contexts) {
+        io_context->stop();
+    }
+
     SPDLOG_INFO("Mqtt Server stopped successfully");
 }
 
+asio::awaitable<void> MqttServer::handle_session_expiry() {
+    asio::steady_timer timer(co_await asio::this_coro::executor);
+    asio::error_code ec;
+
+    // 检查精度和会话超时检查相同, 过期的会话最多延迟一个刻度删除
+    auto duration = std::chrono::seconds(
+        std::max(1U, MqttConfig::getInstance()->check_timeout_duration()));
+
+    for (;;) {
+        timer.expires_after(duration);
+        co_await timer.async_wait(
+            asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            co_return;
+        }
+
+        broker.expire_offline(std::chrono::steady_clock::now());
+    }
+}
+
+asio::io_context& MqttServer::get_io_context(std::size_t acceptor_id) {
+    // 每个 I/O 线程都有自己的监听套接字时, 新连接直接在当前线程上处理
+    if (acceptor_count == io_contexts.size()) {
+        return *io_contexts[acceptor_id];
+    }
+
+    // 只有一个监听套接字时轮询分配 io_context, 新连接均匀的分布在各个 I/O 线程上
+    auto& io_context = *io_contexts[next_io_context];
+
+    next_io_context = (next_io_context + 1) % io_contexts.size();
+
+    return io_context;
+}
+
+template <typename Socket>
+bool MqttServer::check_conn_limit(Socket& socket) {
+    asio::error_code ec;
+    auto endpoint = socket.remote_endpoint(ec);
+    if (ec) {
+        socket.close(ec);
+        return false;
+    }
+
+    if (!MqttLimits::getInstance()->check_ip_conn_limit(endpoint.address())) {
+        SPDLOG_DEBUG("connection rate limited: [{}]",
+                     endpoint.address().to_string());
+        MqttExposer::getInstance()->inc_mqtt_ip_conn_rate_limit_count_metric();
+        socket.close(ec);
+        return false;
+    }
+
+    return true;
+}
+
 asio::awaitable<void> MqttServer::handle_accept(
-    asio::ip::tcp::acceptor acceptor, const mqtt_listener_cfg_t& cfg) {
+    asio::ip::tcp::acceptor acceptor, const mqtt_listener_cfg_t& cfg,
+    std::size_t acceptor_id) {
     bool is_websocket =
         (cfg.proto == MQTT_PROTOCOL::WS || cfg.proto == MQTT_PROTOCOL::WSS);
 
@@ -113,31 +231,68 @@ asio::awaitable<void> MqttServer::handle_accept(
 
         for (;;) {
             asio::ssl::stream<asio::ip::tcp::socket> ssl_socket(
-                this->io_context, ssl_context);
+                get_io_context(acceptor_id), ssl_context);
             co_await acceptor.async_accept(ssl_socket.next_layer(),
                                            asio::use_awaitable);
+            MqttExposer::getInstance()
+                ->inc_mqtt_accept_connections_count_metric(cfg.proto, cfg.port,
+                                                           acceptor_id);
+            if (!check_conn_limit(ssl_socket.next_layer())) {
+                continue;
+            }
             std::make_shared<
                 MqttSession<asio::ssl::stream<asio::ip::tcp::socket>>>(
                 std::move(ssl_socket), is_websocket, broker)
                 ->start();
+            co_await wait_conn_limit();
         }
 
     } else {
         for (;;) {
+            auto socket = co_await acceptor.async_accept(
+                get_io_context(acceptor_id), asio::use_awaitable);
+            MqttExposer::getInstance()
+                ->inc_mqtt_accept_connections_count_metric(cfg.proto, cfg.port,
+                                                           acceptor_id);
+            if (!check_conn_limit(socket)) {
+                continue;
+            }
             std::make_shared<MqttSession<asio::ip::tcp::socket>>(
-                co_await acceptor.async_accept(asio::use_awaitable),
-                is_websocket, broker)
+                std::move(socket), is_websocket, broker)
                 ->start();
+            co_await wait_conn_limit();
         }
     }
 #else
     for (;;) {
+        auto socket = co_await acceptor.async_accept(
+            get_io_context(acceptor_id), asio::use_awaitable);
+        MqttExposer::getInstance()->inc_mqtt_accept_connections_count_metric(
+            cfg.proto, cfg.port, acceptor_id);
+        if (!check_conn_limit(socket)) {
+            continue;
+        }
         std::make_shared<MqttSession<asio::ip::tcp::socket>>(
-            co_await acceptor.async_accept(asio::use_awaitable), is_websocket,
-            broker)
+            std::move(socket), is_websocket, broker)
             ->start();
+        co_await wait_conn_limit();
     }
 #endif
 
     co_return;
 }
+
+asio::awaitable<void> MqttServer::wait_conn_limit() {
+    auto delay = MqttLimits::getInstance()->consume_conn();
+    if (delay <= std::chrono::steady_clock::duration::zero()) {
+        co_return;
+    }
+
+    MqttExposer::getInstance()->inc_mqtt_global_conn_rate_limit_count_metric();
+
+    asio::steady_timer timer(co_await asio::this_coro::executor);
+    asio::error_code ec;
+
+    timer.expires_after(delay);
+    co_await timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+}
@@ -16,10 +16,27 @@ private:
 
     void stop();
 
-    asio::awaitable<void> handle_accept(asio::ip::tcp::acceptor acceptor, const mqtt_listener_cfg_t& cfg);
+    asio::io_context& get_io_context(std::size_t acceptor_id);
+
+    // 周期性的删除过期的离线会话
+    asio::awaitable<void> handle_session_expiry();
+
+    asio::awaitable<void> handle_accept(asio::ip::tcp::acceptor acceptor, const mqtt_listener_cfg_t& cfg, std::size_t acceptor_id);
+
+    // 同一个 IP 超出连接速率时关闭刚接受的连接, 在 TLS 握手之前检查
+    template <typename Socket>
+    bool check_conn_limit(Socket& socket);
+
+    // 超出全局连接速率时暂停接受连接, 新连接留在内核的监听队列中
+    asio::awaitable<void> wait_conn_limit();
 
 private:
-    asio::io_context io_context;
+    // 每个 I/O 线程运行一个独立的 io_context, 会话固定在其中一个上处理
+    std::vector<std::unique_ptr<asio::io_context>> io_contexts;
+    std::vector<asio::executor_work_guard<asio::io_context::executor_type>> work_guards;
+    // 每个监听地址创建的监听套接字数量, 支持 SO_REUSEPORT 时每个 I/O 线程一个
+    std::size_t acceptor_count;
+    std::size_t next_io_context;
     asio::signal_set signals;
 #ifdef MQ_WITH_TLS
     MqttBroker<asio::ip::tcp::socket, asio::ssl::stream<asio::ip::tcp::socket>> broker;
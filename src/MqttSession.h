@@ -1,12 +1,16 @@
 #pragma once
 
+#include "MqttBacklog.h"
 #include "MqttBroker.h"
 #include "MqttConfig.h"
+#include "MqttDecoder.h"
+#include "MqttEncoder.h"
 #include "MqttSessionState.h"
 #include "MqttUtils.h"
 #include "MqttWebSocket.h"
 #include "MqttExposer.h"
 #include "MqttLimits.h"
+#include "MqttTimingWheel.h"
 
 template <typename SocketType>
 class MqttSession: public std::enable_shared_from_this<MqttSession<SocketType>> {
@@ -23,10 +27,21 @@ public:
 
     std::string get_session_id();
 
-    void move_session_state(std::shared_ptr<MqttSession<SocketType>> old_session);
+    // 新会话接管同一个客户端标识符时取出旧会话的状态, 并关闭旧会话
+    MqttOfflineSession take_session_state();
+
+    // 持久会话离线时由 broker 取出需要保留的状态
+    MqttOfflineSession take_offline_session();
 
     void push_packet(const mqtt_packet_t& packet);
 
+    bool is_clean_session();
+
+    const std::unordered_map<std::string, uint8_t>& get_sub_topic_map();
+
+    // 创建后不再改变, 可以在其它线程中读取
+    const std::shared_ptr<MqttBacklog>& get_backlog();
+
 private:
 #ifdef MQ_WITH_TLS
     asio::awaitable<void> handle_ssl_handshake();
@@ -42,9 +57,17 @@ private:
 
     void handle_error_code();
 
+    asio::awaitable<void> restore_session_state(const std::shared_ptr<MqttSession<SocketType>>& old_session);
+
+    void restore_session_state(MqttOfflineSession old_state);
+
+    // 没有可用的报文标识符时返回 0
     uint16_t gen_packet_id();
 
-    asio::awaitable<void> handle_keep_alive();
+    void erase_waiting_packet(mqtt_waiting_packet_t& waiting_packet);
+
+    // 保活超时由时间轮回调, 只在会话所在的线程中执行
+    void handle_keep_alive_timeout();
 
     asio::awaitable<void> handle_packet();
 
@@ -52,15 +75,19 @@ private:
 
     asio::awaitable<MQTT_RC_CODE> read_websocket();
 
-    asio::awaitable<MQTT_RC_CODE> write_websocket(std::string_view msg, opcode op = opcode::binary, bool eof = true);
-
-    template <std::size_t N>
-    asio::awaitable<MQTT_RC_CODE> write_websocket(const std::array<asio::const_buffer, N>& msg, opcode op = opcode::binary, bool eof = true);
-
     asio::awaitable<MQTT_RC_CODE> handle_connect();
 
     asio::awaitable<MQTT_RC_CODE> handle_publish();
 
+    // 暂停读取客户端的报文, 直到 congested 中的会话和全局的积压都降到水位以下
+    asio::awaitable<void> wait_backlog(std::vector<std::shared_ptr<MqttBacklog>>& congested);
+
+    // 超出发布的字节速率时暂停读取, 直到 read_delay 时间后速率恢复
+    asio::awaitable<void> wait_read_delay();
+
+    // 日志模式下在存储同步到磁盘后发送 PUBACK 或 PUBREC
+    void commit_ack(uint8_t cmd, uint16_t packet_id);
+
     asio::awaitable<MQTT_RC_CODE> handle_puback();
 
     asio::awaitable<MQTT_RC_CODE> handle_pubrec();
@@ -77,68 +104,78 @@ private:
 
     asio::awaitable<MQTT_RC_CODE> handle_disconnect();
 
-    asio::awaitable<MQTT_RC_CODE> read_byte(uint8_t* addr, bool read_payload);
-
-    asio::awaitable<MQTT_RC_CODE> read_uint16(uint16_t* addr, bool read_payload);
+    MQTT_RC_CODE check_command();
 
-    asio::awaitable<MQTT_RC_CODE> read_bytes_to_buf(std::string& bytes, uint32_t n, bool read_payload);
+    MQTT_RC_CODE check_remaining_length();
 
-    asio::awaitable<MQTT_RC_CODE> read_uint16_header_length_bytes(std::string& bytes, bool read_payload);
+    MQTT_RC_CODE parse_fixed_header(std::size_t& header_length);
 
-    asio::awaitable<MQTT_RC_CODE> read_utf8_string(std::string& str, bool read_payload);
+    asio::awaitable<MQTT_RC_CODE> fill_recv_buffer();
 
-    asio::awaitable<MQTT_RC_CODE> read_will_packet(mqtt_packet_t& packet, bool read_payload);
+    asio::awaitable<MQTT_RC_CODE> read_mqtt_packet();
 
-    MQTT_RC_CODE add_mqtt_fixed_header(std::string& packet, uint8_t cmd, uint32_t remaining_length);
+    // WebSocket 连接在报文之前加上帧头
+    MQTT_RC_CODE enqueue_frame(mqtt_frame_t frame, opcode op = opcode::binary);
 
-    MQTT_RC_CODE check_command();
+    MQTT_RC_CODE enqueue_ack(uint8_t cmd, uint16_t packet_id);
 
-    MQTT_RC_CODE check_remaining_length();
+    MQTT_RC_CODE enqueue_publish(const mqtt_packet_t& packet, uint16_t packet_id);
 
-    MQTT_RC_CODE check_sub_topic(const std::string& topic_name);
+    // 将待投递的消息和发送队列中的报文按批量上限合并写出, 直到都写完
+    asio::awaitable<MQTT_RC_CODE> flush_send_queue();
 
-    MQTT_RC_CODE check_pub_topic(const std::string& topic_name);
+    // 发送协程没有在写时启动发送协程, 发送协程写完后退出
+    void notify_writer();
 
-    MQTT_RC_CODE check_validate_utf8(const std::string& ustr);
+    asio::awaitable<void> handle_write();
 
-    asio::awaitable<MQTT_RC_CODE> read_remaining_length();
+    // 以下 send_* 只将报文放入发送队列, 由发送协程统一写出
+    MQTT_RC_CODE send_connack(uint8_t ack, uint8_t reason_code);
 
-    asio::awaitable<MQTT_RC_CODE> read_fixed_header();
+    MQTT_RC_CODE send_suback(uint16_t packet_id, const std::string& payload);
 
-    asio::awaitable<MQTT_RC_CODE> send_connack(uint8_t ack, uint8_t reason_code);
+    MQTT_RC_CODE send_unsuback(uint16_t packet_id);
 
-    asio::awaitable<MQTT_RC_CODE> send_suback(uint16_t packet_id, const std::string& payload);
+    MQTT_RC_CODE send_puback(uint16_t packet_id);
 
-    asio::awaitable<MQTT_RC_CODE> send_unsuback(uint16_t packet_id);
+    MQTT_RC_CODE send_pubrec(uint16_t packet_id);
 
-    asio::awaitable<MQTT_RC_CODE> send_puback(uint16_t packet_id);
+    MQTT_RC_CODE send_pubrel(uint16_t packet_id);
 
-    asio::awaitable<MQTT_RC_CODE> send_pubrec(uint16_t packet_id);
+    MQTT_RC_CODE send_pubcomp(uint16_t packet_id);
 
-    asio::awaitable<MQTT_RC_CODE> send_pubrel(uint16_t packet_id);
+    MQTT_RC_CODE send_publimit(uint16_t packet_id);
 
-    asio::awaitable<MQTT_RC_CODE> send_pubcomp(uint16_t packet_id);
+    MQTT_RC_CODE send_pingresp();
 
-    asio::awaitable<MQTT_RC_CODE> send_publimit(uint16_t packet_id);
+    // 按等待表中最早到期的报文设置时间轮定时
+    void flush_waiting_deadline();
 
-    asio::awaitable<MQTT_RC_CODE> send_pingresp();
+    void schedule_resend(mqtt_waiting_packet_t& waiting_packet);
 
-    asio::awaitable<void> handle_inflighting_packets();
+    // 等待表中有报文到期时由时间轮回调
+    void handle_waiting_timeout();
 
-    asio::awaitable<void> handle_waiting_map_packets();
+    // 将待投递队列中的全部消息编码进发送队列
+    MQTT_RC_CODE send_mqtt_packets();
 
-    asio::awaitable<MQTT_RC_CODE> send_mqtt_packets(const std::list<mqtt_packet_t>& packet_list);
+    void send_publish_qos0(const mqtt_packet_t& packet);
 
-    asio::awaitable<void> send_publish_qos0(mqtt_packet_t packet);
+    // 第一次发送前将消息放入等待表, 收到确认之前占用发送窗口
+    void add_waiting_publish(const mqtt_packet_t& packet, uint16_t packet_id);
 
-    asio::awaitable<MQTT_RC_CODE> send_publish_qos1(mqtt_packet_t packet, bool is_new);
+    MQTT_RC_CODE send_publish_qos1(const mqtt_packet_t& packet, uint16_t packet_id);
 
-    asio::awaitable<MQTT_RC_CODE> send_publish_qos2(mqtt_packet_t packet, bool is_new);
+    MQTT_RC_CODE send_publish_qos2(const mqtt_packet_t& packet, uint16_t packet_id);
 
     void add_subscribe(const std::list<std::pair<std::string, uint8_t>>& sub_topic_list);
 
+    void get_retain(const std::list<std::pair<std::string, uint8_t>>& sub_topic_list);
+
     bool is_open();
 
+    MQTT_PROTOCOL get_mqtt_protocol();
+
     inline MQTT_QUALITY get_mqtt_quality(uint8_t qos) {
         if (qos == 0) return MQTT_QUALITY::Qos0;
         if (qos == 1) return MQTT_QUALITY::Qos1;
@@ -146,10 +183,6 @@ private:
         return MQTT_QUALITY::Unknown;
     }
 
-public:
-    // 统计存在订阅项的会话, 优化消息分发的性能
-    static std::unordered_set<std::string> active_sub_set;
-
 private:
     SocketType socket;
     bool is_websocket;
@@ -162,18 +195,37 @@ private:
 #else
     MqttBroker<asio::ip::tcp::socket>& broker;
 #endif
-    asio::steady_timer cond_timer;
-    asio::steady_timer keep_alive_timer;
-    asio::steady_timer check_timer;
-    asio::experimental::channel<void()> write_lock;
+    MqttTimingWheel& timing_wheel;
+    MqttTimingWheel::entry keep_alive_entry;
+    MqttTimingWheel::entry waiting_entry;
     MqttSessionState session_state;
+    // 已投递但还没有发出的消息字节数, 包括还在任务队列中的消息
+    std::shared_ptr<MqttBacklog> backlog;
+    // 连接时确定所属的限制组
+    mqtt_client_limit_t client_limit;
+    // 处理完当前报文后需要暂停读取的时间
+    std::chrono::steady_clock::duration read_delay;
     bool complete_connect;
     MQTT_RC_CODE rc;
     uint8_t command;
     uint32_t pos;
     uint32_t remaining_length;
     std::string payload;
-    std::chrono::steady_clock::time_point deadline;
+    // 当前报文的可变报头和有效载荷, 指向接收缓冲区或 payload
+    std::string_view packet_body;
+    // 接收缓冲区, [recv_begin, recv_end) 为已读取但还未解析的数据
+    std::vector<char> recv_buf;
+    std::size_t recv_begin;
+    std::size_t recv_end;
+    // 发送队列, 正在写出时新的报文追加到队尾, 由 is_writing 保证只有一个写操作
+    std::deque<mqtt_frame_t> send_queue;
+    std::vector<asio::const_buffer> send_buffers;
+    std::string send_linear_buf;
+    bool is_writing;
+    // 读协程已经退出, 等待发送协程写完后清理会话
+    bool is_closing;
+    // 会话状态已经被取出, 之后到达的消息交给 broker 重新投递
+    bool is_offline;
 };
 
 #include "MqttSession.ipp"
\ No newline at end of file
@@ -2,9 +2,6 @@
 
 using namespace std::string_view_literals;
 
-template <typename SocketType>
-std::unordered_set<std::string> MqttSession<SocketType>::active_sub_set;
-
 template <typename SocketType>
 MqttSession<SocketType>::MqttSession(
     SocketType socket, bool is_websocket,
@@ -18,23 +15,31 @@ MqttSession<SocketType>::MqttSession(
     : socket(std::move(socket)),
       is_websocket(is_websocket),
       broker(mqtt_broker),
-      cond_timer(socket.get_executor()),
-      keep_alive_timer(socket.get_executor()),
-      check_timer(socket.get_executor()),
-      write_lock(socket.get_executor(), 1),
+      timing_wheel(MqttTimingWheel::get(this->socket.get_executor())),
+      keep_alive_entry([this] { handle_keep_alive_timeout(); }),
+      waiting_entry([this] { handle_waiting_timeout(); }),
+      backlog(std::make_shared<MqttBacklog>(
+          MqttConfig::getInstance()->session_queue_high_watermark(),
+          &MqttBacklog::global())),
+      read_delay(std::chrono::steady_clock::duration::zero()),
       complete_connect(false),
       rc(MQTT_RC_CODE::ERR_SUCCESS),
       command(0),
       pos(0),
-      remaining_length(0) {
-    this->cond_timer.expires_at(std::chrono::steady_clock::time_point::max());
-    this->keep_alive_timer.expires_at(
-        std::chrono::steady_clock::time_point::max());
-    this->check_timer.expires_at(std::chrono::steady_clock::time_point::max());
-}
+      remaining_length(0),
+      recv_buf(MQTT_RECV_BUFFER_MIN_SIZE),
+      recv_begin(0),
+      recv_end(0),
+      is_writing(false),
+      is_closing(false),
+      is_offline(false) {}
 
 template <typename SocketType>
-MqttSession<SocketType>::~MqttSession() {}
+MqttSession<SocketType>::~MqttSession() {
+    // 关闭后没有发出的消息不再计入积压
+    this->backlog->release(this->session_state.inflight_queue.bytes());
+    MqttLimits::getInstance()->release(this->client_limit);
+}
 
 template <typename SocketType>
 void MqttSession<SocketType>::start() {
@@ -89,11 +94,6 @@ void MqttSession<SocketType>::handle_session() {
         socket.get_executor(),
         [self = this->shared_from_this()] { return self->handle_packet(); },
         asio::detached);
-
-    asio::co_spawn(
-        socket.get_executor(),
-        [self = this->shared_from_this()] { return self->handle_keep_alive(); },
-        asio::detached);
 }
 
 #ifdef MQ_WITH_TLS
@@ -157,10 +157,8 @@ void MqttSession<SocketType>::disconnect() {
             MQTT_PROTOCOL::MQTT);
     }
 #endif
-    this->cond_timer.cancel(ignored_ec);
-    this->keep_alive_timer.cancel(ignored_ec);
-    this->check_timer.cancel(ignored_ec);
-    this->write_lock.cancel();
+    this->timing_wheel.cancel(this->keep_alive_entry);
+    this->timing_wheel.cancel(this->waiting_entry);
 }
 
 template <typename SocketType>
@@ -170,16 +168,24 @@ void MqttSession<SocketType>::init_buffer() {
     this->command = 0;
     this->remaining_length = 0;
     this->payload.clear();
-    this->payload.shrink_to_fit();
+    this->packet_body = {};
+
+    // 只释放大报文占用的内存, 小报文复用已经分配的空间
+    if (this->payload.capacity() > MQTT_RECV_BUFFER_SIZE) {
+        this->payload.shrink_to_fit();
+    }
 }
 
 template <typename SocketType>
 void MqttSession<SocketType>::flush_deadline() {
-    if (this->session_state.keep_alive > 0) {
-        uint16_t keep_alive = this->session_state.keep_alive * 3 / 2;
+    // 保活时间为 0 时不检查超时, 连接关闭后定时项不能再挂到时间轮上
+    if (this->session_state.keep_alive > 0 && this->is_open()) {
+        uint32_t keep_alive = this->session_state.keep_alive * 3 / 2;
 
-        this->deadline =
-            std::chrono::steady_clock::now() + std::chrono::seconds(keep_alive);
+        this->timing_wheel.schedule(this->keep_alive_entry,
+                                    std::chrono::seconds(keep_alive));
+    } else {
+        this->timing_wheel.cancel(this->keep_alive_entry);
     }
 }
 
@@ -187,22 +193,21 @@ template <typename SocketType>
 void MqttSession<SocketType>::handle_error_code() {
     disconnect();
 
-    // 会话清理
-    if (this->complete_connect && this->session_state.clean_session) {
-        MqttSession<SocketType>::active_sub_set.erase(this->client_id);
-        this->broker.leave(this->client_id);
+    // 会话清理, 持久会话转为离线记录保存在 broker 中
+    if (this->complete_connect) {
+        this->broker.leave(this->shared_from_this());
     }
 
     // 如果存在遗嘱消息就发送
     if (this->complete_connect &&
-        this->session_state.will_topic.topic_name->length()) {
+        !this->session_state.will_topic.message.topic_name().empty()) {
         // 如果是保留的需要添加到保留消息集合中
         if (this->session_state.will_topic.retain) {
             this->broker.add_retain(this->session_state.will_topic);
         }
 
         SPDLOG_DEBUG("send will topic [{}]",
-                     *this->session_state.will_topic.topic_name);
+                     this->session_state.will_topic.message.topic_name());
 
         // 将保留消息标志置零后分发
         this->session_state.will_topic.retain = 0;
@@ -285,6 +290,10 @@ void MqttSession<SocketType>::handle_error_code() {
             SPDLOG_ERROR("Wrong authentication");
             break;
         }
+        case MQTT_RC_CODE::ERR_REFUSED_SERVER_UNAVAILABLE: {
+            SPDLOG_ERROR("Too many connections in limit group");
+            break;
+        }
         default: {
             SPDLOG_ERROR("Other error");
         }
@@ -293,39 +302,41 @@ void MqttSession<SocketType>::handle_error_code() {
 
 template <typename SocketType>
 uint16_t MqttSession<SocketType>::gen_packet_id() {
-    do {
-        this->session_state.packet_id_gen++;
+    uint32_t max_inflight = MqttConfig::getInstance()->max_inflight_messages();
 
-        // packet id must > 0
-        if (this->session_state.packet_id_gen == 0) {
-            this->session_state.packet_id_gen++;
-        }
-    } while (this->session_state.waiting_map.contains(
-        this->session_state.packet_id_gen));
+    // 标识符的范围取窗口的两倍, 不限制窗口时可以使用全部的标识符
+    uint16_t max_id = 65535;
+    if (max_inflight > 0) {
+        max_id = std::clamp<uint32_t>(max_inflight * 2, 64, 65535);
+    }
 
-    return this->session_state.packet_id_gen;
+    // 客户端发来的 Qos2 报文也以报文标识符记录在等待表中, 不能和它重复
+    const auto& waiting_map = this->session_state.waiting_map;
+    return this->session_state.packet_ids.allocate(
+        max_id,
+        [&waiting_map](uint16_t packet_id) {
+            return waiting_map.contains(packet_id);
+        });
 }
 
 template <typename SocketType>
-asio::awaitable<void> MqttSession<SocketType>::handle_keep_alive() {
-    auto check_duration = std::chrono::seconds(
-        MqttConfig::getInstance()->check_timeout_duration());
-
-    // 每到一次间隔时间检查一下是否超时
-    while (this->is_open()) {
-        this->keep_alive_timer.expires_after(check_duration);
+void MqttSession<SocketType>::erase_waiting_packet(
+    mqtt_waiting_packet_t& waiting_packet) {
+    // 服务端分配的标识符同时释放, 发送窗口空出一个位置
+    this->session_state.packet_ids.release(waiting_packet.packet_id);
+    this->session_state.waiting_map.erase(waiting_packet);
+}
 
-        co_await this->keep_alive_timer.async_wait(asio::use_awaitable);
+template <typename SocketType>
+void MqttSession<SocketType>::handle_keep_alive_timeout() {
+    SPDLOG_INFO("keep alive timeout, client_id = [{}]", this->client_id);
 
-        if (this->deadline <= std::chrono::steady_clock::now()) {
-            disconnect();
-        }
-    }
+    // 关闭连接后读操作失败, 由 handle_packet 完成会话清理
+    disconnect();
 }
 
 template <typename SocketType>
-void MqttSession<SocketType>::move_session_state(
-    std::shared_ptr<MqttSession<SocketType>> new_session) {
+MqttOfflineSession MqttSession<SocketType>::take_session_state() {
     // 连接完成标志置为未完成, 这样连接断开后不会再去调用 leave 删除会话
     // 也不会发送遗嘱消息
     this->complete_connect = false;
@@ -333,362 +344,123 @@ void MqttSession<SocketType>::move_session_state(
     // 关闭旧会话的连接
     disconnect();
 
-    // 恢复会话状态
-    if (new_session->session_state.clean_session == 0) {
-        new_session->session_state.inflight_queue =
-            std::move(this->session_state.inflight_queue);
-        new_session->session_state.sub_topic_map =
-            std::move(this->session_state.sub_topic_map);
-        new_session->session_state.waiting_map =
-            std::move(this->session_state.waiting_map);
-    }
-}
-
-template <typename SocketType>
-void MqttSession<SocketType>::push_packet(const mqtt_packet_t& packet) {
-    this->session_state.inflight_queue.emplace(packet);
-    SPDLOG_DEBUG("push packet: topic_name = [{}], payload = [{}]",
-                 *packet.topic_name, *packet.payload);
-
-    // 通知处理线程读取消息
-    this->cond_timer.cancel_one();
-}
-
-template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::read_byte(
-    uint8_t* addr, bool read_payload) {
-    asio::error_code ec;
-
-    if (read_payload) {
-        if (this->pos + 1 > this->remaining_length) {
-            co_return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
-        }
-
-        *addr = this->payload[this->pos];
-        this->pos += 1;
-
-        co_return MQTT_RC_CODE::ERR_SUCCESS;
-    }
-
-    co_await async_read(this->socket, asio::buffer(addr, 1),
-                        asio::redirect_error(asio::use_awaitable, ec));
-    if (ec) {
-        co_return MQTT_RC_CODE::ERR_NO_CONN;
-    }
-
-    co_return MQTT_RC_CODE::ERR_SUCCESS;
-}
-
-template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::read_uint16(
-    uint16_t* addr, bool read_payload) {
-    asio::error_code ec;
-    uint8_t msb, lsb;
-
-    if (read_payload) {
-        if (this->pos + 2 > this->remaining_length) {
-            co_return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
-        }
-
-        msb = this->payload[this->pos];
-        lsb = this->payload[this->pos + 1];
-
-        *addr = static_cast<uint16_t>((msb << 8) + lsb);
-
-        this->pos += 2;
-
-        co_return MQTT_RC_CODE::ERR_SUCCESS;
-    }
-
-    std::array<asio::mutable_buffer, 2> buf = {
-        {asio::buffer(&msb, sizeof(uint8_t)),
-         asio::buffer(&lsb, sizeof(uint8_t))}};
-
-    co_await async_read(this->socket, buf,
-                        asio::redirect_error(asio::use_awaitable, ec));
-    if (ec) {
-        co_return MQTT_RC_CODE::ERR_NO_CONN;
-    }
-
-    *addr = static_cast<uint16_t>((msb << 8) + lsb);
-
-    co_return MQTT_RC_CODE::ERR_SUCCESS;
-}
-
-template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::read_bytes_to_buf(
-    std::string& bytes, uint32_t n, bool read_payload) {
-    asio::error_code ec;
-
-    if (n == 0) {
-        co_return MQTT_RC_CODE::ERR_SUCCESS;
-    }
-
-    bytes.resize(n);
-
-    if (read_payload) {
-        if (this->pos + n > this->remaining_length) {
-            co_return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
-        }
-
-        std::memcpy(bytes.data(), this->payload.data() + this->pos, n);
-
-        this->pos += n;
-
-        co_return MQTT_RC_CODE::ERR_SUCCESS;
-    }
-
-    co_await async_read(this->socket,
-                        asio::buffer(bytes.data(), bytes.length()),
-                        asio::redirect_error(asio::use_awaitable, ec));
-    if (ec) {
-        co_return MQTT_RC_CODE::ERR_NO_CONN;
-    }
-
-    co_return MQTT_RC_CODE::ERR_SUCCESS;
+    return take_offline_session();
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE>
-MqttSession<SocketType>::read_uint16_header_length_bytes(std::string& bytes,
-                                                         bool read_payload) {
-    asio::error_code ec;
-    MQTT_RC_CODE rc;
-    uint16_t slen;
-
-    rc = co_await read_uint16(&slen, read_payload);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
-
-    if (slen == 0) {
-        co_return rc;
-    }
-
-    bytes.resize(slen);
+MqttOfflineSession MqttSession<SocketType>::take_offline_session() {
+    MqttOfflineSession offline_session;
 
-    if (read_payload) {
-        if (this->pos + slen > this->remaining_length) {
-            co_return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
-        }
-
-        std::memcpy(bytes.data(), this->payload.data() + this->pos, slen);
-
-        this->pos += slen;
-        co_return MQTT_RC_CODE::ERR_SUCCESS;
-    }
+    offline_session.packet_ids = std::move(this->session_state.packet_ids);
+    offline_session.sub_topic_map =
+        std::move(this->session_state.sub_topic_map);
+    offline_session.waiting_map = std::move(this->session_state.waiting_map);
+    this->backlog->release(this->session_state.inflight_queue.bytes());
+    offline_session.inflight_queue =
+        std::move(this->session_state.inflight_queue);
 
-    co_await async_read(this->socket,
-                        asio::buffer(bytes.data(), bytes.length()),
-                        asio::redirect_error(asio::use_awaitable, ec));
-
-    if (ec) {
-        co_return MQTT_RC_CODE::ERR_NO_CONN;
-    }
+    this->is_offline = true;
+    this->timing_wheel.cancel(this->waiting_entry);
 
-    co_return rc;
+    return offline_session;
 }
 
 template <typename SocketType>
-MQTT_RC_CODE MqttSession<SocketType>::check_validate_utf8(
-    const std::string& ustr) {
-    uint32_t len = ustr.length();
-    uint32_t i, j, codelen, codepoint;
-
-    if (len > 65536) return MQTT_RC_CODE::ERR_STR_LENGTH_UTF8;
-
-    for (i = 0; i < len; i++) {
-        if (ustr[i] == 0) {
-            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
-        } else if (ustr[i] <= 0x7f) {
-            codelen = 1;
-            codepoint = ustr[i];
-        } else if ((ustr[i] & 0xE0) == 0xC0) {
-            if (ustr[i] == 0xC0 || ustr[i] == 0xC1) {
-                return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
-            }
-            codelen = 2;
-            codepoint = (ustr[i] & 0x1F);
-        } else if ((ustr[i] & 0xF0) == 0xE0) {
-            codelen = 3;
-            codepoint = (ustr[i] & 0x0F);
-        } else if ((ustr[i] & 0xF8) == 0xF0) {
-            if (ustr[i] > 0xF4) {
-                return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
-            }
-            codelen = 4;
-            codepoint = (ustr[i] & 0x07);
-        } else {
-            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
-        }
-
-        for (j = 0; j < codelen - 1; j++) {
-            if ((ustr[++i] & 0xC0) != 0x80) {
-                return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
-            }
-            codepoint = (codepoint << 6) | (ustr[i] & 0x3F);
-        }
-
-        if (codepoint >= 0xD800 && codepoint <= 0xDFFF) {
-            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
-        }
-
-        if (codelen == 3 && codepoint < 0x0800) {
-            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
-        } else if (codelen == 4 &&
-                   (codepoint < 0x10000 || codepoint > 0x10FFFF)) {
-            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
-        }
-
-        if (codepoint >= 0xFDD0 && codepoint <= 0xFDEF) {
-            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
-        }
-        if ((codepoint & 0xFFFF) == 0xFFFE || (codepoint & 0xFFFF) == 0xFFFF) {
-            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
-        }
-
-        if (codepoint <= 0x001F ||
-            (codepoint >= 0x007F && codepoint <= 0x009F)) {
-            return MQTT_RC_CODE::ERR_MALFORMED_UTF8;
-        }
+asio::awaitable<void> MqttSession<SocketType>::restore_session_state(
+    const std::shared_ptr<MqttSession<SocketType>>& old_session) {
+    // 旧会话可能运行在其它 I/O 线程中, 先切换到旧会话的线程取出会话状态,
+    // 再切换回当前会话的线程
+    co_await asio::dispatch(
+        asio::bind_executor(old_session->socket.get_executor(),
+                            asio::use_awaitable));
+    MqttOfflineSession old_state = old_session->take_session_state();
+    co_await asio::dispatch(asio::bind_executor(this->socket.get_executor(),
+                                                asio::use_awaitable));
+
+    if (this->session_state.clean_session) {
+        // 新会话不保留状态时, 旧会话的订阅项也要从订阅树中删除
+        this->broker.unsubscribe_all(this->client_id, old_state.sub_topic_map);
+        co_return;
     }
 
-    return MQTT_RC_CODE::ERR_SUCCESS;
+    restore_session_state(std::move(old_state));
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::read_utf8_string(
-    std::string& str, bool read_payload) {
-    MQTT_RC_CODE rc;
+void MqttSession<SocketType>::restore_session_state(
+    MqttOfflineSession old_state) {
+    // 恢复会话状态, 加入 broker 后新投递的消息排在旧消息之后
+    this->backlog->add(old_state.inflight_queue.bytes());
 
-    rc = co_await read_uint16_header_length_bytes(str, read_payload);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
+    while (!this->session_state.inflight_queue.empty()) {
+        old_state.inflight_queue.push(
+            this->session_state.inflight_queue.front());
+        this->session_state.inflight_queue.pop();
     }
 
-    rc = check_validate_utf8(str);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
+    this->session_state.inflight_queue = std::move(old_state.inflight_queue);
+    this->session_state.sub_topic_map = std::move(old_state.sub_topic_map);
+    this->session_state.waiting_map = std::move(old_state.waiting_map);
+    this->session_state.packet_ids = std::move(old_state.packet_ids);
 
-    co_return rc;
+    // 重连后立即重发未确认的 PUBLISH 和 PUBREL, 不再等待原来的重发时间
+    this->session_state.waiting_map.expire_resend(
+        std::chrono::steady_clock::now());
 }
 
 template <typename SocketType>
-MQTT_RC_CODE MqttSession<SocketType>::check_sub_topic(
-    const std::string& topic_name) {
-    if (topic_name.empty()) {
-        return MQTT_RC_CODE::ERR_SUB_TOPIC_NAME;
-    }
-
-    uint32_t slen = topic_name.length();
-
-    if (slen > 65535) {
-        return MQTT_RC_CODE::ERR_STR_LENGTH_UTF8;
-    }
-
-    for (uint32_t i = 0; i < slen; i++) {
-        if (topic_name[i] == '+') {
-            // 只能单独占一个主题层级
-            if ((i == 0 || topic_name[i - 1] == '/') &&
-                (i == slen - 1 || topic_name[i + 1] == '/')) {
-            } else {
-                return MQTT_RC_CODE::ERR_SUB_TOPIC_NAME;
-            }
-
-        } else if (topic_name[i] == '#') {
-            // 只能是最后一个且只有当没有其它字符时前面才能没有 '/'
-            if (i == slen - 1 && (i == 0 || topic_name[i - 1] == '/')) {
-            } else {
-                return MQTT_RC_CODE::ERR_SUB_TOPIC_NAME;
-            }
-        }
-    }
-
-    return MQTT_RC_CODE::ERR_SUCCESS;
+void MqttSession<SocketType>::push_packet(const mqtt_packet_t& packet) {
+    // 投递时就计入积压, 发布者可以立即看到任务队列中还没有处理的消息
+    std::size_t packet_bytes = packet.message.remaining_length();
+    this->backlog->add(packet_bytes);
+
+    // 会话状态只在会话所在的线程中访问, 在其它线程调用时投递到会话的任务队列
+    asio::dispatch(this->socket.get_executor(),
+                   [self = this->shared_from_this(), packet, packet_bytes] {
+                       if (self->is_offline) {
+                           self->backlog->release(packet_bytes);
+                           self->broker.redeliver(self->client_id, packet);
+                           return;
+                       }
+
+                       auto config = MqttConfig::getInstance();
+                       auto& queue = self->session_state.inflight_queue;
+                       std::size_t queued_bytes = queue.bytes() + packet_bytes;
+
+                       queue.push(packet);
+
+                       // 待投递的消息超过上限时按配置的策略丢弃
+                       std::size_t dropped =
+                           queue.trim(config->max_queued_messages(),
+                                      config->max_queued_bytes(),
+                                      config->queue_full_policy());
+                       MqttExposer::getInstance()
+                           ->inc_mqtt_queue_dropped_count_metric(dropped);
+                       self->backlog->release(queued_bytes - queue.bytes());
+
+                       SPDLOG_DEBUG(
+                           "push packet: topic_name = [{}], payload = [{}]",
+                           packet.message.topic_name(),
+                           packet.message.payload());
+
+                       self->notify_writer();
+                   });
 }
 
 template <typename SocketType>
-MQTT_RC_CODE MqttSession<SocketType>::check_pub_topic(
-    const std::string& topic_name) {
-    if (topic_name.length() > 65535) {
-        return MQTT_RC_CODE::ERR_STR_LENGTH_UTF8;
-    }
-
-    // 不能向包含通配符 #、+ 的主题发布消息
-    for (auto ch : topic_name) {
-        if (ch == '+' || ch == '#') {
-            return MQTT_RC_CODE::ERR_PUB_TOPIC_NAME;
-        }
-    }
-
-    return MQTT_RC_CODE::ERR_SUCCESS;
+const std::shared_ptr<MqttBacklog>& MqttSession<SocketType>::get_backlog() {
+    return this->backlog;
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::read_will_packet(
-    mqtt_packet_t& packet, bool read_payload) {
-    MQTT_RC_CODE rc;
-    std::string will_topic_name;
-    std::string will_payload;
-    uint16_t will_payloadlen;
-
-    rc = co_await read_utf8_string(will_topic_name, read_payload);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
-
-    rc = check_sub_topic(will_topic_name);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
-
-    rc = co_await read_uint16(&will_payloadlen, read_payload);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
-
-    if (will_payloadlen > 0) {
-        rc = co_await read_bytes_to_buf(will_payload, will_payloadlen,
-                                        read_payload);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    }
-
-    packet.topic_name =
-        std::make_shared<const std::string>(std::move(will_topic_name));
-    packet.payload =
-        std::make_shared<const std::string>(std::move(will_payload));
-
-    co_return rc;
+bool MqttSession<SocketType>::is_clean_session() {
+    return this->session_state.clean_session;
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::read_remaining_length() {
-    MQTT_RC_CODE rc = MQTT_RC_CODE::ERR_SUCCESS;
-
-    uint8_t byte;
-
-    for (uint32_t remaining_count = 0, remaining_mult = 1; remaining_count < 4;
-         remaining_count++, remaining_mult <<= 7) {
-        rc = co_await read_byte(&byte, false);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-
-        this->remaining_length += (byte & 0x7F) * remaining_mult;
-
-        if (!(byte & 0x80)) break;
-    }
-
-    if (byte & 0x80) {
-        rc = MQTT_RC_CODE::ERR_REMAINING_LENGTH;
-    }
-
-    SPDLOG_DEBUG("remaning length = [{}]", this->remaining_length);
-
-    co_return rc;
+const std::unordered_map<std::string, uint8_t>&
+MqttSession<SocketType>::get_sub_topic_map() {
+    return this->session_state.sub_topic_map;
 }
 
 template <typename SocketType>
@@ -785,395 +557,414 @@ MQTT_RC_CODE MqttSession<SocketType>::check_remaining_length() {
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::read_fixed_header() {
+MQTT_RC_CODE MqttSession<SocketType>::parse_fixed_header(
+    std::size_t& header_length) {
     MQTT_RC_CODE rc = MQTT_RC_CODE::ERR_SUCCESS;
 
-    rc = co_await read_byte(&this->command, false);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
+    const auto* data =
+        reinterpret_cast<const uint8_t*>(this->recv_buf.data()) +
+        this->recv_begin;
+    std::size_t length = this->recv_end - this->recv_begin;
 
-    rc = check_command();
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
+    // 固定报头还没有接收完整时返回长度 0, 继续从 socket 中读取
+    header_length = 0;
 
-    rc = co_await read_remaining_length();
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
+    if (length < 2) {
+        return rc;
     }
 
-    rc = check_remaining_length();
+    this->command = data[0];
+
+    rc = check_command();
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
+        return rc;
     }
 
-    co_return rc;
-}
+    uint32_t value = 0;
+    std::size_t idx = 1;
 
-template <typename SocketType>
-MQTT_RC_CODE MqttSession<SocketType>::add_mqtt_fixed_header(std::string& packet,
-                                                            uint8_t cmd,
-                                                            uint32_t rlen) {
-    uint8_t remaining_bytes[5], byte;
-    uint8_t remaining_count = 0;
+    for (uint32_t remaining_mult = 1; idx <= 4; idx++, remaining_mult <<= 7) {
+        if (idx >= length) {
+            return rc;
+        }
 
-    do {
-        byte = rlen % 0x80;
-        rlen /= 0x80;
+        value += (data[idx] & 0x7F) * remaining_mult;
 
-        if (rlen > 0) {
-            byte |= 0x80;
+        if (!(data[idx] & 0x80)) {
+            break;
         }
+    }
 
-        remaining_bytes[remaining_count] = byte;
+    if (idx > 4) {
+        return MQTT_RC_CODE::ERR_REMAINING_LENGTH;
+    }
 
-        remaining_count++;
+    this->remaining_length = value;
 
-    } while (rlen > 0 && remaining_count < 5);
+    SPDLOG_DEBUG("remaning length = [{}]", this->remaining_length);
 
-    if (remaining_count == 5) {
-        return MQTT_RC_CODE::ERR_PAYLOAD_SIZE;
+    rc = check_remaining_length();
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
     }
 
-    packet.reserve(1 + remaining_count);
-    packet.push_back(cmd);
-
-    // remaining_count 至少为 1
-    for (uint8_t idx = 0; idx < remaining_count; idx++) {
-        packet.push_back(remaining_bytes[idx]);
-    }
+    header_length = idx + 1;
 
-    return MQTT_RC_CODE::ERR_SUCCESS;
+    return rc;
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_connack(
-    uint8_t ack, uint8_t reason_code) {
+asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::fill_recv_buffer() {
     asio::error_code ec;
-    MQTT_RC_CODE rc = MQTT_RC_CODE::ERR_SUCCESS;
-
-    SPDLOG_DEBUG("CONNACK: send ack = [X'{:02X}'] reason_code = [X'{:02X}']",
-                 static_cast<uint16_t>(ack),
-                 static_cast<uint16_t>(reason_code));
+    MQTT_RC_CODE rc;
 
-    std::string packet;
+    // 读取 socket 之前通知发送协程写出已经处理的报文产生的响应,
+    // 读协程挂起后多个响应合并写出
+    notify_writer();
 
-    rc = add_mqtt_fixed_header(packet, MQTT_CMD::CONNACK, 2);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
+    // 已解析的数据不再需要, 将剩余数据移动到缓冲区头部
+    if (this->recv_begin > 0) {
+        std::memmove(this->recv_buf.data(),
+                     this->recv_buf.data() + this->recv_begin,
+                     this->recv_end - this->recv_begin);
+        this->recv_end -= this->recv_begin;
+        this->recv_begin = 0;
     }
 
-    std::array<asio::const_buffer, 3> buf = {
-        {asio::buffer(packet.data(), packet.length()),
-         asio::buffer(&ack, sizeof(uint8_t)),
-         asio::buffer(&reason_code, sizeof(uint8_t))}};
+    // 缓冲区已满时扩容, 空闲连接只占用较小的缓冲区
+    if (this->recv_end == this->recv_buf.size() &&
+        this->recv_buf.size() < MQTT_RECV_BUFFER_SIZE) {
+        this->recv_buf.resize(
+            std::min(this->recv_buf.size() * 2, MQTT_RECV_BUFFER_SIZE));
+    }
 
-    if (this->is_websocket) {
-        rc = co_await this->write_websocket(buf);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    } else {
-        co_await async_write(socket, buf,
-                             asio::redirect_error(asio::use_awaitable, ec));
-        if (ec) {
-            co_return MQTT_RC_CODE::ERR_NO_CONN;
-        }
+    // 一次读取 socket 中所有可读的数据, 后续从缓冲区中解析多个报文
+    std::size_t n = co_await this->socket.async_read_some(
+        asio::buffer(this->recv_buf.data() + this->recv_end,
+                     this->recv_buf.size() - this->recv_end),
+        asio::redirect_error(asio::use_awaitable, ec));
+    if (ec) {
+        co_return MQTT_RC_CODE::ERR_NO_CONN;
     }
 
-    co_return rc;
+    this->recv_end += n;
+
+    co_return MQTT_RC_CODE::ERR_SUCCESS;
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_suback(
-    uint16_t packet_id, const std::string& payload) {
+asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::read_mqtt_packet() {
     asio::error_code ec;
     MQTT_RC_CODE rc = MQTT_RC_CODE::ERR_SUCCESS;
+    std::size_t header_length = 0;
+
+    // 缓冲区中的数据足够解析出固定报头时不需要再读取 socket
+    for (;;) {
+        rc = parse_fixed_header(header_length);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS || header_length > 0) {
+            break;
+        }
 
-    std::string packet;
-    uint16_t net_packet_id;
+        rc = co_await fill_recv_buffer();
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            break;
+        }
+    }
 
-    rc = add_mqtt_fixed_header(packet, MQTT_CMD::SUBACK, 2 + payload.length());
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
 
-    net_packet_id = asio::detail::socket_ops::host_to_network_short(packet_id);
+    this->recv_begin += header_length;
 
-    std::array<asio::const_buffer, 3> buf = {
-        {asio::buffer(packet.data(), packet.length()),
-         asio::buffer(&net_packet_id, sizeof(uint16_t)),
-         asio::buffer(payload.data(), payload.length())}};
+    if (this->remaining_length == 0) {
+        co_return rc;
+    }
 
-    if (this->is_websocket) {
-        rc = co_await this->write_websocket(buf);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    } else {
-        co_await async_write(this->socket, buf,
-                             asio::redirect_error(asio::use_awaitable, ec));
-        if (ec) {
-            co_return MQTT_RC_CODE::ERR_NO_CONN;
+    // 报文能够放入缓冲区时, 在缓冲区中凑齐整个报文, 直接在缓冲区上解析
+    // 下一次读取 socket 之前缓冲区中的数据不会移动
+    if (this->remaining_length <= MQTT_RECV_BUFFER_SIZE) {
+        while (this->recv_end - this->recv_begin < this->remaining_length) {
+            rc = co_await fill_recv_buffer();
+            if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+                co_return rc;
+            }
         }
+
+        this->packet_body =
+            std::string_view(this->recv_buf.data() + this->recv_begin,
+                             this->remaining_length);
+        this->recv_begin += this->remaining_length;
+
+        co_return rc;
     }
 
-    SPDLOG_DEBUG("SUBACK: send packet_id = [X'{:04X}']", packet_id);
+    // 大报文先取出缓冲区中已有的部分, 剩余部分直接读取到 payload 中
+    std::size_t buffered = this->recv_end - this->recv_begin;
 
-    co_return rc;
-}
+    this->payload.resize(this->remaining_length);
+    std::memcpy(this->payload.data(), this->recv_buf.data() + this->recv_begin,
+                buffered);
+    this->recv_begin = this->recv_end = 0;
 
-template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_unsuback(
-    uint16_t packet_id) {
-    asio::error_code ec;
-    MQTT_RC_CODE rc;
-    std::string packet;
-    uint16_t net_packet_id;
+    notify_writer();
 
-    rc = add_mqtt_fixed_header(packet, MQTT_CMD::UNSUBACK, 2);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
+    co_await async_read(this->socket,
+                        asio::buffer(this->payload.data() + buffered,
+                                     this->remaining_length - buffered),
+                        asio::redirect_error(asio::use_awaitable, ec));
+    if (ec) {
+        co_return MQTT_RC_CODE::ERR_NO_CONN;
     }
 
-    net_packet_id = asio::detail::socket_ops::host_to_network_short(packet_id);
+    this->packet_body = this->payload;
 
-    std::array<asio::const_buffer, 2> buf = {
-        {asio::buffer(packet.data(), packet.length()),
-         asio::buffer(&net_packet_id, sizeof(uint16_t))}};
+    co_return rc;
+}
 
+template <typename SocketType>
+MQTT_RC_CODE MqttSession<SocketType>::enqueue_frame(mqtt_frame_t frame,
+                                                    opcode op) {
     if (this->is_websocket) {
-        rc = co_await this->write_websocket(buf);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    } else {
-        co_await async_write(this->socket, buf,
-                             asio::redirect_error(asio::use_awaitable, ec));
-        if (ec) {
-            co_return MQTT_RC_CODE::ERR_NO_CONN;
-        }
+        std::string_view ws_header =
+            ws.encode_ws_header(frame.size(), op, true, false, false);
+
+        // 每个 MQTT 报文单独封装为一个 WebSocket 帧, 帧头放在最前面
+        frame.head.insert(0, ws_header);
     }
 
-    SPDLOG_DEBUG("UNSUBACK: send packet_id = [X'{:04X}']", packet_id);
+    this->send_queue.push_back(std::move(frame));
 
-    co_return rc;
+    return MQTT_RC_CODE::ERR_SUCCESS;
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_puback(
-    uint16_t packet_id) {
-    asio::error_code ec;
+MQTT_RC_CODE MqttSession<SocketType>::enqueue_ack(uint8_t cmd,
+                                                  uint16_t packet_id) {
     MQTT_RC_CODE rc;
-    std::string packet;
-    uint16_t net_packet_id;
+    mqtt_frame_t frame;
 
-    rc = add_mqtt_fixed_header(packet, MQTT_CMD::PUBACK, 2);
+    rc = MqttEncoder::encode_fixed_header(frame.head, cmd, 2);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
+        return rc;
     }
 
-    net_packet_id = asio::detail::socket_ops::host_to_network_short(packet_id);
+    frame.head.push_back(static_cast<char>(packet_id >> 8));
+    frame.head.push_back(static_cast<char>(packet_id & 0xFF));
+
+    return enqueue_frame(std::move(frame));
+}
 
-    std::array<asio::const_buffer, 2> buf = {
-        {asio::buffer(packet.data(), packet.length()),
-         asio::buffer(&net_packet_id, sizeof(uint16_t))}};
+template <typename SocketType>
+MQTT_RC_CODE MqttSession<SocketType>::enqueue_publish(
+    const mqtt_packet_t& packet, uint16_t packet_id) {
+    MQTT_RC_CODE rc;
+    mqtt_frame_t frame;
 
-    if (this->is_websocket) {
-        rc = co_await this->write_websocket(buf);
+    // 消息创建时已经编码了主题和固定报头, 这里只引用消息不做拷贝
+    frame.message = packet.message;
+    frame.fixed_header = frame.message.fixed_header(packet.qos);
+    frame.topic = frame.message.encoded_topic();
+    frame.body = frame.message.payload();
+
+    // 重发和保留消息带有 dup 或 retain 标志, 只能单独编码固定报头
+    if (packet.dup != 0 || packet.retain != 0 || frame.fixed_header.empty()) {
+        frame.fixed_header = {};
+
+        uint8_t command = static_cast<uint8_t>(
+            MQTT_CMD::PUBLISH | static_cast<uint8_t>((packet.dup & 1) << 3) |
+            static_cast<uint8_t>(packet.qos << 1) | packet.retain);
+
+        rc = MqttEncoder::encode_fixed_header(
+            frame.head, command,
+            frame.message.remaining_length() + (packet.qos > 0 ? 2 : 0));
         if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    } else {
-        co_await async_write(this->socket, buf,
-                             asio::redirect_error(asio::use_awaitable, ec));
-        if (ec) {
-            co_return MQTT_RC_CODE::ERR_NO_CONN;
+            return rc;
         }
     }
 
-    SPDLOG_DEBUG("PUBACK: send packet_id = [X'{:04X}']", packet_id);
+    if (packet.qos > 0) {
+        frame.has_packet_id = true;
+        frame.packet_id =
+            asio::detail::socket_ops::host_to_network_short(packet_id);
+    }
 
-    co_return rc;
+    return enqueue_frame(std::move(frame));
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_pubrec(
-    uint16_t packet_id) {
+asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::flush_send_queue() {
     asio::error_code ec;
     MQTT_RC_CODE rc;
-    std::string packet;
-    uint16_t net_packet_id;
-
-    rc = add_mqtt_fixed_header(packet, MQTT_CMD::PUBREC, 2);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
 
-    net_packet_id = asio::detail::socket_ops::host_to_network_short(packet_id);
+    std::size_t max_batch_bytes = MqttConfig::getInstance()->max_batch_bytes();
 
-    std::array<asio::const_buffer, 2> buf = {
-        {asio::buffer(packet.data(), packet.length()),
-         asio::buffer(&net_packet_id, sizeof(uint16_t))}};
-
-    if (this->is_websocket) {
-        rc = co_await this->write_websocket(buf);
+    // 写的过程中新投递的消息和新加入队列的报文在下一批中一起写出
+    for (;;) {
+        rc = send_mqtt_packets();
         if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
             co_return rc;
         }
-    } else {
-        co_await async_write(this->socket, buf,
-                             asio::redirect_error(asio::use_awaitable, ec));
-        if (ec) {
-            co_return MQTT_RC_CODE::ERR_NO_CONN;
+
+        if (this->send_queue.empty()) {
+            break;
         }
-    }
 
-    SPDLOG_DEBUG("PUBREC: send packet_id = [X'{:04X}']", packet_id);
+        std::size_t batch_count = 0;
+        std::size_t batch_bytes = 0;
 
-    co_return rc;
-}
+        this->send_buffers.clear();
 
-template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_pubrel(
-    uint16_t packet_id) {
-    asio::error_code ec;
-    MQTT_RC_CODE rc;
-    std::string packet;
-    uint16_t net_packet_id;
+        // 至少取一个报文, 之后在不超过批量上限的情况下尽可能多取
+        for (const auto& frame : this->send_queue) {
+            std::size_t frame_bytes = frame.size();
 
-    rc = add_mqtt_fixed_header(packet, MQTT_CMD::PUBREL | 0x02, 2);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
+            if (batch_count > 0 && batch_bytes + frame_bytes > max_batch_bytes) {
+                break;
+            }
 
-    net_packet_id = asio::detail::socket_ops::host_to_network_short(packet_id);
+            frame.append_buffers(this->send_buffers);
 
-    std::array<asio::const_buffer, 2> buf = {
-        {asio::buffer(packet.data(), packet.length()),
-         asio::buffer(&net_packet_id, sizeof(uint16_t))}};
+            batch_count++;
+            batch_bytes += frame_bytes;
+        }
 
-    if (this->is_websocket) {
-        rc = co_await this->write_websocket(buf);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
+#ifdef MQ_WITH_TLS
+        if constexpr (std::is_same_v<SocketType, asio::ssl::stream<
+                                                     asio::ip::tcp::socket>>) {
+            // SSL 流每次只加密缓冲区序列中的第一块, 拼接成连续内存后
+            // 整批数据才能合并到尽量少的 TLS 记录中
+            this->send_linear_buf.resize(batch_bytes);
+            asio::buffer_copy(asio::buffer(this->send_linear_buf),
+                              this->send_buffers);
+
+            co_await async_write(this->socket,
+                                 asio::buffer(this->send_linear_buf),
+                                 asio::redirect_error(asio::use_awaitable, ec));
+
+            if (this->send_linear_buf.capacity() > max_batch_bytes) {
+                this->send_linear_buf.clear();
+                this->send_linear_buf.shrink_to_fit();
+            }
+        } else {
+            co_await async_write(this->socket, this->send_buffers,
+                                 asio::redirect_error(asio::use_awaitable, ec));
         }
-    } else {
-        co_await async_write(this->socket, buf,
+#else
+        co_await async_write(this->socket, this->send_buffers,
                              asio::redirect_error(asio::use_awaitable, ec));
+#endif
         if (ec) {
             co_return MQTT_RC_CODE::ERR_NO_CONN;
         }
-    }
 
-    SPDLOG_DEBUG("PUBREL: send packet_id = [X'{:04X}']", packet_id);
+        MqttExposer::getInstance()->observe_mqtt_write_batch_metric(
+            get_mqtt_protocol(), batch_count, batch_bytes);
 
-    co_return rc;
+        this->send_queue.erase(this->send_queue.begin(),
+                               this->send_queue.begin() + batch_count);
+    }
+
+    co_return MQTT_RC_CODE::ERR_SUCCESS;
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_pubcomp(
-    uint16_t packet_id) {
-    asio::error_code ec;
+MQTT_RC_CODE MqttSession<SocketType>::send_connack(uint8_t ack,
+                                                   uint8_t reason_code) {
     MQTT_RC_CODE rc;
-    std::string packet;
-    uint16_t net_packet_id;
+    mqtt_frame_t frame;
 
-    rc = add_mqtt_fixed_header(packet, MQTT_CMD::PUBCOMP, 2);
+    SPDLOG_DEBUG("CONNACK: send ack = [X'{:02X}'] reason_code = [X'{:02X}']",
+                 static_cast<uint16_t>(ack),
+                 static_cast<uint16_t>(reason_code));
+
+    rc = MqttEncoder::encode_fixed_header(frame.head, MQTT_CMD::CONNACK, 2);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
+        return rc;
     }
 
-    net_packet_id = asio::detail::socket_ops::host_to_network_short(packet_id);
+    frame.head.push_back(static_cast<char>(ack));
+    frame.head.push_back(static_cast<char>(reason_code));
 
-    std::array<asio::const_buffer, 2> buf = {
-        {asio::buffer(packet.data(), packet.length()),
-         asio::buffer(&net_packet_id, sizeof(uint16_t))}};
+    return enqueue_frame(std::move(frame));
+}
 
-    if (this->is_websocket) {
-        rc = co_await this->write_websocket(buf);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    } else {
-        co_await async_write(this->socket, buf,
-                             asio::redirect_error(asio::use_awaitable, ec));
-        if (ec) {
-            co_return MQTT_RC_CODE::ERR_NO_CONN;
-        }
+template <typename SocketType>
+MQTT_RC_CODE MqttSession<SocketType>::send_suback(uint16_t packet_id,
+                                                  const std::string& payload) {
+    MQTT_RC_CODE rc;
+    mqtt_frame_t frame;
+
+    rc = MqttEncoder::encode_fixed_header(frame.head, MQTT_CMD::SUBACK,
+                                          2 + payload.length());
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        return rc;
     }
 
-    SPDLOG_DEBUG("PUBCOMP: send packet_id = [X'{:04X}']", packet_id);
+    frame.head.push_back(static_cast<char>(packet_id >> 8));
+    frame.head.push_back(static_cast<char>(packet_id & 0xFF));
+    frame.head.append(payload);
 
-    co_return rc;
+    SPDLOG_DEBUG("SUBACK: send packet_id = [X'{:04X}']", packet_id);
+
+    return enqueue_frame(std::move(frame));
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_publimit(
-    uint16_t packet_id) {
-    asio::error_code ec;
-    MQTT_RC_CODE rc;
-    std::string packet;
-    uint16_t net_packet_id;
+MQTT_RC_CODE MqttSession<SocketType>::send_unsuback(uint16_t packet_id) {
+    SPDLOG_DEBUG("UNSUBACK: send packet_id = [X'{:04X}']", packet_id);
 
-    rc = add_mqtt_fixed_header(packet, MQTT_CMD::PUBLIMIT, 2);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
+    return enqueue_ack(MQTT_CMD::UNSUBACK, packet_id);
+}
 
-    net_packet_id = asio::detail::socket_ops::host_to_network_short(packet_id);
+template <typename SocketType>
+MQTT_RC_CODE MqttSession<SocketType>::send_puback(uint16_t packet_id) {
+    SPDLOG_DEBUG("PUBACK: send packet_id = [X'{:04X}']", packet_id);
 
-    std::array<asio::const_buffer, 2> buf = {
-        {asio::buffer(packet.data(), packet.length()),
-         asio::buffer(&net_packet_id, sizeof(uint16_t))}};
+    return enqueue_ack(MQTT_CMD::PUBACK, packet_id);
+}
 
-    if (this->is_websocket) {
-        rc = co_await this->write_websocket(buf);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    } else {
-        co_await async_write(this->socket, buf,
-                             asio::redirect_error(asio::use_awaitable, ec));
-        if (ec) {
-            co_return MQTT_RC_CODE::ERR_NO_CONN;
-        }
-    }
+template <typename SocketType>
+MQTT_RC_CODE MqttSession<SocketType>::send_pubrec(uint16_t packet_id) {
+    SPDLOG_DEBUG("PUBREC: send packet_id = [X'{:04X}']", packet_id);
+
+    return enqueue_ack(MQTT_CMD::PUBREC, packet_id);
+}
+
+template <typename SocketType>
+MQTT_RC_CODE MqttSession<SocketType>::send_pubrel(uint16_t packet_id) {
+    SPDLOG_DEBUG("PUBREL: send packet_id = [X'{:04X}']", packet_id);
+
+    return enqueue_ack(MQTT_CMD::PUBREL | 0x02, packet_id);
+}
+
+template <typename SocketType>
+MQTT_RC_CODE MqttSession<SocketType>::send_pubcomp(uint16_t packet_id) {
+    SPDLOG_DEBUG("PUBCOMP: send packet_id = [X'{:04X}']", packet_id);
+
+    return enqueue_ack(MQTT_CMD::PUBCOMP, packet_id);
+}
 
+template <typename SocketType>
+MQTT_RC_CODE MqttSession<SocketType>::send_publimit(uint16_t packet_id) {
     SPDLOG_DEBUG("PUBLIMIT: send packet_id = [X'{:04X}']", packet_id);
 
-    co_return rc;
+    return enqueue_ack(MQTT_CMD::PUBLIMIT, packet_id);
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_pingresp() {
-    asio::error_code ec;
+MQTT_RC_CODE MqttSession<SocketType>::send_pingresp() {
     MQTT_RC_CODE rc;
-    std::string packet;
+    mqtt_frame_t frame;
 
-    rc = add_mqtt_fixed_header(packet, MQTT_CMD::PINGRESP, 0);
+    rc = MqttEncoder::encode_fixed_header(frame.head, MQTT_CMD::PINGRESP, 0);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
-
-    if (this->is_websocket) {
-        rc = co_await this->write_websocket(packet);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    } else {
-        co_await async_write(this->socket,
-                             asio::buffer(packet.data(), packet.length()),
-                             asio::redirect_error(asio::use_awaitable, ec));
-        if (ec) {
-            co_return MQTT_RC_CODE::ERR_NO_CONN;
-        }
+        return rc;
     }
 
     SPDLOG_DEBUG("PINGRESP");
 
-    co_return rc;
+    return enqueue_frame(std::move(frame));
 }
 
 template <typename SocketType>
@@ -1198,17 +989,13 @@ asio::awaitable<void> MqttSession<SocketType>::handle_packet() {
                 break;
             }
 
+            this->packet_body = this->payload;
+
             SPDLOG_INFO("command = [X'{:02X}'], remaining_length = [{}]",
                         static_cast<uint16_t>(this->command),
                         this->remaining_length);
         } else {
-            this->rc = co_await read_fixed_header();
-            if (this->rc != MQTT_RC_CODE::ERR_SUCCESS) {
-                break;
-            }
-
-            this->rc = co_await read_bytes_to_buf(
-                this->payload, this->remaining_length, false);
+            this->rc = co_await read_mqtt_packet();
             if (this->rc != MQTT_RC_CODE::ERR_SUCCESS) {
                 break;
             }
@@ -1249,6 +1036,9 @@ asio::awaitable<void> MqttSession<SocketType>::handle_packet() {
                 break;
         }
 
+        // 处理报文时可能新增或确认了等待中的报文
+        flush_waiting_deadline();
+
         if (this->rc == MQTT_RC_CODE::ERR_SUCCESS_DISCONNECT) {
             break;
         }
@@ -1256,6 +1046,23 @@ asio::awaitable<void> MqttSession<SocketType>::handle_packet() {
         if (this->rc != MQTT_RC_CODE::ERR_SUCCESS) {
             break;
         }
+
+        if (this->read_delay > std::chrono::steady_clock::duration::zero()) {
+            co_await wait_read_delay();
+        }
+    }
+
+    // 断开连接之前写出还在队列中的报文, 例如拒绝连接的 CONNACK
+    // 发送协程正在写出时由它写完后清理会话
+    this->is_closing = true;
+    if (this->is_writing) {
+        co_return;
+    }
+
+    if (this->is_open()) {
+        this->is_writing = true;
+        co_await flush_send_queue();
+        this->is_writing = false;
     }
 
     handle_error_code();
@@ -1387,6 +1194,8 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::read_websocket() {
     uint32_t remaining_count = 0;
     uint32_t remaining_mult = 1;
 
+    notify_writer();
+
     while (true) {
         if (is_new_frame) {
             co_await async_read(this->socket, this->head_buf,
@@ -1438,10 +1247,12 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::read_websocket() {
                 case ws_frame_type::WS_CLOSE_FRAME: {
                     close_frame cf = ws.parse_close_payload(ws_payload.data(),
                                                             ws_payload.size());
-                    std::string close_msg = ws.format_close_payload(
+                    mqtt_frame_t close_msg;
+                    close_msg.head = ws.format_close_payload(
                         close_code::normal, cf.message, cf.length);
-                    co_await this->write_websocket(close_msg, opcode::close);
-                    this->disconnect();
+                    this->enqueue_frame(std::move(close_msg), opcode::close);
+
+                    // 关闭帧在断开连接之前写出
                     co_return MQTT_RC_CODE::ERR_SUCCESS_DISCONNECT;
                 }
                 default: {
@@ -1515,153 +1326,42 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::read_websocket() {
     co_return rc;
 }
 
-template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::write_websocket(
-    std::string_view msg, opcode op, bool eof) {
-    asio::error_code ec;
-    MQTT_RC_CODE rc = MQTT_RC_CODE::ERR_SUCCESS;
-
-    std::vector<asio::const_buffer> buffers;
-    std::string_view header;
-
-    header = ws.encode_ws_header(msg.length(), op, eof, false, false);
-    buffers.push_back(asio::buffer(header));
-    buffers.push_back(asio::buffer(msg));
-
-    co_await async_write(this->socket, buffers,
-                         asio::redirect_error(asio::use_awaitable, ec));
-    if (ec) {
-        co_return MQTT_RC_CODE::ERR_NO_CONN;
-    }
-
-    co_return rc;
-}
-
-template <typename SocketType>
-template <std::size_t N>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::write_websocket(
-    const std::array<asio::const_buffer, N>& msg, opcode op, bool eof) {
-    asio::error_code ec;
-    MQTT_RC_CODE rc = MQTT_RC_CODE::ERR_SUCCESS;
-
-    std::vector<asio::const_buffer> buffers;
-    std::string_view header;
-
-    std::size_t total_size = 0;
-    for (const auto& buf : msg) {
-        total_size += asio::buffer_size(buf);
-    }
-    header = ws.encode_ws_header(total_size, op, eof, false, false);
-    buffers.push_back(asio::buffer(header));
-
-    buffers.insert(buffers.end(), msg.begin(), msg.end());
-
-    co_await async_write(this->socket, buffers,
-                         asio::redirect_error(asio::use_awaitable, ec));
-
-    if (ec) {
-        co_return MQTT_RC_CODE::ERR_NO_CONN;
-    }
-
-    co_return rc;
-}
-
 template <typename SocketType>
 asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_connect() {
     MQTT_RC_CODE rc = MQTT_RC_CODE::ERR_SUCCESS;
-    uint16_t protocol_name_length;
-    std::string protocol_name;
-    uint8_t protocol_version;
-    uint8_t connect_flags;
-    bool clean_session, will;
+    mqtt_connect_packet_t connect_packet;
     mqtt_packet_t will_topic;
-    uint8_t password_flag, username_flag;
-    std::string password, username;
-    uint16_t keep_alive;
     std::string client_id;
     bool session_present;
 
-    SPDLOG_DEBUG("CONNECT: read protocol name length");
-    rc = co_await read_uint16(&protocol_name_length, true);
+    rc = MqttDecoder::decode_connect(this->packet_body, connect_packet);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
 
-    if (protocol_name_length != 4) {
-        SPDLOG_ERROR("protocol_name_length = [{}]", protocol_name_length);
-        co_return MQTT_RC_CODE::ERR_PROTOCOL;
-    }
-
-    SPDLOG_DEBUG("CONNECT: read protocol name");
-    rc = co_await read_bytes_to_buf(protocol_name, protocol_name_length, true);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
-
-    if (protocol_name != "MQTT") {
-        SPDLOG_ERROR("protocol_name = [{}]", protocol_name);
-        co_return MQTT_RC_CODE::ERR_PROTOCOL;
-    }
-
-    SPDLOG_DEBUG("CONNECT: read protocol version");
-    rc = co_await read_byte(&protocol_version, true);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
-
-    if (protocol_version != 0x04) {
-        rc =
-            co_await send_connack(0x00, MQTT_CONNACK::REFUSED_PROTOCOL_VERSION);
+    if (connect_packet.protocol_version != 0x04) {
+        rc = send_connack(0x00, MQTT_CONNACK::REFUSED_PROTOCOL_VERSION);
         if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
             co_return rc;
         }
 
         SPDLOG_ERROR("protocol_version = [{}]",
-                     static_cast<uint16_t>(protocol_version));
-
-        co_return MQTT_RC_CODE::ERR_PROTOCOL;
-    }
-
-    SPDLOG_DEBUG("CONNECT: read connect flags");
-    rc = co_await read_byte(&connect_flags, true);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
-
-    clean_session = (connect_flags & 0x02) >> 1;
-    will = connect_flags & 0x04;
-    will_topic.qos = (connect_flags & 0x18) >> 3;
-    will_topic.retain = ((connect_flags & 0x20) == 0x20);
-    password_flag = connect_flags & 0x40;
-    username_flag = connect_flags & 0x80;
-
-    if (will_topic.qos == 3) {
-        co_return MQTT_RC_CODE::ERR_PROTOCOL;
-    }
+                     static_cast<uint16_t>(connect_packet.protocol_version));
 
-    if (will == false && (will_topic.qos != 0 || will_topic.retain)) {
         co_return MQTT_RC_CODE::ERR_PROTOCOL;
     }
 
-    SPDLOG_DEBUG("CONNECT: read keep alive");
-    rc = co_await read_uint16(&keep_alive, true);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
+    bool clean_session = connect_packet.clean_session;
+    uint16_t keep_alive = connect_packet.keep_alive;
 
     // KeepAlive 时间
     SPDLOG_DEBUG("keep alive = [{}] seconds", keep_alive);
 
-    SPDLOG_DEBUG("CONNECT: read client identifier");
-    rc = co_await read_utf8_string(client_id, true);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
+    client_id = connect_packet.client_id;
 
     // MS_ 前缀用于自动生成的 client_id, 客户端生成的不能带有 MS_ 前缀
     if (client_id.starts_with("MS_")) {
-        rc = co_await send_connack(0x00,
-                                   MQTT_CONNACK::REFUSED_IDENTIFIER_REJECTED);
+        rc = send_connack(0x00, MQTT_CONNACK::REFUSED_IDENTIFIER_REJECTED);
         if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
             co_return rc;
         }
@@ -1671,8 +1371,8 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_connect() {
     if (client_id.empty()) {
         // 不能保留会话
         if (clean_session == false) {
-            rc = co_await send_connack(
-                0x00, MQTT_CONNACK::REFUSED_IDENTIFIER_REJECTED);
+            rc = send_connack(0x00,
+                              MQTT_CONNACK::REFUSED_IDENTIFIER_REJECTED);
             if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
                 co_return rc;
             }
@@ -1683,35 +1383,22 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_connect() {
         client_id = this->broker.gen_session_id();
     }
 
-    // 读取遗嘱消息
-    if (will) {
-        rc = co_await read_will_packet(will_topic, true);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
+    // 遗嘱消息
+    will_topic.qos = connect_packet.will_qos;
+    will_topic.retain = connect_packet.will_retain;
+    if (connect_packet.will) {
+        will_topic.message =
+            MqttMessage(connect_packet.will_topic, connect_packet.will_payload);
     }
 
-    // 读取用户名
-    if (username_flag) {
-        rc = co_await read_utf8_string(username, true);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    }
-
-    // 读取密码
-    if (password_flag) {
-        rc = co_await read_utf8_string(password, true);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    }
+    std::string username(connect_packet.username);
+    std::string password(connect_packet.password);
 
     // 进行密码校验
     if (MqttConfig::getInstance()->auth()) {
         if (MqttConfig::getInstance()->auth(username, password) == false) {
-            rc = co_await send_connack(
-                0x00, MQTT_CONNACK::REFUSED_BAD_USERNAME_PASSWORD);
+            rc = send_connack(0x00,
+                              MQTT_CONNACK::REFUSED_BAD_USERNAME_PASSWORD);
             if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
                 co_return rc;
             }
@@ -1748,8 +1435,7 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_connect() {
         SPDLOG_DEBUG("remote ip addr : [{}]", rule.object);
 
         if (!MqttConfig::getInstance()->acl_check(rule)) {
-            rc = co_await send_connack(0x00,
-                                       MQTT_CONNACK::REFUSED_NOT_AUTHORIZED);
+            rc = send_connack(0x00, MQTT_CONNACK::REFUSED_NOT_AUTHORIZED);
             if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
                 co_return rc;
             }
@@ -1760,8 +1446,7 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_connect() {
         rule.object = client_id;
 
         if (!MqttConfig::getInstance()->acl_check(rule)) {
-            rc = co_await send_connack(0x00,
-                                       MQTT_CONNACK::REFUSED_NOT_AUTHORIZED);
+            rc = send_connack(0x00, MQTT_CONNACK::REFUSED_NOT_AUTHORIZED);
             if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
                 co_return rc;
             }
@@ -1770,41 +1455,52 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_connect() {
     }
 
     this->client_id = client_id;
+    // 限制组只和客户端标识符有关, 连接时确定一次
+    this->client_limit.group =
+        MqttLimits::getInstance()->get_group(this->client_id);
+
+    if (!MqttLimits::getInstance()->add_connection(this->client_limit)) {
+        MqttExposer::getInstance()
+            ->inc_mqtt_max_connections_limit_count_metric(
+                this->client_limit.group->name);
+        rc = send_connack(0x00, MQTT_CONNACK::REFUSED_SERVER_UNAVAILABLE);
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            co_return rc;
+        }
+        co_return MQTT_RC_CODE::ERR_REFUSED_SERVER_UNAVAILABLE;
+    }
 
     this->session_state.clean_session = clean_session;
     this->session_state.keep_alive = keep_alive;
     this->session_state.will_topic = will_topic;
 
     // 加入 broker
-    session_present = this->broker.join_or_update(this->shared_from_this());
+    std::optional<MqttOfflineSession> offline_session;
+    auto old_session =
+        this->broker.join_or_update(this->shared_from_this(), offline_session);
+    session_present = (old_session != nullptr || offline_session.has_value());
+
+    // 会话状态恢复, 旧会话在线时从旧会话取出, 否则从离线记录恢复
+    if (old_session) {
+        co_await restore_session_state(old_session);
+    } else if (offline_session) {
+        restore_session_state(std::move(*offline_session));
+    }
 
     // CONNECT 完成标志设置
     this->complete_connect = true;
 
     // 发送 CONNACK 响应
-    rc = co_await send_connack(session_present, MQTT_CONNACK::ACCEPTED);
+    rc = send_connack(session_present, MQTT_CONNACK::ACCEPTED);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return MQTT_RC_CODE::ERR_NO_CONN;
     }
 
     // 添加自动订阅项
-    this->add_subscribe(MqttConfig::getInstance()->auto_subscribe_list());
-
-    // 开启协程用于处理需要当前会话转发的主题
-    asio::co_spawn(
-        this->socket.get_executor(),
-        [self = this->shared_from_this()] {
-            return self->handle_inflighting_packets();
-        },
-        asio::detached);
-
-    // 开启协程用于处理需要等待一段时间的操作
-    asio::co_spawn(
-        this->socket.get_executor(),
-        [self = this->shared_from_this()] {
-            return self->handle_waiting_map_packets();
-        },
-        asio::detached);
+    const auto& auto_subscribe_list =
+        MqttConfig::getInstance()->auto_subscribe_list();
+    this->add_subscribe(auto_subscribe_list);
+    this->get_retain(auto_subscribe_list);
 
     SPDLOG_DEBUG(
         "success to handle `CONNECT`, client_id = [{}], clean_session = [{}]",
@@ -1817,57 +1513,33 @@ template <typename SocketType>
 asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_publish() {
     MQTT_RC_CODE rc = MQTT_RC_CODE::ERR_SUCCESS;
     mqtt_packet_t pub_packet;
+    mqtt_publish_packet_t publish_packet;
     uint8_t retain = this->command & 0x01;    // 第 0 位 retain
     uint8_t qos =
         (this->command >> 1) & 0x03;    // 第 2 位 Qos-H, 第 1 位 Qos-S
     uint8_t dup = (this->command >> 3) & 1;    // 第 3 位 dup
-    std::string pub_topic;
-    uint16_t packet_id = 0;
-    uint32_t pub_payloadlen;
-    std::string pub_payload;
 
     if (qos == 3 || (qos == 1 && dup == 1)) {
         co_return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
     }
 
-    rc = co_await read_utf8_string(pub_topic, true);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
-
-    rc = check_pub_topic(pub_topic);
+    rc = MqttDecoder::decode_publish(this->packet_body, qos, publish_packet);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
 
-    if (pub_topic.empty()) {
-        co_return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
-    }
-
-    if (qos > 0) {
-        rc = co_await read_uint16(&packet_id, true);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-
-        if (packet_id == 0) {
-            co_return MQTT_RC_CODE::ERR_PROTOCOL;
-        }
-    }
+    uint16_t packet_id = publish_packet.packet_id;
 
     // 允许主题内容为空, 对于保留消息来说, 内容为空就删除保留消息
-    pub_payloadlen = this->remaining_length - this->pos;
-    if (pub_payloadlen > 0) {
-        if (pub_payloadlen > MqttConfig::getInstance()->max_packet_size()) {
-            co_return MQTT_RC_CODE::ERR_PAYLOAD_SIZE;
-        }
-
-        rc = co_await read_bytes_to_buf(pub_payload, pub_payloadlen, true);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
+    if (publish_packet.payload.length() >
+        MqttConfig::getInstance()->max_packet_size()) {
+        co_return MQTT_RC_CODE::ERR_PAYLOAD_SIZE;
     }
 
+    // 超出字节速率时仍然处理这条消息, 之后暂停读取, 不会因为暂停丢失消息
+    this->read_delay = MqttLimits::getInstance()->consume_pub_bytes(
+        this->client_limit, this->packet_body.size());
+
     // ACL 检查
     if (MqttConfig::getInstance()->acl_enable()) {
         mqtt_acl_rule_t rule;
@@ -1876,7 +1548,7 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_publish() {
         rule.action = MQTT_ACL_ACTION::PUB;
         rule.topics = std::make_unique<std::unordered_set<std::string>>();
 
-        rule.topics->emplace(pub_topic);
+        rule.topics->emplace(publish_packet.topic_name);
 
         // 检查不通过则不再对此消息处理
         if (!MqttConfig::getInstance()->acl_check(rule)) {
@@ -1884,63 +1556,72 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_publish() {
         }
     }
 
-    std::string limit_group;
+    // 日志模式下消息写入存储并同步到磁盘后才发送响应报文
+    bool journal = MqttConfig::getInstance()->store_journal();
     // 报文读取完毕, 对于 qos1 和 qos2 级别需要发送响应报文
     if (qos == 0) {
-        if (!MqttLimits::getInstance()->check_pub_limit(this->client_id,
-                                                        limit_group)) {
+        if (!MqttLimits::getInstance()->check_pub_limit(this->client_limit)) {
             MqttExposer::getInstance()->inc_mqtt_pub_topic_limit_count_metric(
-                std::move(limit_group), this->client_id, get_mqtt_quality(qos));
+                this->client_limit.group->name, this->client_id,
+                get_mqtt_quality(qos));
             co_return rc;
         }
 
         MqttExposer::getInstance()->inc_mqtt_pub_topic_count_metric(
             this->client_id, get_mqtt_quality(qos));
     } else if (qos == 1) {
-        if (!MqttLimits::getInstance()->check_pub_limit(this->client_id,
-                                                        limit_group)) {
+        if (!MqttLimits::getInstance()->check_pub_limit(this->client_limit)) {
             MqttExposer::getInstance()->inc_mqtt_pub_topic_limit_count_metric(
-                std::move(limit_group), this->client_id, get_mqtt_quality(qos));
-            rc = co_await send_publimit(packet_id);
+                this->client_limit.group->name, this->client_id,
+                get_mqtt_quality(qos));
+            rc = send_publimit(packet_id);
             co_return rc;
         }
 
-        rc = co_await send_puback(packet_id);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
+        if (!journal) {
+            rc = send_puback(packet_id);
+            if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+                co_return rc;
+            }
         }
 
         MqttExposer::getInstance()->inc_mqtt_pub_topic_count_metric(
             this->client_id, get_mqtt_quality(qos));
     } else if (qos == 2) {
-        if (!MqttLimits::getInstance()->check_pub_limit(this->client_id,
-                                                        limit_group)) {
+        if (!MqttLimits::getInstance()->check_pub_limit(this->client_limit)) {
             MqttExposer::getInstance()->inc_mqtt_pub_topic_limit_count_metric(
-                std::move(limit_group), this->client_id, get_mqtt_quality(qos));
-            rc = co_await send_publimit(packet_id);
+                this->client_limit.group->name, this->client_id,
+                get_mqtt_quality(qos));
+            rc = send_publimit(packet_id);
             co_return rc;
         }
 
-        rc = co_await send_pubrec(packet_id);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
+        if (!journal) {
+            rc = send_pubrec(packet_id);
+            if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+                co_return rc;
+            }
         }
 
         // 对于 qos2 级别, 如果客户端没有收到 PUBREC 报文, 可能会重传
         // 因此只要 packet_id 还没被服务端释放, 就不再接受重传的报文
         // 保证只有一个消息到达
         if (dup == 1 && this->session_state.waiting_map.contains(packet_id)) {
+            if (journal) {
+                commit_ack(MQTT_CMD::PUBREC, packet_id);
+            }
             co_return rc;
         }
 
         // 等待 PUBREL
-        mqtt_packet_t packet;
-        packet.state = MQTT_MSG_STATE::WAIT_RECEIVE_PUBREL;
-        packet.expiry_time =
+        mqtt_waiting_packet_t& waiting_packet =
+            this->session_state.waiting_map.insert(packet_id);
+        waiting_packet.state = MQTT_MSG_STATE::WAIT_RECEIVE_PUBREL;
+        this->session_state.waiting_map.schedule(
+            waiting_packet, mqtt_waiting_packet_t::timeout_t::WAITING,
             std::chrono::steady_clock::now() +
-            std::chrono::seconds(MqttConfig::getInstance()->max_waiting_time());
-
-        this->session_state.waiting_map[packet_id] = std::move(packet);
+                std::chrono::seconds(
+                    MqttConfig::getInstance()->max_waiting_time()));
 
         MqttExposer::getInstance()->inc_mqtt_pub_topic_count_metric(
             this->client_id, get_mqtt_quality(qos));
@@ -1950,16 +1631,14 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_publish() {
     pub_packet.dup = dup;
     pub_packet.qos = qos;
     pub_packet.retain = retain;
-    pub_packet.topic_name =
-        std::make_shared<const std::string>(std::move(pub_topic));
-    pub_packet.payload =
-        std::make_shared<const std::string>(std::move(pub_payload));
+    pub_packet.message =
+        MqttMessage(publish_packet.topic_name, publish_packet.payload);
 
     // 添加到保留消息
     if (retain) {
         // 内容为空则移除保留消息
-        if (pub_payloadlen == 0) {
-            this->broker.remove_retain(*(pub_packet.topic_name));
+        if (publish_packet.payload.empty()) {
+            this->broker.remove_retain(publish_packet.topic_name);
         } else {
             this->broker.add_retain(pub_packet);
         }
@@ -1969,39 +1648,150 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_publish() {
     pub_packet.dup = 0;
     pub_packet.retain = 0;
 
+    MQTT_OVERLOAD_POLICY policy = MqttConfig::getInstance()->overload_policy();
+
+    // 超过全局水位时 drop 策略直接丢弃新消息, 保留消息仍然会更新
+    if (policy == MQTT_OVERLOAD_POLICY::DROP &&
+        MqttBacklog::global().is_congested()) {
+        MqttExposer::getInstance()->inc_mqtt_overload_dropped_count_metric(1);
+        if (journal && qos > 0) {
+            commit_ack(qos == 1 ? MQTT_CMD::PUBACK : MQTT_CMD::PUBREC,
+                       packet_id);
+        }
+        co_return rc;
+    }
+
     // 消息分发
-    this->broker.dispatch(pub_packet);
+    std::vector<std::shared_ptr<MqttBacklog>> congested;
+    this->broker.dispatch(pub_packet, congested);
+
+    if (journal && qos > 0) {
+        commit_ack(qos == 1 ? MQTT_CMD::PUBACK : MQTT_CMD::PUBREC, packet_id);
+    }
+
+    if (policy == MQTT_OVERLOAD_POLICY::PAUSE) {
+        // 自己的积压由自己的发送协程写出, 不需要停止读取
+        std::erase(congested, this->backlog);
+
+        if (!congested.empty() || MqttBacklog::global().is_congested()) {
+            co_await wait_backlog(congested);
+        }
+    }
 
     co_return rc;
 }
 
+template <typename SocketType>
+asio::awaitable<void> MqttSession<SocketType>::wait_read_delay() {
+    asio::steady_timer timer(this->socket.get_executor());
+    asio::error_code ec;
+
+    auto deadline = std::chrono::steady_clock::now() + this->read_delay;
+    this->read_delay = std::chrono::steady_clock::duration::zero();
+
+    MqttExposer::getInstance()->inc_mqtt_pub_bytes_limit_count_metric(
+        this->client_limit.group->name);
+
+    // 暂停之前先写出已经产生的响应报文
+    notify_writer();
+
+    // 分段等待, 会话被接管或关闭时尽快退出
+    while (this->is_open() && std::chrono::steady_clock::now() < deadline) {
+        // 暂停是限速造成的, 不能算作客户端的保活超时
+        flush_deadline();
+
+        timer.expires_after(std::min<std::chrono::steady_clock::duration>(
+            deadline - std::chrono::steady_clock::now(),
+            MQTT_BACKLOG_MAX_PAUSE));
+        co_await timer.async_wait(
+            asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            break;
+        }
+    }
+
+    flush_deadline();
+}
+
+template <typename SocketType>
+void MqttSession<SocketType>::commit_ack(uint8_t cmd, uint16_t packet_id) {
+    // 回调在存储的同步线程中执行, 确认报文回到会话所在的线程中发送
+    // 同步按写入顺序完成, 同一个连接的确认顺序和消息到达的顺序一致
+    this->broker.commit([self = this->shared_from_this(), cmd, packet_id] {
+        asio::dispatch(self->socket.get_executor(), [self, cmd, packet_id] {
+            if (!self->is_open()) {
+                return;
+            }
+
+            if (self->enqueue_ack(cmd, packet_id) !=
+                MQTT_RC_CODE::ERR_SUCCESS) {
+                self->disconnect();
+                return;
+            }
+
+            self->notify_writer();
+        });
+    });
+}
+
+template <typename SocketType>
+asio::awaitable<void> MqttSession<SocketType>::wait_backlog(
+    std::vector<std::shared_ptr<MqttBacklog>>& congested) {
+    asio::steady_timer timer(this->socket.get_executor());
+    asio::error_code ec;
+
+    auto deadline = std::chrono::steady_clock::now() + MQTT_BACKLOG_MAX_PAUSE;
+
+    MqttExposer::getInstance()->inc_mqtt_paused_publishers_count_metric();
+
+    // 暂停之前先写出已经产生的响应报文, 客户端能收到这条消息的确认
+    notify_writer();
+
+    while (this->is_open() && std::chrono::steady_clock::now() < deadline) {
+        std::erase_if(congested, [](const std::shared_ptr<MqttBacklog>& b) {
+            return !b->is_congested();
+        });
+
+        if (congested.empty() && !MqttBacklog::global().is_congested()) {
+            break;
+        }
+
+        timer.expires_after(MQTT_BACKLOG_CHECK_INTERVAL);
+        co_await timer.async_wait(
+            asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            break;
+        }
+    }
+
+    // 暂停是服务端造成的, 不能算作客户端的保活超时
+    flush_deadline();
+}
+
 template <typename SocketType>
 asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_puback() {
     MQTT_RC_CODE rc;
     uint16_t packet_id;
 
-    rc = co_await read_uint16(&packet_id, true);
+    rc = MqttDecoder::decode_packet_id(this->packet_body, packet_id);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
 
-    if (packet_id == 0) {
-        co_return MQTT_RC_CODE::ERR_PROTOCOL;
-    }
-
     // 查找对应的主题
-    auto iter = this->session_state.waiting_map.find(packet_id);
-    if (iter == this->session_state.waiting_map.end()) {
+    mqtt_waiting_packet_t* waiting_packet =
+        this->session_state.waiting_map.find(packet_id);
+    if (waiting_packet == nullptr) {
         // 没找到说明可能已经被服务端删除了, 正常返回即可
         co_return rc;
     }
 
     SPDLOG_DEBUG(
         "PUBACK: receive puback, packet id = [X'{:04X}'], state = [{}]",
-        packet_id, static_cast<uint16_t>(iter->second.state));
+        packet_id, static_cast<uint16_t>(waiting_packet->state));
 
     // 完成 Qos1 交互, 释放 packet id
-    this->session_state.waiting_map.erase(iter);
+    erase_waiting_packet(*waiting_packet);
 
     co_return rc;
 }
@@ -2011,45 +1801,40 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_pubrec() {
     MQTT_RC_CODE rc;
     uint16_t packet_id;
 
-    rc = co_await read_uint16(&packet_id, true);
+    rc = MqttDecoder::decode_packet_id(this->packet_body, packet_id);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
 
-    if (packet_id == 0) {
-        co_return MQTT_RC_CODE::ERR_PROTOCOL;
-    }
-
     // 查找对应的主题
-    auto iter = this->session_state.waiting_map.find(packet_id);
-    if (iter == this->session_state.waiting_map.end()) {
+    mqtt_waiting_packet_t* waiting_packet =
+        this->session_state.waiting_map.find(packet_id);
+    if (waiting_packet == nullptr) {
         // 没找到说明可能已经被服务端删除了, 正常返回即可
         co_return rc;
     }
 
     SPDLOG_DEBUG(
         "PUBREC: receive pubrec, packet id = [X'{:04X}'], state = [{}]",
-        packet_id, static_cast<uint16_t>(iter->second.state));
+        packet_id, static_cast<uint16_t>(waiting_packet->state));
 
-    mqtt_packet_t& packet = iter->second;
-
-    // 收到了 PUBREC 后不能再重发 PUBLISH 了
+    // 收到了 PUBREC 后不能再重发 PUBLISH 了, 消息也不再需要保存
     // 更改状态, 避免切换协程后重发 PUBLISH
-    packet.state = MQTT_MSG_STATE::WAIT_RECEIVE_PUBREC;
-    packet.expiry_time = std::chrono::steady_clock::time_point::max();
+    waiting_packet->packet = mqtt_packet_t{};
+    waiting_packet->state = MQTT_MSG_STATE::WAIT_RECEIVE_PUBREC;
+    this->session_state.waiting_map.cancel(*waiting_packet);
 
     // 发送 PUBREL 响应
-    rc = co_await send_pubrel(packet_id);
+    rc = send_pubrel(packet_id);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
 
     // 设置重发
-    packet.state = MQTT_MSG_STATE::WAIT_RESEND_PUBREL;
-    packet.max_resend_count = MqttConfig::getInstance()->max_resend_count();
-    packet.expiry_time =
-        std::chrono::steady_clock::now() +
-        std::chrono::seconds(MqttConfig::getInstance()->resend_duration());
+    waiting_packet->state = MQTT_MSG_STATE::WAIT_RESEND_PUBREL;
+    waiting_packet->max_resend_count =
+        MqttConfig::getInstance()->max_resend_count();
+    schedule_resend(*waiting_packet);
 
     co_return rc;
 }
@@ -2059,42 +1844,36 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_pubrel() {
     MQTT_RC_CODE rc;
     uint16_t packet_id;
 
-    rc = co_await read_uint16(&packet_id, true);
+    rc = MqttDecoder::decode_packet_id(this->packet_body, packet_id);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
 
-    if (packet_id == 0) {
-        co_return MQTT_RC_CODE::ERR_PROTOCOL;
-    }
-
     // 查找对应的主题
-    auto iter = this->session_state.waiting_map.find(packet_id);
-    if (iter == this->session_state.waiting_map.end()) {
+    mqtt_waiting_packet_t* waiting_packet =
+        this->session_state.waiting_map.find(packet_id);
+    if (waiting_packet == nullptr) {
         // 没找到说明可能已经被服务端删除了, 正常返回即可
         co_return rc;
     }
 
     SPDLOG_DEBUG(
         "PUBREL: receive pubrel, packet id = [X'{:04X}'], state = [{}]",
-        packet_id, static_cast<uint16_t>(iter->second.state));
-
-    mqtt_packet_t& packet = iter->second;
+        packet_id, static_cast<uint16_t>(waiting_packet->state));
 
     // 发送 PUBCOMP 响应
-    rc = co_await send_pubcomp(packet_id);
+    rc = send_pubcomp(packet_id);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         // 发送失败设置重发
-        packet.state = MQTT_MSG_STATE::WAIT_RESEND_PUBCOMP;
-        packet.max_resend_count = MqttConfig::getInstance()->max_resend_count();
-        packet.expiry_time =
-            std::chrono::steady_clock::now() +
-            std::chrono::seconds(MqttConfig::getInstance()->resend_duration());
+        waiting_packet->state = MQTT_MSG_STATE::WAIT_RESEND_PUBCOMP;
+        waiting_packet->max_resend_count =
+            MqttConfig::getInstance()->max_resend_count();
+        schedule_resend(*waiting_packet);
         co_return rc;
     }
 
     // 发送成功则释放 packet id
-    this->session_state.waiting_map.erase(iter);
+    erase_waiting_packet(*waiting_packet);
 
     co_return rc;
 }
@@ -2104,28 +1883,25 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_pubcomp() {
     MQTT_RC_CODE rc;
     uint16_t packet_id;
 
-    rc = co_await read_uint16(&packet_id, true);
+    rc = MqttDecoder::decode_packet_id(this->packet_body, packet_id);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
 
-    if (packet_id == 0) {
-        co_return MQTT_RC_CODE::ERR_PROTOCOL;
-    }
-
     // 查找对应的主题
-    auto iter = this->session_state.waiting_map.find(packet_id);
-    if (iter == this->session_state.waiting_map.end()) {
+    mqtt_waiting_packet_t* waiting_packet =
+        this->session_state.waiting_map.find(packet_id);
+    if (waiting_packet == nullptr) {
         // 没找到说明可能已经被服务端删除了, 正常返回即可
         co_return rc;
     }
 
     SPDLOG_DEBUG(
         "PUBCOMP: receive pubcomp, packet id = [X'{:04X}'], state = [{}]",
-        packet_id, static_cast<uint16_t>(iter->second.state));
+        packet_id, static_cast<uint16_t>(waiting_packet->state));
 
     // 完成 Qos2 交互, 释放 packet id
-    this->session_state.waiting_map.erase(iter);
+    erase_waiting_packet(*waiting_packet);
 
     co_return rc;
 }
@@ -2133,48 +1909,23 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_pubcomp() {
 template <typename SocketType>
 asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_subscribe() {
     MQTT_RC_CODE rc;
-    uint16_t packet_id;
-    std::string tmp_topic;
-    uint8_t tmp_qos;
+    mqtt_subscribe_packet_t subscribe_packet;
     std::list<std::pair<std::string, uint8_t>> sub_topic_list;
     std::string suback_payload;
     uint32_t curr_subscriptions = this->session_state.sub_topic_map.size();
     uint32_t new_subscriptions = 0;
     uint32_t max_subscriptions = MqttConfig::getInstance()->max_subscriptions();
 
-    rc = co_await read_uint16(&packet_id, true);
+    rc = MqttDecoder::decode_subscribe(this->packet_body, subscribe_packet);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
 
-    if (packet_id == 0) {
-        co_return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
-    }
-
-    // 必须包含至少一对主题过滤器 和 QoS等级字段组合
-    if (this->pos == this->remaining_length) {
-        co_return MQTT_RC_CODE::ERR_MALFORMED_PACKET;
-    }
-
-    while (this->pos < this->remaining_length) {
-        rc = co_await read_utf8_string(tmp_topic, true);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-
-        rc = check_sub_topic(tmp_topic);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-
-        rc = co_await read_byte(&tmp_qos, true);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
+    uint16_t packet_id = subscribe_packet.packet_id;
 
-        if (tmp_qos > 2) {
-            co_return MQTT_RC_CODE::ERR_PROTOCOL;
-        }
+    for (const auto& [topic_filter, qos] : subscribe_packet.topic_filters) {
+        std::string tmp_topic(topic_filter);
+        uint8_t tmp_qos = qos;
 
         if (MqttConfig::getInstance()->acl_enable()) {
             mqtt_acl_rule_t rule;
@@ -2208,11 +1959,10 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_subscribe() {
             }
         }
 
-        std::string limit_group;
         if (tmp_qos != 0x80 && !MqttLimits::getInstance()->check_sub_limit(
-                                   this->client_id, limit_group)) {
+                                   this->client_limit)) {
             MqttExposer::getInstance()->inc_mqtt_pub_topic_limit_count_metric(
-                std::move(limit_group), this->client_id,
+                this->client_limit.group->name, this->client_id,
                 get_mqtt_quality(tmp_qos));
             tmp_qos = 0x80;
         }
@@ -2224,13 +1974,17 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_subscribe() {
         suback_payload.push_back(tmp_qos);
     }
 
-    rc = co_await send_suback(packet_id, suback_payload);
+    // 回复 SUBACK 之前先添加订阅项, 保证客户端收到 SUBACK 后
+    // 其它 I/O 线程上发布的消息都能匹配到新的订阅
+    this->add_subscribe(sub_topic_list);
+
+    rc = send_suback(packet_id, suback_payload);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
 
-    // 添加订阅项
-    this->add_subscribe(sub_topic_list);
+    // 获取保留消息, 只针对当前新增的主题
+    this->get_retain(sub_topic_list);
 
     co_return MQTT_RC_CODE::ERR_SUCCESS;
 }
@@ -2239,32 +1993,19 @@ template <typename SocketType>
 asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_unsubscribe() {
     MQTT_RC_CODE rc = MQTT_RC_CODE::ERR_SUCCESS_DISCONNECT;
 
-    uint16_t packet_id = 0;
-    std::string tmp_topic;
-    std::list<std::string> unsub_topic_list;
+    mqtt_unsubscribe_packet_t unsubscribe_packet;
 
-    rc = co_await read_uint16(&packet_id, true);
+    rc = MqttDecoder::decode_unsubscribe(this->packet_body, unsubscribe_packet);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
 
-    while (this->pos < this->remaining_length) {
-        rc = co_await read_utf8_string(tmp_topic, true);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-
-        unsub_topic_list.emplace_back(std::move(tmp_topic));
-    }
+    uint16_t packet_id = unsubscribe_packet.packet_id;
 
-    // 读取完后发送响应
-    rc = co_await send_unsuback(packet_id);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
+    // 回复 UNSUBACK 之前先删除对应主题订阅信息, 与 SUBACK 的处理保持一致
+    for (auto topic_filter : unsubscribe_packet.topic_filters) {
+        std::string name(topic_filter);
 
-    // 删除对应主题订阅信息
-    for (auto& name : unsub_topic_list) {
         auto it = this->session_state.sub_topic_map.find(name);
         if (it == this->session_state.sub_topic_map.end()) {
             continue;
@@ -2282,12 +2023,13 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_unsubscribe() {
                 this->client_id, get_mqtt_quality(qos));
         }
 
+        this->broker.unsubscribe(this->client_id, name);
+
         this->session_state.sub_topic_map.erase(it);
     }
 
-    if (this->session_state.sub_topic_map.empty()) {
-        MqttSession<SocketType>::active_sub_set.erase(this->client_id);
-    }
+    // 发送响应
+    rc = send_unsuback(packet_id);
 
     co_return rc;
 }
@@ -2296,7 +2038,7 @@ template <typename SocketType>
 asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_pingreq() {
     MQTT_RC_CODE rc;
 
-    rc = co_await send_pingresp();
+    rc = send_pingresp();
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
         co_return rc;
     }
@@ -2317,408 +2059,225 @@ asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::handle_disconnect() {
 }
 
 template <typename SocketType>
-asio::awaitable<void> MqttSession<SocketType>::handle_inflighting_packets() {
-    MQTT_RC_CODE rc;
-    mqtt_packet_t packet;
-    uint8_t old_qos;
-    std::list<mqtt_packet_t> send_packet_list;
-    asio::error_code ec;
-
-    while (this->is_open()) {
-        if (!this->session_state.inflight_queue.empty()) {
-            packet = this->session_state.inflight_queue.front();
-            this->session_state.inflight_queue.pop();
-
-            for (auto& [sub_topic, qos] : this->session_state.sub_topic_map) {
-                // 保留消息指定了具体的主题名称
-                if (packet.retain && packet.specified_topic_name.length() &&
-                    sub_topic != packet.specified_topic_name) {
-                    continue;
-                }
+void MqttSession<SocketType>::notify_writer() {
+    // 连接完成之前不投递消息, 保证 CONNACK 是第一个写出的报文
+    // 拒绝连接时的 CONNACK 由读协程在断开连接之前写出
+    if (this->is_writing || !this->complete_connect || !this->is_open()) {
+        return;
+    }
 
-                if (utils::check_topic_match(*(packet.topic_name), sub_topic)) {
-                    // Qos 等级取两者最小值
-                    old_qos = packet.qos;
+    this->is_writing = true;
 
-                    packet.qos = std::min(packet.qos, qos);
+    asio::co_spawn(
+        this->socket.get_executor(),
+        [self = this->shared_from_this()] { return self->handle_write(); },
+        asio::detached);
+}
 
-                    send_packet_list.emplace_back(packet);
+template <typename SocketType>
+asio::awaitable<void> MqttSession<SocketType>::handle_write() {
+    MQTT_RC_CODE rc = co_await flush_send_queue();
 
-                    packet.qos = old_qos;
-                }
-            }
+    this->is_writing = false;
 
-            // 批量发送满足订阅的消息
-            rc = co_await send_mqtt_packets(send_packet_list);
-            if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-                disconnect();
-            }
+    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+        disconnect();
+    }
 
-            send_packet_list.clear();
-        } else {
-            co_await this->cond_timer.async_wait(
-                asio::redirect_error(asio::use_awaitable, ec));
-        }
+    // 读协程已经退出, 由发送协程完成会话清理
+    if (this->is_closing) {
+        handle_error_code();
     }
 }
 
 template <typename SocketType>
-asio::awaitable<void> MqttSession<SocketType>::handle_waiting_map_packets() {
-    MQTT_RC_CODE rc;
-    auto check_duration = std::chrono::seconds(
-        MqttConfig::getInstance()->check_waiting_map_duration());
-
-    // 每到一次间隔时间检查一下 waiting
-    while (this->is_open()) {
-        this->check_timer.expires_after(check_duration);
-
-        co_await this->check_timer.async_wait(asio::use_awaitable);
-
-        // 在这个阶段可能会连续发送多个报文
-        // 如果协程切换到 handle_inflighting_packets 执行发送
-        // 可能会导致我们在遍历 map 的途中切换过去新插入了元素
-        // 因此使用 channel 进行写同步, 当 map 中的发送都处理完了才能切换
-        if (!this->write_lock.try_send()) {
-            co_await this->write_lock.async_send(asio::deferred);
-        }
-
-        auto deadline = std::chrono::steady_clock::now();
+void MqttSession<SocketType>::flush_waiting_deadline() {
+    const mqtt_waiting_packet_t* waiting_packet =
+        this->session_state.waiting_map.front();
 
-        for (auto iter = this->session_state.waiting_map.begin();
-             iter != this->session_state.waiting_map.end();) {
-            // 使用引用, 方便直接修改包中的内容
-            mqtt_packet_t& packet = iter->second;
-
-            if (packet.expiry_time > deadline) {
-                iter++;
-                continue;
-            }
-
-            if (packet.state == MQTT_MSG_STATE::WAIT_RECEIVE_PUBACK ||
-                packet.state == MQTT_MSG_STATE::WAIT_RECEIVE_PUBCOMP ||
-                packet.state == MQTT_MSG_STATE::WAIT_RECEIVE_PUBREC ||
-                packet.state == MQTT_MSG_STATE::WAIT_RECEIVE_PUBREL) {
-                // 删除超过最长等待时间的报文
-                iter = this->session_state.waiting_map.erase(iter);
-            } else if (packet.state ==
-                       MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS1) {
-                if (packet.max_resend_count == 0) {
-                    iter = this->session_state.waiting_map.erase(iter);
-                } else {
-                    rc = co_await send_publish_qos1(packet, false);
-                    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-                        break;
-                    }
-
-                    packet.max_resend_count--;
+    // 没有需要定时处理的报文时不占用时间轮
+    if (waiting_packet == nullptr || !this->is_open()) {
+        this->timing_wheel.cancel(this->waiting_entry);
+        return;
+    }
 
-                    packet.expiry_time =
-                        std::chrono::steady_clock::now() +
-                        std::chrono::seconds(
-                            MqttConfig::getInstance()->resend_duration());
-                    iter++;
-                }
+    this->timing_wheel.schedule(
+        this->waiting_entry,
+        waiting_packet->expiry_time - std::chrono::steady_clock::now());
+}
 
-            } else if (packet.state ==
-                       MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS2) {
-                if (packet.max_resend_count == 0) {
-                    iter = this->session_state.waiting_map.erase(iter);
-                } else {
-                    rc = co_await send_publish_qos2(packet, false);
-                    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-                        break;
-                    }
+template <typename SocketType>
+void MqttSession<SocketType>::schedule_resend(
+    mqtt_waiting_packet_t& waiting_packet) {
+    this->session_state.waiting_map.schedule(
+        waiting_packet, mqtt_waiting_packet_t::timeout_t::RESEND,
+        std::chrono::steady_clock::now() +
+            std::chrono::seconds(MqttConfig::getInstance()->resend_duration()));
+}
 
-                    packet.max_resend_count--;
+template <typename SocketType>
+void MqttSession<SocketType>::handle_waiting_timeout() {
+    MQTT_RC_CODE rc = MQTT_RC_CODE::ERR_SUCCESS;
+    auto& waiting_map = this->session_state.waiting_map;
+    auto now = std::chrono::steady_clock::now();
 
-                    packet.expiry_time =
-                        std::chrono::steady_clock::now() +
-                        std::chrono::seconds(
-                            MqttConfig::getInstance()->resend_duration());
-                    iter++;
-                }
-            } else if (packet.state == MQTT_MSG_STATE::WAIT_RESEND_PUBREL) {
-                if (packet.max_resend_count == 0) {
-                    iter = this->session_state.waiting_map.erase(iter);
-                } else {
-                    rc = co_await send_pubrel(packet.packet_id);
-                    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-                        break;
-                    }
+    // 按到期顺序只处理已经到期的报文, 重发的报文移到链表尾部
+    // 这里只将需要重发的报文放入发送队列, 由发送协程统一写出
+    for (;;) {
+        mqtt_waiting_packet_t* waiting_packet = waiting_map.front();
+        if (waiting_packet == nullptr || waiting_packet->expiry_time > now) {
+            break;
+        }
 
-                    packet.max_resend_count--;
+        if (waiting_packet->state == MQTT_MSG_STATE::WAIT_RECEIVE_PUBACK ||
+            waiting_packet->state == MQTT_MSG_STATE::WAIT_RECEIVE_PUBCOMP ||
+            waiting_packet->state == MQTT_MSG_STATE::WAIT_RECEIVE_PUBREC ||
+            waiting_packet->state == MQTT_MSG_STATE::WAIT_RECEIVE_PUBREL) {
+            // 删除超过最长等待时间的报文
+            erase_waiting_packet(*waiting_packet);
+            continue;
+        }
 
-                    packet.expiry_time =
-                        std::chrono::steady_clock::now() +
-                        std::chrono::seconds(
-                            MqttConfig::getInstance()->resend_duration());
-                    iter++;
-                }
-            } else if (packet.state == MQTT_MSG_STATE::WAIT_RESEND_PUBCOMP) {
-                if (packet.max_resend_count == 0) {
-                    iter = this->session_state.waiting_map.erase(iter);
-                } else {
-                    rc = co_await send_pubcomp(packet.packet_id);
-                    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-                        break;
-                    }
+        if (waiting_packet->max_resend_count == 0) {
+            erase_waiting_packet(*waiting_packet);
+            continue;
+        }
 
-                    packet.max_resend_count--;
+        if (waiting_packet->state ==
+            MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS1) {
+            rc = send_publish_qos1(waiting_packet->packet,
+                                   waiting_packet->packet_id);
+        } else if (waiting_packet->state ==
+                   MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS2) {
+            rc = send_publish_qos2(waiting_packet->packet,
+                                   waiting_packet->packet_id);
+        } else if (waiting_packet->state ==
+                   MQTT_MSG_STATE::WAIT_RESEND_PUBREL) {
+            rc = send_pubrel(waiting_packet->packet_id);
+        } else if (waiting_packet->state ==
+                   MQTT_MSG_STATE::WAIT_RESEND_PUBCOMP) {
+            rc = send_pubcomp(waiting_packet->packet_id);
+        } else {
+            waiting_map.cancel(*waiting_packet);
+            continue;
+        }
 
-                    packet.expiry_time =
-                        std::chrono::steady_clock::now() +
-                        std::chrono::seconds(
-                            MqttConfig::getInstance()->resend_duration());
-                    iter++;
-                }
-            } else {
-                iter++;
-            }
+        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+            disconnect();
+            return;
         }
 
-        // 释放写锁
-        this->write_lock.try_receive([](auto...) {});
+        waiting_packet->max_resend_count--;
+        schedule_resend(*waiting_packet);
     }
+
+    flush_waiting_deadline();
+
+    // 通知发送协程写出重发的报文
+    notify_writer();
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_mqtt_packets(
-    const std::list<mqtt_packet_t>& packet_list) {
+MQTT_RC_CODE MqttSession<SocketType>::send_mqtt_packets() {
     MQTT_RC_CODE rc = MQTT_RC_CODE::ERR_SUCCESS;
+    auto& inflight_queue = this->session_state.inflight_queue;
 
-    if (packet_list.empty()) {
-        co_return rc;
+    // 消息在 broker 分发时已经完成了主题匹配和 Qos 等级的计算
+    // 因此队列中的消息都是需要发送的, 直接从待投递队列中取出编码进发送队列
+    if (inflight_queue.empty()) {
+        return rc;
     }
 
-    // 写同步, 在将列表中的主题写完后才能调度到 handle_waiting_map_packets
-    if (!this->write_lock.try_send()) {
-        co_await this->write_lock.async_send(asio::deferred);
+    uint32_t max_inflight = MqttConfig::getInstance()->max_inflight_messages();
+    if (max_inflight == 0) {
+        max_inflight = std::numeric_limits<uint32_t>::max();
     }
 
-    for (auto& packet : packet_list) {
-        if (packet.qos == 0) {
-            co_await send_publish_qos0(packet);
-        } else if (packet.qos == 1) {
-            rc = co_await send_publish_qos1(packet, true);
-            if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+    while (!inflight_queue.empty()) {
+        const mqtt_packet_t& packet = inflight_queue.front();
+        uint16_t packet_id = 0;
+
+        // 等待确认的消息达到窗口上限时, 后面的消息留在队列中保持顺序
+        // 收到 PUBACK 或 PUBCOMP 释放窗口后由发送协程继续发送
+        if (packet.qos > 0) {
+            if (this->session_state.packet_ids.size() >= max_inflight) {
                 break;
             }
-        } else {
-            rc = co_await send_publish_qos2(packet, true);
-            if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
+
+            packet_id = gen_packet_id();
+            if (packet_id == 0) {
                 break;
             }
-        }
-    }
-
-    this->write_lock.try_receive([](auto...) {});
-
-    co_return rc;
-}
 
-template <typename SocketType>
-asio::awaitable<void> MqttSession<SocketType>::send_publish_qos0(
-    mqtt_packet_t packet) {
-    asio::error_code ec;
-    MQTT_RC_CODE rc;
-    std::string header;
-    uint8_t dup = packet.dup;
-    uint8_t qos = packet.qos;
-    uint8_t retain = packet.retain;
-    uint8_t command = static_cast<uint8_t>(
-        MQTT_CMD::PUBLISH | static_cast<uint8_t>((dup & 1) << 3) |
-        static_cast<uint8_t>(qos << 1) | retain);
-    const std::string& topic_name = *(packet.topic_name);
-    const std::string& payload = *(packet.payload);
-    uint16_t sub_topic_length = topic_name.length();
-    uint32_t pub_remaning_length =
-        sizeof(sub_topic_length) + sub_topic_length + payload.length();
-
-    SPDLOG_DEBUG("PUBLISH Qos0: command = [X'{:02X}']",
-                 static_cast<uint16_t>(command));
-
-    rc = add_mqtt_fixed_header(header, command, pub_remaning_length);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return;
-    }
+            add_waiting_publish(packet, packet_id);
+        }
 
-    sub_topic_length =
-        asio::detail::socket_ops::host_to_network_short(sub_topic_length);
+        if (packet.qos == 0) {
+            send_publish_qos0(packet);
+        } else if (packet.qos == 1) {
+            rc = send_publish_qos1(packet, packet_id);
+        } else {
+            rc = send_publish_qos2(packet, packet_id);
+        }
 
-    std::array<asio::const_buffer, 4> buf = {
-        {asio::buffer(header.data(), header.length()),
-         asio::buffer(&sub_topic_length, sizeof(uint16_t)),
-         asio::buffer(topic_name.data(), topic_name.length()),
-         asio::buffer(payload.data(), payload.length())}};
+        this->backlog->release(packet.message.remaining_length());
+        inflight_queue.pop();
 
-    if (this->is_websocket) {
-        rc = co_await this->write_websocket(buf);
         if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            SPDLOG_WARN("Failed to publish topic = [{}]",
-                        std::string(topic_name));
-            co_return;
-        }
-    } else {
-        co_await async_write(this->socket, buf,
-                             asio::redirect_error(asio::use_awaitable, ec));
-        if (ec) {
-            SPDLOG_WARN("Failed to publish topic = [{}]",
-                        std::string(topic_name));
-            co_return;
+            return rc;
         }
     }
 
-    co_return;
+    flush_waiting_deadline();
+
+    return rc;
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_publish_qos1(
-    mqtt_packet_t packet, bool is_new) {
-    asio::error_code ec;
+void MqttSession<SocketType>::send_publish_qos0(const mqtt_packet_t& packet) {
     MQTT_RC_CODE rc;
-    std::string header;
-    uint8_t dup = packet.dup;
-    uint8_t qos = packet.qos;
-    uint8_t retain = packet.retain;
-    uint8_t command = static_cast<uint8_t>(
-        MQTT_CMD::PUBLISH | static_cast<uint8_t>((dup & 1) << 3) |
-        static_cast<uint8_t>(qos << 1) | retain);
-    const std::string& topic_name = *(packet.topic_name);
-    const std::string& payload = *(packet.payload);
-    uint16_t sub_topic_length = topic_name.length();
-    uint32_t pub_remaning_length =
-        sizeof(sub_topic_length) + sub_topic_length + 2 + payload.length();
-    uint16_t packet_id;
-
-    // 如果是第一次发送, 取一个未使用的报文标识符
-    // 否则用之前生成的报文标识符重发
-    if (is_new) {
-        packet_id = gen_packet_id();
-        packet.packet_id = packet_id;
-
-        // 先将状态存放, 如果 PUBLISH 发送失败需要重发
-        packet.dup = 1;
-        packet.state =
-            MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS1;    // 状态为等待重发
-        packet.max_resend_count = MqttConfig::getInstance()->max_resend_count();
-        packet.expiry_time =
-            std::chrono::steady_clock::now() +
-            std::chrono::seconds(MqttConfig::getInstance()->resend_duration());
-        this->session_state.waiting_map[packet_id] = packet;
-    } else {
-        packet_id = packet.packet_id;
-    }
 
-    SPDLOG_DEBUG("PUBLISH Qos1: command = [X'{:02X}'], packet id = [X'{:04X}']",
-                 static_cast<uint16_t>(command), packet_id);
+    SPDLOG_DEBUG("PUBLISH Qos0: topic = [{}]", packet.message.topic_name());
 
-    rc = add_mqtt_fixed_header(header, command, pub_remaning_length);
+    rc = enqueue_publish(packet, 0);
     if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
-
-    sub_topic_length =
-        asio::detail::socket_ops::host_to_network_short(sub_topic_length);
-    packet_id = asio::detail::socket_ops::host_to_network_short(packet_id);
-
-    std::array<asio::const_buffer, 5> buf = {
-        {asio::buffer(header.data(), header.length()),
-         asio::buffer(&sub_topic_length, sizeof(uint16_t)),
-         asio::buffer(topic_name.data(), topic_name.length()),
-         asio::buffer(&packet_id, sizeof(uint16_t)),
-         asio::buffer(payload.data(), payload.length())}};
-
-    if (this->is_websocket) {
-        rc = co_await this->write_websocket(buf);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    } else {
-        co_await async_write(this->socket, buf,
-                             asio::redirect_error(asio::use_awaitable, ec));
-        if (ec) {
-            SPDLOG_WARN("Failed to publish topic = [{}]",
-                        std::string(topic_name));
-            co_return MQTT_RC_CODE::ERR_NO_CONN;
-        }
+        SPDLOG_WARN("Failed to publish topic = [{}]", packet.message.topic_name());
     }
-
-    co_return rc;
 }
 
 template <typename SocketType>
-asio::awaitable<MQTT_RC_CODE> MqttSession<SocketType>::send_publish_qos2(
-    mqtt_packet_t packet, bool is_new) {
-    asio::error_code ec;
-    MQTT_RC_CODE rc;
-    std::string header;
-    uint8_t dup = packet.dup;
-    uint8_t qos = packet.qos;
-    uint8_t retain = packet.retain;
-    uint8_t command = static_cast<uint8_t>(
-        MQTT_CMD::PUBLISH | static_cast<uint8_t>((dup & 1) << 3) |
-        static_cast<uint8_t>(qos << 1) | retain);
-    const std::string& topic_name = *(packet.topic_name);
-    const std::string& payload = *(packet.payload);
-    uint16_t sub_topic_length = topic_name.length();
-    uint32_t pub_remaning_length =
-        sizeof(sub_topic_length) + sub_topic_length + 2 + payload.length();
-    uint16_t packet_id;
-
-    // 如果是第一次发送, 取一个未使用的报文标识符
-    // 否则用之前生成的报文标识符重发
-    if (is_new) {
-        packet_id = gen_packet_id();
-        packet.packet_id = packet_id;
-
-        // 先将状态存放, 如果 PUBLISH 发送失败需要重发
-        packet.dup = 1;
-        packet.state =
-            MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS2;    // 状态为等待重发
-        packet.max_resend_count = MqttConfig::getInstance()->max_resend_count();
-        packet.expiry_time =
-            std::chrono::steady_clock::now() +
-            std::chrono::seconds(MqttConfig::getInstance()->resend_duration());
-        this->session_state.waiting_map[packet_id] = packet;
-    } else {
-        packet_id = packet.packet_id;
-    }
-
-    SPDLOG_DEBUG("PUBLISH Qos2: command = [X'{:02X}'], packet id = [X'{:04X}']",
-                 static_cast<uint16_t>(command), packet_id);
-
-    rc = add_mqtt_fixed_header(header, command, pub_remaning_length);
-    if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-        co_return rc;
-    }
+void MqttSession<SocketType>::add_waiting_publish(const mqtt_packet_t& packet,
+                                                  uint16_t packet_id) {
+    // 先将状态存放, 如果 PUBLISH 发送失败需要带上 dup 标志重发
+    mqtt_waiting_packet_t& waiting_packet =
+        this->session_state.waiting_map.insert(packet_id);
+    waiting_packet.packet = packet;
+    waiting_packet.packet.dup = 1;
+    waiting_packet.state =
+        packet.qos == 1
+            ? MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS1
+            : MQTT_MSG_STATE::WAIT_RESEND_PUBLISH_QOS2;    // 状态为等待重发
+    waiting_packet.max_resend_count =
+        MqttConfig::getInstance()->max_resend_count();
+    schedule_resend(waiting_packet);
+}
 
-    sub_topic_length =
-        asio::detail::socket_ops::host_to_network_short(sub_topic_length);
-    packet_id = asio::detail::socket_ops::host_to_network_short(packet_id);
+template <typename SocketType>
+MQTT_RC_CODE MqttSession<SocketType>::send_publish_qos1(
+    const mqtt_packet_t& packet, uint16_t packet_id) {
+    SPDLOG_DEBUG("PUBLISH Qos1: topic = [{}], packet id = [X'{:04X}']",
+                 packet.message.topic_name(), packet_id);
 
-    std::array<asio::const_buffer, 5> buf = {
-        {asio::buffer(header.data(), header.length()),
-         asio::buffer(&sub_topic_length, sizeof(uint16_t)),
-         asio::buffer(topic_name.data(), topic_name.length()),
-         asio::buffer(&packet_id, sizeof(uint16_t)),
-         asio::buffer(payload.data(), payload.length())}};
+    return enqueue_publish(packet, packet_id);
+}
 
-    if (this->is_websocket) {
-        rc = co_await this->write_websocket(buf);
-        if (rc != MQTT_RC_CODE::ERR_SUCCESS) {
-            co_return rc;
-        }
-    } else {
-        co_await async_write(this->socket, buf,
-                             asio::redirect_error(asio::use_awaitable, ec));
-        if (ec) {
-            SPDLOG_WARN("Failed to publish topic = [{}]",
-                        std::string(topic_name));
-            co_return MQTT_RC_CODE::ERR_NO_CONN;
-        }
-    }
+template <typename SocketType>
+MQTT_RC_CODE MqttSession<SocketType>::send_publish_qos2(
+    const mqtt_packet_t& packet, uint16_t packet_id) {
+    SPDLOG_DEBUG("PUBLISH Qos2: topic = [{}], packet id = [X'{:04X}']",
+                 packet.message.topic_name(), packet_id);
 
-    co_return rc;
+    return enqueue_publish(packet, packet_id);
 }
 
 template <typename SocketType>
@@ -2728,18 +2287,12 @@ void MqttSession<SocketType>::add_subscribe(
         return;
     }
 
-    // 更新存在订阅的会话
-    MqttSession::active_sub_set.emplace(this->client_id);
-
     for (const auto& [name, qos] : sub_topic_list) {
         SPDLOG_DEBUG("subscribe topic name = [{}], qos = [X'{:02X}']", name,
                      static_cast<uint16_t>(qos));
 
         this->session_state.sub_topic_map[name] = qos;
 
-        // 获取保留消息, 只针对当前新增的主题
-        this->broker.get_retain(this->shared_from_this(), name);
-
         if (qos == 0) {
             MqttExposer::getInstance()->inc_mqtt_sub_topic_count_metric(
                 this->client_id, get_mqtt_quality(qos));
@@ -2751,6 +2304,17 @@ void MqttSession<SocketType>::add_subscribe(
                 this->client_id, get_mqtt_quality(qos));
         }
     }
+
+    // 更新 broker 中的订阅树
+    this->broker.subscribe(this->client_id, sub_topic_list);
+}
+
+template <typename SocketType>
+void MqttSession<SocketType>::get_retain(
+    const std::list<std::pair<std::string, uint8_t>>& sub_topic_list) {
+    for (const auto& [name, qos] : sub_topic_list) {
+        this->broker.get_retain(this->shared_from_this(), name, qos);
+    }
 }
 
 template <typename SocketType>
@@ -2765,4 +2329,15 @@ bool MqttSession<SocketType>::is_open() {
 #else
     return this->socket.is_open();
 #endif
+}
+
+template <typename SocketType>
+MQTT_PROTOCOL MqttSession<SocketType>::get_mqtt_protocol() {
+#ifdef MQ_WITH_TLS
+    if constexpr (std::is_same_v<SocketType,
+                                 asio::ssl::stream<asio::ip::tcp::socket>>) {
+        return this->is_websocket ? MQTT_PROTOCOL::WSS : MQTT_PROTOCOL::MQTTS;
+    }
+#endif
+    return this->is_websocket ? MQTT_PROTOCOL::WS : MQTT_PROTOCOL::MQTT;
 }
\ No newline at end of file
@@ -1,19 +1,34 @@
 #pragma once
 
 #include "MqttCommon.h"
+#include "MqttPacketIdAllocator.h"
+#include "MqttPacketQueue.h"
 #include "MqttTokenBucket.h"
+#include "MqttWaitingMap.h"
 
 struct MqttSessionState {
     bool clean_session;
     uint16_t keep_alive;
-    uint16_t packet_id_gen;
     mqtt_packet_t will_topic;
     std::unordered_map<std::string, uint8_t> sub_topic_map;
-    std::unordered_map<uint16_t, mqtt_packet_t> waiting_map;
-    std::queue<mqtt_packet_t> inflight_queue;
+    MqttWaitingMap waiting_map;
+    MqttPacketIdAllocator packet_ids;
+    MqttPacketQueue inflight_queue;
 
     MqttSessionState() :
         clean_session(true),
-        keep_alive(0U),
-        packet_id_gen(0U) {}
+        keep_alive(0U) {}
+};
+
+// 持久会话断开连接后由 broker 保存的离线记录, 只保留重连时需要恢复的状态
+// 不持有连接、缓冲区和定时器, 大量设备离线时每个会话只占用很少的内存
+struct MqttOfflineSession {
+    std::chrono::steady_clock::time_point expiry_time;
+    std::unordered_map<std::string, uint8_t> sub_topic_map;
+    MqttWaitingMap waiting_map;
+    MqttPacketIdAllocator packet_ids;
+    MqttPacketQueue inflight_queue;
+
+    MqttOfflineSession() :
+        expiry_time(std::chrono::steady_clock::time_point::max()) {}
 };
\ No newline at end of file
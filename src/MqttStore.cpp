@@ -0,0 +1,715 @@
+#include "MqttStore.h"
+
+#include <filesystem>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "ylt/struct_pack.hpp"
+
+// 每条记录前是 4 字节的长度和 4 字节的 CRC32 校验, 按本机字节序存放
+constexpr std::size_t MQTT_STORE_FRAME_HEADER_SIZE = 8;
+
+static const std::array<uint32_t, 256> s_crc32_table = [] {
+    std::array<uint32_t, 256> table{};
+
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+    }
+
+    return table;
+}();
+
+static uint32_t s_crc32(const char* data, std::size_t size) {
+    uint32_t crc = 0xFFFFFFFFU;
+
+    for (std::size_t i = 0; i < size; i++) {
+        crc = s_crc32_table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^
+              (crc >> 8);
+    }
+
+    return crc ^ 0xFFFFFFFFU;
+}
+
+static void s_sync_file(std::FILE* file) {
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    ::fsync(fileno(file));
+#endif
+}
+
+static int64_t s_system_seconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+static mqtt_store_message_t s_to_store_message(const mqtt_packet_t& packet) {
+    return mqtt_store_message_t{
+        .topic = std::string(packet.message.topic_name()),
+        .payload = std::string(packet.message.payload()),
+        .qos = static_cast<uint8_t>(packet.qos),
+    };
+}
+
+// 文件名为 <name>.<seq>, 返回序号, 不是该类型的文件时返回 0
+static uint64_t s_parse_seq(const std::string& filename, std::string_view name) {
+    if (filename.size() <= name.size() + 1 ||
+        filename.compare(0, name.size(), name) != 0 ||
+        filename[name.size()] != '.') {
+        return 0;
+    }
+
+    uint64_t seq = 0;
+    for (std::size_t i = name.size() + 1; i < filename.size(); i++) {
+        if (filename[i] < '0' || filename[i] > '9') {
+            return 0;
+        }
+        seq = seq * 10 + (filename[i] - '0');
+    }
+
+    return seq;
+}
+
+static bool s_write_record(std::FILE* file, std::string& buffer,
+                           const mqtt_store_record_t& record) {
+    buffer.resize(MQTT_STORE_FRAME_HEADER_SIZE);
+    struct_pack::serialize_to(buffer, record);
+
+    uint32_t length =
+        static_cast<uint32_t>(buffer.size() - MQTT_STORE_FRAME_HEADER_SIZE);
+    uint32_t crc =
+        s_crc32(buffer.data() + MQTT_STORE_FRAME_HEADER_SIZE, length);
+
+    std::memcpy(buffer.data(), &length, sizeof(length));
+    std::memcpy(buffer.data() + sizeof(length), &crc, sizeof(crc));
+
+    return std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+}
+
+MqttStore::MqttStore(std::string dir, std::size_t max_log_size,
+                     uint32_t sync_interval, std::size_t sync_bytes,
+                     std::size_t max_queued_messages)
+    : dir_(std::move(dir)),
+      max_log_size_(max_log_size),
+      sync_interval_(sync_interval),
+      max_queued_messages_(max_queued_messages),
+      stopping_(false),
+      sync_bytes_(sync_bytes),
+      file_(nullptr),
+      log_seq_(0),
+      log_size_(0),
+      dirty_(false),
+      written_lsn_(0),
+      synced_lsn_(0),
+      snapshot_seq_(0),
+      compact_seq_(0),
+      compacted_seq_(0) {}
+
+MqttStore::~MqttStore() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+
+    if (sync_thread_.joinable()) {
+        sync_thread_.join();
+    }
+
+    if (compact_thread_.joinable()) {
+        compact_thread_.join();
+    }
+
+    for (std::FILE* file : closed_files_) {
+        s_sync_file(file);
+        std::fclose(file);
+    }
+
+    if (file_ != nullptr) {
+        s_sync_file(file_);
+        std::fclose(file_);
+    }
+}
+
+std::string MqttStore::path_of(std::string_view name, uint64_t seq) const {
+    return dir_ + "/" + std::string(name) + "." + std::to_string(seq);
+}
+
+mqtt_store_image_t MqttStore::open() {
+    namespace fs = std::filesystem;
+
+    fs::create_directories(dir_);
+
+    uint64_t snapshot_seq = 0;
+    std::vector<uint64_t> snapshot_seqs;
+    std::vector<uint64_t> log_seqs;
+    std::vector<uint64_t> retained_seqs;
+
+    for (const auto& entry : fs::directory_iterator(dir_)) {
+        std::string filename = entry.path().filename().string();
+
+        if (uint64_t seq = s_parse_seq(filename, "snapshot"); seq > 0) {
+            snapshot_seq = std::max(snapshot_seq, seq);
+            snapshot_seqs.push_back(seq);
+        } else if (uint64_t seq = s_parse_seq(filename, "wal"); seq > 0) {
+            log_seqs.push_back(seq);
+        } else if (uint64_t seq = s_parse_seq(filename, "retained"); seq > 0) {
+            retained_seqs.push_back(seq);
+        } else if (filename.ends_with(".tmp")) {
+            // 写了一半的快照或保留消息段
+            fs::remove(entry.path());
+        }
+    }
+
+    std::sort(log_seqs.begin(), log_seqs.end());
+
+    // 合并完成后还没来得及删除的旧文件
+    for (uint64_t seq : snapshot_seqs) {
+        if (seq < snapshot_seq) {
+            fs::remove(path_of("snapshot", seq));
+        }
+    }
+
+    for (uint64_t seq : log_seqs) {
+        if (seq <= snapshot_seq) {
+            fs::remove(path_of("wal", seq));
+        }
+    }
+
+    // 保留消息段先于快照改名, 序号和快照不同的段属于旧快照或者没有完成的合并
+    for (uint64_t seq : retained_seqs) {
+        if (seq != snapshot_seq) {
+            fs::remove(path_of("retained", seq));
+        }
+    }
+
+    mqtt_store_image_t image;
+
+    if (snapshot_seq > 0 && fs::exists(path_of("retained", snapshot_seq))) {
+        image.retained_segment =
+            MqttRetainSegment::open(path_of("retained", snapshot_seq));
+    }
+
+    // 快照写完后才改名, 不完整说明文件已经损坏, 不能继续启动
+    if (snapshot_seq > 0 &&
+        !replay(path_of("snapshot", snapshot_seq), image)) {
+        throw std::runtime_error("Store snapshot is corrupted: " +
+                                 path_of("snapshot", snapshot_seq));
+    }
+
+    uint64_t last_seq = snapshot_seq;
+    for (uint64_t seq : log_seqs) {
+        if (seq <= snapshot_seq) {
+            continue;
+        }
+
+        // 崩溃时最后一条记录可能只写了一半, 之后的内容全部丢弃
+        if (!replay(path_of("wal", seq), image)) {
+            SPDLOG_WARN("Store log is truncated: {}", path_of("wal", seq));
+        }
+
+        last_seq = seq;
+    }
+
+    SPDLOG_INFO("Store recovered: sessions = [{}], retained segment = [{}], "
+                "retained changes = [{}], snapshot = [{}], logs = [{}]",
+                image.sessions.size(),
+                image.retained_segment ? image.retained_segment->size() : 0,
+                image.retained.size() + image.erased_retained.size(),
+                snapshot_seq, last_seq - snapshot_seq);
+
+    this->snapshot_seq_ = snapshot_seq;
+    this->compact_seq_ = last_seq;
+    this->compacted_seq_ = snapshot_seq;
+    this->log_seq_ = last_seq;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rotate();
+    }
+
+    if (this->file_ == nullptr) {
+        throw std::runtime_error("Failed to open store log: " +
+                                 path_of("wal", this->log_seq_));
+    }
+
+    this->sync_thread_ = std::thread([this] { handle_sync(); });
+    this->compact_thread_ = std::thread([this] { handle_compact(); });
+
+    return image;
+}
+
+void MqttStore::open_session(const std::string& client_id) {
+    mqtt_store_record_t record;
+    record.op = MQTT_STORE_OP::OPEN_SESSION;
+    record.client_id = client_id;
+
+    append(record);
+}
+
+void MqttStore::put_session(const std::string& client_id,
+                            const MqttOfflineSession& session) {
+    mqtt_store_record_t record;
+    record.op = MQTT_STORE_OP::PUT_SESSION;
+    record.client_id = client_id;
+    record.session.offline_time = s_system_seconds();
+    record.session.subscriptions.insert(session.sub_topic_map.begin(),
+                                        session.sub_topic_map.end());
+
+    session.waiting_map.for_each([&record](const mqtt_waiting_packet_t& p) {
+        record.session.waiting.push_back(mqtt_store_waiting_t{
+            .packet_id = p.packet_id,
+            .state = p.state,
+            .message = s_to_store_message(p.packet),
+        });
+    });
+
+    session.inflight_queue.for_each([&record](const mqtt_packet_t& packet) {
+        record.session.queue.push_back(s_to_store_message(packet));
+    });
+
+    append(record);
+}
+
+void MqttStore::erase_session(const std::string& client_id) {
+    mqtt_store_record_t record;
+    record.op = MQTT_STORE_OP::ERASE_SESSION;
+    record.client_id = client_id;
+
+    append(record);
+}
+
+void MqttStore::subscribe(const std::string& client_id,
+                          const std::string& topic_filter, uint8_t qos) {
+    mqtt_store_record_t record;
+    record.op = MQTT_STORE_OP::SUBSCRIBE;
+    record.client_id = client_id;
+    record.message.topic = topic_filter;
+    record.message.qos = qos;
+
+    append(record);
+}
+
+void MqttStore::unsubscribe(const std::string& client_id,
+                            const std::string& topic_filter) {
+    mqtt_store_record_t record;
+    record.op = MQTT_STORE_OP::UNSUBSCRIBE;
+    record.client_id = client_id;
+    record.message.topic = topic_filter;
+
+    append(record);
+}
+
+void MqttStore::enqueue(const std::string& client_id,
+                        const mqtt_packet_t& packet) {
+    mqtt_store_record_t record;
+    record.op = MQTT_STORE_OP::ENQUEUE;
+    record.client_id = client_id;
+    record.message = s_to_store_message(packet);
+
+    append(record);
+}
+
+void MqttStore::put_retain(const mqtt_packet_t& packet) {
+    mqtt_store_record_t record;
+    record.op = MQTT_STORE_OP::PUT_RETAIN;
+    record.message = s_to_store_message(packet);
+
+    append(record);
+}
+
+void MqttStore::erase_retain(std::string_view topic_name) {
+    mqtt_store_record_t record;
+    record.op = MQTT_STORE_OP::ERASE_RETAIN;
+    record.message.topic = topic_name;
+
+    append(record);
+}
+
+void MqttStore::commit(std::function<void()> callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (this->sync_interval_ > 0 &&
+            this->synced_lsn_ < this->written_lsn_) {
+            this->commit_waiters_.emplace_back(this->written_lsn_,
+                                               std::move(callback));
+            return;
+        }
+    }
+
+    callback();
+}
+
+void MqttStore::snapshot() {
+    uint64_t seq;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        seq = this->log_seq_;
+        rotate();
+    }
+    cond_.notify_all();
+
+    // 合并由后台线程完成, 这里只等待结果
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this, seq] {
+        return this->compacted_seq_ >= seq || this->stopping_;
+    });
+}
+
+void MqttStore::append(const mqtt_store_record_t& record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (this->file_ == nullptr) {
+        return;
+    }
+
+    // 每条记录都交给操作系统, 进程崩溃时不会停留在用户态的缓冲区中
+    if (!s_write_record(this->file_, this->buffer_, record) ||
+        std::fflush(this->file_) != 0) {
+        SPDLOG_ERROR("Failed to write store log: {}",
+                     path_of("wal", this->log_seq_));
+        return;
+    }
+
+    this->log_size_ += this->buffer_.size();
+    this->written_lsn_ += this->buffer_.size();
+    this->dirty_ = true;
+
+    if (this->log_size_ >= this->max_log_size_) {
+        rotate();
+        cond_.notify_all();
+    } else if (this->sync_interval_ > 0 && this->sync_bytes_ > 0 &&
+               this->written_lsn_ - this->synced_lsn_ >= this->sync_bytes_) {
+        cond_.notify_all();
+    }
+}
+
+void MqttStore::rotate() {
+    if (this->file_ != nullptr) {
+        this->closed_files_.push_back(this->file_);
+        this->compact_seq_ = this->log_seq_;
+    }
+
+    this->log_seq_++;
+    this->log_size_ = 0;
+    this->file_ = std::fopen(path_of("wal", this->log_seq_).c_str(), "ab");
+
+    if (this->file_ == nullptr) {
+        SPDLOG_ERROR("Failed to open store log: {}",
+                     path_of("wal", this->log_seq_));
+    }
+}
+
+void MqttStore::apply(mqtt_store_record_t& record, mqtt_store_image_t& image) {
+    switch (record.op) {
+        case MQTT_STORE_OP::OPEN_SESSION: {
+            auto& session = image.sessions[record.client_id];
+            session.offline_time = 0;
+            session.waiting.clear();
+            session.queue.clear();
+            break;
+        }
+        case MQTT_STORE_OP::PUT_SESSION: {
+            image.sessions[record.client_id] = std::move(record.session);
+            break;
+        }
+        case MQTT_STORE_OP::ERASE_SESSION: {
+            image.sessions.erase(record.client_id);
+            break;
+        }
+        case MQTT_STORE_OP::SUBSCRIBE: {
+            auto iter = image.sessions.find(record.client_id);
+            if (iter != image.sessions.end()) {
+                iter->second.subscriptions[record.message.topic] =
+                    record.message.qos;
+            }
+            break;
+        }
+        case MQTT_STORE_OP::UNSUBSCRIBE: {
+            auto iter = image.sessions.find(record.client_id);
+            if (iter != image.sessions.end()) {
+                iter->second.subscriptions.erase(record.message.topic);
+            }
+            break;
+        }
+        case MQTT_STORE_OP::ENQUEUE: {
+            auto iter = image.sessions.find(record.client_id);
+            if (iter == image.sessions.end()) {
+                break;
+            }
+
+            // 字节数和丢弃策略的限制在恢复到会话的队列时再处理
+            auto& queue = iter->second.queue;
+            queue.push_back(std::move(record.message));
+            if (queue.size() > this->max_queued_messages_) {
+                queue.pop_front();
+            }
+            break;
+        }
+        case MQTT_STORE_OP::PUT_RETAIN: {
+            std::string topic = record.message.topic;
+            image.retained[std::move(topic)] = std::move(record.message);
+            break;
+        }
+        case MQTT_STORE_OP::ERASE_RETAIN: {
+            image.retained.erase(record.message.topic);
+            image.erased_retained.insert(std::move(record.message.topic));
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+}
+
+bool MqttStore::replay(const std::string& path, mqtt_store_image_t& image) {
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> file(
+        std::fopen(path.c_str(), "rb"), &std::fclose);
+    if (!file) {
+        return false;
+    }
+
+    std::string payload;
+    char header[MQTT_STORE_FRAME_HEADER_SIZE];
+
+    for (;;) {
+        std::size_t n = std::fread(header, 1, sizeof(header), file.get());
+        if (n == 0) {
+            return true;
+        }
+
+        if (n != sizeof(header)) {
+            return false;
+        }
+
+        uint32_t length, crc;
+        std::memcpy(&length, header, sizeof(length));
+        std::memcpy(&crc, header + sizeof(length), sizeof(crc));
+
+        payload.resize(length);
+        if (std::fread(payload.data(), 1, length, file.get()) != length ||
+            s_crc32(payload.data(), length) != crc) {
+            return false;
+        }
+
+        mqtt_store_record_t record;
+        if (struct_pack::deserialize_to(record, payload.data(), length)) {
+            return false;
+        }
+
+        apply(record, image);
+    }
+}
+
+bool MqttStore::compact(uint64_t seq) {
+    namespace fs = std::filesystem;
+
+    mqtt_store_image_t image;
+
+    if (this->snapshot_seq_ > 0 &&
+        !replay(path_of("snapshot", this->snapshot_seq_), image)) {
+        SPDLOG_ERROR("Store snapshot is corrupted: {}",
+                     path_of("snapshot", this->snapshot_seq_));
+        return false;
+    }
+
+    std::string retained_path = path_of("retained", this->snapshot_seq_);
+    if (this->snapshot_seq_ > 0 && fs::exists(retained_path)) {
+        try {
+            auto segment = MqttRetainSegment::open(retained_path);
+
+            mqtt_retain_entry_t entry;
+            for (std::size_t i = 0; i < segment->size(); i++) {
+                if (segment->entry(i, entry)) {
+                    image.retained.try_emplace(
+                        std::string(entry.topic_name),
+                        mqtt_store_message_t{
+                            .topic = std::string(entry.topic_name),
+                            .payload = std::string(entry.payload),
+                            .qos = entry.qos,
+                        });
+                }
+            }
+        } catch (const std::exception& e) {
+            SPDLOG_ERROR("{}", e.what());
+            return false;
+        }
+    }
+
+    for (uint64_t i = this->snapshot_seq_ + 1; i <= seq; i++) {
+        if (fs::exists(path_of("wal", i))) {
+            replay(path_of("wal", i), image);
+        }
+    }
+
+    // 保留消息段先于快照写入, 快照改名成功后两者才一起生效
+    std::vector<mqtt_retain_entry_t> retained_entries;
+    retained_entries.reserve(image.retained.size());
+    for (const auto& [_, message] : image.retained) {
+        retained_entries.push_back(mqtt_retain_entry_t{
+            .topic_name = message.topic,
+            .payload = message.payload,
+            .qos = message.qos,
+        });
+    }
+
+    if (!MqttRetainSegment::write(path_of("retained", seq),
+                                  retained_entries)) {
+        SPDLOG_ERROR("Failed to write retain segment: {}",
+                     path_of("retained", seq));
+        return false;
+    }
+
+    // 先写到临时文件, 同步后再改名, 启动时看到的快照一定是完整的
+    std::string tmp_path = path_of("snapshot", seq) + ".tmp";
+    std::FILE* file = std::fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr) {
+        SPDLOG_ERROR("Failed to create store snapshot: {}", tmp_path);
+        return false;
+    }
+
+    bool ok = true;
+    std::string buffer;
+    mqtt_store_record_t record;
+
+    for (auto& [client_id, session] : image.sessions) {
+        record.op = MQTT_STORE_OP::PUT_SESSION;
+        record.client_id = client_id;
+        record.session = std::move(session);
+        ok = ok && s_write_record(file, buffer, record);
+    }
+
+    ok = ok && std::fflush(file) == 0;
+    s_sync_file(file);
+    std::fclose(file);
+
+    std::error_code ec;
+    if (ok) {
+        fs::rename(tmp_path, path_of("snapshot", seq), ec);
+    }
+
+    if (!ok || ec) {
+        SPDLOG_ERROR("Failed to write store snapshot: {}", tmp_path);
+        fs::remove(tmp_path, ec);
+        fs::remove(path_of("retained", seq), ec);
+        return false;
+    }
+
+    // 新快照已经包含了之前的全部内容, 旧的保留消息段可能还被映射, 删除后映射仍然有效
+    if (this->snapshot_seq_ > 0) {
+        fs::remove(path_of("snapshot", this->snapshot_seq_), ec);
+        fs::remove(retained_path, ec);
+    }
+
+    for (uint64_t i = this->snapshot_seq_ + 1; i <= seq; i++) {
+        fs::remove(path_of("wal", i), ec);
+    }
+
+    SPDLOG_INFO("Store snapshot written: sessions = [{}], retained = [{}], "
+                "seq = [{}]",
+                image.sessions.size(), image.retained.size(), seq);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    this->snapshot_seq_ = seq;
+
+    return true;
+}
+
+void MqttStore::handle_sync() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!this->stopping_) {
+        if (this->sync_interval_ > 0) {
+            cond_.wait_for(
+                lock, std::chrono::milliseconds(this->sync_interval_), [this] {
+                    return this->stopping_ ||
+                           (this->sync_bytes_ > 0 &&
+                            this->written_lsn_ - this->synced_lsn_ >=
+                                this->sync_bytes_);
+                });
+        } else {
+            cond_.wait(lock, [this] {
+                return this->stopping_ || !this->closed_files_.empty();
+            });
+        }
+
+        if (this->stopping_) {
+            break;
+        }
+
+        std::FILE* file = this->dirty_ ? this->file_ : nullptr;
+        std::vector<std::FILE*> closed_files = std::move(this->closed_files_);
+        this->closed_files_.clear();
+        this->dirty_ = false;
+
+        uint64_t lsn = this->written_lsn_;
+
+        // 同步时不持有锁, broker 追加日志不会被磁盘操作阻塞
+        // 正在写的文件只在这里和析构时关闭, 因此同步时文件一定有效
+        lock.unlock();
+
+        for (std::FILE* closed_file : closed_files) {
+            s_sync_file(closed_file);
+            std::fclose(closed_file);
+        }
+
+        if (this->sync_interval_ > 0 && file != nullptr) {
+            s_sync_file(file);
+        }
+
+        lock.lock();
+
+        this->synced_lsn_ = lsn;
+
+        // 这次同步覆盖的提交全部完成, 回调在锁外执行
+        std::vector<std::function<void()>> callbacks;
+        while (!this->commit_waiters_.empty() &&
+               this->commit_waiters_.front().first <= lsn) {
+            callbacks.push_back(std::move(this->commit_waiters_.front().second));
+            this->commit_waiters_.pop_front();
+        }
+
+        if (!callbacks.empty()) {
+            lock.unlock();
+            for (auto& callback : callbacks) {
+                callback();
+            }
+            lock.lock();
+        }
+    }
+}
+
+void MqttStore::handle_compact() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!this->stopping_) {
+        cond_.wait(lock, [this] {
+            return this->stopping_ || this->compact_seq_ > this->compacted_seq_;
+        });
+
+        if (this->stopping_) {
+            break;
+        }
+
+        uint64_t seq = this->compact_seq_;
+
+        // 合并在单独的线程中进行, 不会推迟同步和提交
+        lock.unlock();
+        compact(seq);
+        lock.lock();
+
+        this->compacted_seq_ = seq;
+        cond_.notify_all();
+    }
+}
\ No newline at end of file
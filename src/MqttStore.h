@@ -0,0 +1,155 @@
+#pragma once
+
+#include "MqttCommon.h"
+#include "MqttRetainSegment.h"
+#include "MqttSessionState.h"
+
+// 日志记录的类型
+enum class MQTT_STORE_OP: uint8_t {
+    OPEN_SESSION,     // 持久会话上线, 未投递的消息交给在线会话, 只保留订阅
+    PUT_SESSION,      // 持久会话离线, 记录完整的离线状态
+    ERASE_SESSION,    // 会话被不保留状态的连接接管或者过期
+    SUBSCRIBE,
+    UNSUBSCRIBE,
+    ENQUEUE,          // 离线会话收到一条消息
+    PUT_RETAIN,
+    ERASE_RETAIN,
+};
+
+// 持久化的一条消息
+struct mqtt_store_message_t {
+    std::string topic;
+    std::string payload;
+    uint8_t qos;
+};
+
+// 等待确认的报文, 服务端接收的 Qos2 报文和 PUBREL 阶段的报文只有标识符
+struct mqtt_store_waiting_t {
+    uint16_t packet_id;
+    MQTT_MSG_STATE state;
+    mqtt_store_message_t message;
+};
+
+// 持久会话的状态, 在线时只记录订阅的变化, 离线时才记录未投递的消息
+struct mqtt_store_session_t {
+    int64_t offline_time;    // 离线时的系统时间 (秒), 在线时为 0
+    std::unordered_map<std::string, uint8_t> subscriptions;
+    std::vector<mqtt_store_waiting_t> waiting;
+    std::deque<mqtt_store_message_t> queue;
+};
+
+struct mqtt_store_record_t {
+    MQTT_STORE_OP op;
+    std::string client_id;
+    mqtt_store_message_t message;    // 订阅时 topic 为主题过滤器, qos 为订阅等级
+    mqtt_store_session_t session;
+};
+
+// 从快照和日志恢复出的全部状态
+// 快照中的保留消息单独存放在映射的段文件中, retained 和 erased_retained 只包含之后日志中的变化
+struct mqtt_store_image_t {
+    std::unordered_map<std::string, mqtt_store_session_t> sessions;
+    std::shared_ptr<MqttRetainSegment> retained_segment;
+    std::unordered_map<std::string, mqtt_store_message_t> retained;
+    std::unordered_set<std::string> erased_retained;
+};
+
+// 持久会话和保留消息的存储, broker 在持有锁时追加日志, 日志的顺序就是状态变化的顺序
+// 日志按段写入, 超过大小后换到下一段, 由后台线程把上一个快照和写完的日志段
+// 合并成新的快照, 再删除已经合并的文件
+// 快照和日志使用相同的记录格式, 启动时读取最新的快照再重放之后的日志段
+// 保留消息在合并时写入和快照同序号的段文件, 启动时只映射, 不随保留消息的数量变慢
+// 每条记录写入后立即交给操作系统, 进程崩溃不会丢失, 断电时最多丢失一个同步间隔
+// 同步线程每隔 sync_interval 或者积累了 sync_bytes 的日志就同步一次, 一次同步覆盖
+// 这段时间内所有的写入, 需要等待落盘的调用者通过 commit 注册回调 (组提交)
+class MqttStore {
+public:
+    // sync_interval 为 0 时不主动同步到磁盘, max_queued_messages 限制重放时每个会话的消息数
+    MqttStore(std::string dir, std::size_t max_log_size, uint32_t sync_interval, std::size_t sync_bytes, std::size_t max_queued_messages);
+
+    ~MqttStore();
+
+    MqttStore(const MqttStore&) = delete;
+
+    MqttStore& operator=(const MqttStore&) = delete;
+
+    // 恢复存储的状态并打开新的日志段, 失败时抛出异常
+    mqtt_store_image_t open();
+
+    void open_session(const std::string& client_id);
+
+    void put_session(const std::string& client_id, const MqttOfflineSession& session);
+
+    void erase_session(const std::string& client_id);
+
+    void subscribe(const std::string& client_id, const std::string& topic_filter, uint8_t qos);
+
+    void unsubscribe(const std::string& client_id, const std::string& topic_filter);
+
+    void enqueue(const std::string& client_id, const mqtt_packet_t& packet);
+
+    void put_retain(const mqtt_packet_t& packet);
+
+    void erase_retain(std::string_view topic_name);
+
+    // 之前追加的日志全部同步到磁盘后调用 callback, 回调在同步线程中执行
+    // 不主动同步时立即在当前线程中调用
+    void commit(std::function<void()> callback);
+
+    // 把当前的日志段合并到快照, 等待合并完成
+    void snapshot();
+
+private:
+    void append(const mqtt_store_record_t& record);
+
+    // 换到下一个日志段, 调用时需要持有 mutex_
+    void rotate();
+
+    void apply(mqtt_store_record_t& record, mqtt_store_image_t& image);
+
+    // 读取一个文件中的全部记录, 遇到写了一半的记录时停止, 返回是否完整读取
+    bool replay(const std::string& path, mqtt_store_image_t& image);
+
+    // 合并快照和序号不超过 seq 的日志段, 失败时保留原来的文件
+    bool compact(uint64_t seq);
+
+    void handle_sync();
+
+    void handle_compact();
+
+    std::string path_of(std::string_view name, uint64_t seq) const;
+
+private:
+    std::string dir_;
+    std::size_t max_log_size_;
+    uint32_t sync_interval_;
+    std::size_t max_queued_messages_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread sync_thread_;
+    std::thread compact_thread_;
+    bool stopping_;
+    std::size_t sync_bytes_;
+
+    // 正在写入的日志段
+    std::FILE* file_;
+    uint64_t log_seq_;
+    std::size_t log_size_;
+    bool dirty_;
+    std::string buffer_;
+    // 已经换掉的日志段, 由同步线程同步后关闭
+    std::vector<std::FILE*> closed_files_;
+
+    // 累计写入和已经同步的日志字节数, 用作提交的位置
+    uint64_t written_lsn_;
+    uint64_t synced_lsn_;
+    // 等待同步的回调, 按提交位置递增排列
+    std::deque<std::pair<uint64_t, std::function<void()>>> commit_waiters_;
+
+    // 快照包含的最后一个日志段, 等待合并到的日志段, 以及最后一次合并到的日志段
+    // 合并失败时等到下一次换日志段再重试
+    uint64_t snapshot_seq_;
+    uint64_t compact_seq_;
+    uint64_t compacted_seq_;
+};
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include "MqttTimingWheel.h"
+
+#include "MqttConfig.h"
+
+asio::execution_context::id MqttTimingWheel::id;
+
+MqttTimingWheel::entry::entry(std::function<void()> on_expire)
+    : on_expire_(std::move(on_expire)) {}
+
+MqttTimingWheel::entry::~entry() {
+    if (wheel_ != nullptr) {
+        wheel_->cancel(*this);
+    }
+}
+
+MqttTimingWheel::MqttTimingWheel(asio::io_context& io_context)
+    : asio::execution_context::service(io_context),
+      timer_(io_context),
+      tick_(std::chrono::seconds(std::max<uint32_t>(
+          1, MqttConfig::getInstance()->check_timeout_duration()))),
+      start_(std::chrono::steady_clock::now()),
+      current_tick_(0),
+      count_(0),
+      is_ticking_(false) {
+    for (auto& level : slots_) {
+        level.fill(nullptr);
+    }
+}
+
+MqttTimingWheel& MqttTimingWheel::get(const asio::any_io_executor& executor) {
+    // 会话都运行在 io_context 上, 按执行器所属的 io_context 取得服务
+    auto& context = asio::query(executor, asio::execution::context);
+
+    return asio::use_service<MqttTimingWheel>(
+        static_cast<asio::io_context&>(context));
+}
+
+void MqttTimingWheel::schedule(entry& e,
+                               std::chrono::steady_clock::duration timeout) {
+    auto now = std::chrono::steady_clock::now();
+
+    // 时间轮空闲时没有在计时, 先把当前刻度追到现在
+    if (!this->is_ticking_) {
+        this->current_tick_ = tick_of(now);
+    }
+
+    // 到期刻度向上取整, 保证不会早于指定的超时时间
+    uint64_t expire_tick = tick_of(now + timeout + this->tick_ -
+                                   std::chrono::steady_clock::duration(1));
+    if (expire_tick <= this->current_tick_) {
+        expire_tick = this->current_tick_ + 1;
+    }
+
+    if (e.wheel_ != nullptr) {
+        // 到期刻度没有变化时不需要移动
+        if (e.expire_tick_ == expire_tick) {
+            return;
+        }
+
+        unlink(e);
+    }
+
+    e.expire_tick_ = expire_tick;
+    link(e);
+
+    if (!this->is_ticking_) {
+        start_timer();
+    }
+}
+
+void MqttTimingWheel::cancel(entry& e) noexcept {
+    if (e.wheel_ == this) {
+        unlink(e);
+    }
+}
+
+void MqttTimingWheel::shutdown() {
+    asio::error_code ignored_ec;
+    this->timer_.cancel(ignored_ec);
+    this->is_ticking_ = false;
+
+    // 只摘除定时项, 不触发回调
+    for (auto& level : this->slots_) {
+        for (auto& slot : level) {
+            while (slot != nullptr) {
+                unlink(*slot);
+            }
+        }
+    }
+}
+
+uint64_t MqttTimingWheel::tick_of(
+    std::chrono::steady_clock::time_point time) const noexcept {
+    if (time <= this->start_) {
+        return 0;
+    }
+
+    return static_cast<uint64_t>((time - this->start_) / this->tick_);
+}
+
+void MqttTimingWheel::link(entry& e) noexcept {
+    uint64_t delta = e.expire_tick_ - this->current_tick_;
+    uint32_t level = 0;
+
+    // 距离到期越远放在越高的层级, 超出时间轮范围的放在最高层,
+    // 降级时会重新计算位置
+    while (level + 1 < LEVELS && delta >= (1ULL << ((level + 1) * LEVEL_BITS))) {
+        level++;
+    }
+
+    uint64_t expire_tick = e.expire_tick_;
+    if (delta >= (1ULL << (LEVELS * LEVEL_BITS))) {
+        expire_tick = this->current_tick_ + (1ULL << (LEVELS * LEVEL_BITS)) - 1;
+    }
+
+    entry*& slot =
+        this->slots_[level][(expire_tick >> (level * LEVEL_BITS)) & LEVEL_MASK];
+
+    e.wheel_ = this;
+    e.slot_ = &slot;
+    e.prev_ = nullptr;
+    e.next_ = slot;
+    if (slot != nullptr) {
+        slot->prev_ = &e;
+    }
+    slot = &e;
+
+    this->count_++;
+}
+
+void MqttTimingWheel::unlink(entry& e) noexcept {
+    if (e.prev_ != nullptr) {
+        e.prev_->next_ = e.next_;
+    } else {
+        *e.slot_ = e.next_;
+    }
+
+    if (e.next_ != nullptr) {
+        e.next_->prev_ = e.prev_;
+    }
+
+    e.wheel_ = nullptr;
+    e.slot_ = nullptr;
+    e.prev_ = nullptr;
+    e.next_ = nullptr;
+
+    this->count_--;
+}
+
+void MqttTimingWheel::advance() {
+    this->current_tick_++;
+
+    // 低层转完一圈时, 把高层当前槽位中的定时项重新放到低层
+    for (uint32_t level = 1; level < LEVELS; level++) {
+        if ((this->current_tick_ &
+             ((1ULL << (level * LEVEL_BITS)) - 1)) != 0) {
+            break;
+        }
+
+        entry*& slot = this->slots_[level][(this->current_tick_ >>
+                                            (level * LEVEL_BITS)) &
+                                           LEVEL_MASK];
+        while (slot != nullptr) {
+            entry& e = *slot;
+            unlink(e);
+            link(e);
+        }
+    }
+
+    // 回调中可能会修改其它定时项, 每次都从槽位头部取出一个处理
+    entry*& slot = this->slots_[0][this->current_tick_ & LEVEL_MASK];
+    while (slot != nullptr) {
+        entry& e = *slot;
+        unlink(e);
+
+        // 回调中可能会释放定时项的持有者, 先拷贝回调
+        auto on_expire = e.on_expire_;
+        on_expire();
+    }
+}
+
+void MqttTimingWheel::start_timer() {
+    this->is_ticking_ = true;
+    this->timer_.expires_at(this->start_ +
+                            this->tick_ * (this->current_tick_ + 1));
+    this->timer_.async_wait(
+        [this](const asio::error_code& ec) { handle_timer(ec); });
+}
+
+void MqttTimingWheel::handle_timer(const asio::error_code& ec) {
+    if (ec || !this->is_ticking_) {
+        return;
+    }
+
+    // 线程繁忙时定时器可能延迟触发, 需要补上错过的刻度
+    uint64_t target_tick = tick_of(std::chrono::steady_clock::now());
+    while (this->current_tick_ < target_tick && this->count_ > 0) {
+        advance();
+    }
+
+    // 没有定时项时停止计时, 下一次设置定时项时再启动
+    if (this->count_ == 0) {
+        this->is_ticking_ = false;
+        return;
+    }
+
+    start_timer();
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "MqttCommon.h"
+
+// 分层时间轮, 每个 io_context 一个, 由该 I/O 线程上的所有会话共享
+// 定时项按到期时间挂到对应层级的槽位上, 刷新定时只是把定时项移动到另一个槽位,
+// 时间轮只在有定时项时才按刻度唤醒, 唤醒时只处理当前刻度到期的定时项,
+// 空闲时的开销与定时项数量无关
+// 时间轮及其定时项只能在所属 io_context 的线程中访问
+class MqttTimingWheel : public asio::execution_context::service {
+public:
+    // 挂在时间轮上的定时项, 由使用方持有, 析构时自动从时间轮上摘除
+    class entry {
+    public:
+        explicit entry(std::function<void()> on_expire);
+
+        ~entry();
+
+        entry(const entry&) = delete;
+
+        entry& operator=(const entry&) = delete;
+
+        inline bool is_scheduled() const noexcept { return wheel_ != nullptr; }
+
+    private:
+        friend class MqttTimingWheel;
+
+        std::function<void()> on_expire_;
+        MqttTimingWheel* wheel_ = nullptr;
+        entry** slot_ = nullptr;
+        entry* prev_ = nullptr;
+        entry* next_ = nullptr;
+        uint64_t expire_tick_ = 0;
+    };
+
+    static asio::execution_context::id id;
+
+    explicit MqttTimingWheel(asio::io_context& io_context);
+
+    ~MqttTimingWheel() = default;
+
+    // 取得执行器所在 io_context 的时间轮, 第一次使用时创建
+    static MqttTimingWheel& get(const asio::any_io_executor& executor);
+
+    // 定时项已经在时间轮上时重新设置到期时间
+    void schedule(entry& e, std::chrono::steady_clock::duration timeout);
+
+    void cancel(entry& e) noexcept;
+
+    inline std::size_t size() const noexcept { return count_; }
+
+private:
+    void shutdown() override;
+
+    uint64_t tick_of(std::chrono::steady_clock::time_point time) const noexcept;
+
+    void link(entry& e) noexcept;
+
+    void unlink(entry& e) noexcept;
+
+    // 前进一个刻度, 将高层到期的槽位降级到低层, 再处理最低层到期的定时项
+    void advance();
+
+    void start_timer();
+
+    void handle_timer(const asio::error_code& ec);
+
+private:
+    static constexpr uint32_t LEVEL_BITS = 6;
+    static constexpr uint32_t LEVEL_SLOTS = 1U << LEVEL_BITS;
+    static constexpr uint32_t LEVEL_MASK = LEVEL_SLOTS - 1;
+    // 4 层共 2^24 个刻度, 以 1 秒为刻度时可以覆盖 194 天
+    static constexpr uint32_t LEVELS = 4;
+
+    asio::steady_timer timer_;
+    std::chrono::steady_clock::duration tick_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t current_tick_;
+    std::size_t count_;
+    bool is_ticking_;
+    std::array<std::array<entry*, LEVEL_SLOTS>, LEVELS> slots_;
+};
\ No newline at end of file
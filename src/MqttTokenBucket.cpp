@@ -1,30 +1,80 @@
 #include "MqttTokenBucket.h"
 
-MqttTokenBucket::MqttTokenBucket(double tokensPerSecond)
-    : tokensPerSecond_(tokensPerSecond),
-      maxTokens_(tokensPerSecond),
-      tokens_(tokensPerSecond),
-      lastRefillTime_(std::chrono::steady_clock::now()) {}
+#include <stdexcept>
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+MqttTokenBucket::MqttTokenBucket(double tokensPerSecond) : tat_(0) {
+    init(tokensPerSecond, std::max(tokensPerSecond, 1.0));
+}
 
 MqttTokenBucket::MqttTokenBucket(double tokensPerSecond, double maxTokens)
-    : tokensPerSecond_(tokensPerSecond),
-      maxTokens_(maxTokens),
-      tokens_(maxTokens),
-      lastRefillTime_(std::chrono::steady_clock::now()) {}
+    : tat_(0) {
+    init(tokensPerSecond, maxTokens);
+}
 
 bool MqttTokenBucket::tryConsume() noexcept {
-    refillTokens();    // 在消费之前先补充令牌
-    if (tokens_ >= 1.0) {
-        tokens_ -= 1.0;
-        return true;
+    int64_t now = MqttTokenBucket::now();
+    int64_t increment = static_cast<int64_t>(interval_);
+    int64_t tat = tat_.load(std::memory_order_relaxed);
+
+    for (;;) {
+        // TAT 早于当前时间的部分是已经补满的令牌, 不能累积
+        int64_t new_tat = std::max(tat, now) + increment;
+        if (new_tat - now > tolerance_) {
+            return false;
+        }
+
+        if (tat_.compare_exchange_weak(tat, new_tat,
+                                       std::memory_order_relaxed)) {
+            return true;
+        }
     }
-    return false;
 }
 
-void MqttTokenBucket::refillTokens() noexcept {
-    auto now = std::chrono::steady_clock::now();
-    std::chrono::duration<double> elapsed = now - lastRefillTime_;
-    double newTokens = elapsed.count() * tokensPerSecond_;    // 按时间补充令牌
-    tokens_ = std::min(maxTokens_, tokens_ + newTokens);    // 更新桶中的令牌数
-    lastRefillTime_ = now;    // 更新上次补充时间
+double MqttTokenBucket::consume(double tokens) noexcept {
+    int64_t now = MqttTokenBucket::now();
+    int64_t increment = static_cast<int64_t>(tokens * interval_);
+    int64_t tat = tat_.load(std::memory_order_relaxed);
+    int64_t new_tat;
+
+    do {
+        new_tat = std::max(tat, now) + increment;
+    } while (!tat_.compare_exchange_weak(tat, new_tat,
+                                         std::memory_order_relaxed));
+
+    return std::max<int64_t>(new_tat - now - tolerance_, 0) / 1e9;
+}
+
+void MqttTokenBucket::refund() noexcept {
+    tat_.fetch_sub(static_cast<int64_t>(interval_), std::memory_order_relaxed);
+}
+
+void MqttTokenBucket::reset(double tokensPerSecond) {
+    init(tokensPerSecond, std::max(tokensPerSecond, 1.0));
+    tat_.store(0, std::memory_order_relaxed);
+}
+
+int64_t MqttTokenBucket::now() noexcept {
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+    // 粗粒度时钟只读取内核更新的时间, 不需要访问时钟硬件
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+void MqttTokenBucket::init(double tokensPerSecond, double maxTokens) {
+    if (!(tokensPerSecond > 0) || !(maxTokens >= 1)) {
+        throw std::invalid_argument("invalid token bucket rate");
+    }
+
+    interval_ = 1e9 / tokensPerSecond;
+    tolerance_ = static_cast<int64_t>(maxTokens * interval_);
 }
\ No newline at end of file
@@ -1,26 +1,45 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <algorithm>
 
+// 按通用信元速率算法 (GCRA) 实现的令牌桶, 和令牌桶的限制效果相同
+// 只保存一个理论到达时间 (TAT), 每消耗一个令牌向后推一个发放间隔, TAT 超过当前时间
+// 一个桶的容量时说明令牌已经用完, 更新 TAT 使用 CAS, 多个 I/O 线程可以同时访问同一个桶
+// 当前时间来自粗粒度的单调时钟, 精度为系统时钟的一个刻度 (通常为几毫秒)
 class MqttTokenBucket {
 public:
+    // 容量为一秒发放的令牌数, 至少为一个令牌
     MqttTokenBucket(double tokensPerSecond);
 
     MqttTokenBucket(double tokensPerSecond, double maxTokens);
     
     ~MqttTokenBucket() = default;
 
-    // 尝试消耗一个令牌
+    // 尝试消耗一个令牌, 多个 I/O 线程可能同时访问同一个限制组
     bool tryConsume() noexcept;
 
+    // 不论令牌是否足够都消耗 tokens 个令牌, 返回令牌数恢复到非负还需要的秒数
+    // 用于按字节限速, 一条消息可能超过桶的容量
+    double consume(double tokens) noexcept;
+
+    // 归还一个刚消耗的令牌, 用于上一级的限制没有通过时
+    void refund() noexcept;
+
+    // 令牌桶从池中取出重新使用时按新的速率装满, 调用时不能有其它线程在使用
+    void reset(double tokensPerSecond);
+
+    // 粗粒度单调时钟的当前时间 (纳秒)
+    static int64_t now() noexcept;
+
 private:
-    // 补充令牌，按速率计算增加的令牌数量
-    void refillTokens() noexcept;
+    // 速率必须大于 0, 容量至少为一个令牌, 否则抛出异常
+    void init(double tokensPerSecond, double maxTokens);
 
 private:
-    double tokensPerSecond_;    // 每秒生成的令牌数
-    double maxTokens_;          // 桶中最大令牌数
-    double tokens_;             // 当前桶中的令牌数
-    std::chrono::steady_clock::time_point lastRefillTime_;  // 上次补充令牌的时间
+    double interval_;                // 发放一个令牌的间隔 (纳秒)
+    int64_t tolerance_;              // 桶的容量对应的时间 (纳秒)
+    std::atomic<int64_t> tat_;       // 理论到达时间, 不晚于当前时间时桶是满的
 };
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include "MqttTopicTree.h"
+
+void MqttTopicTree::subscribe(const std::string& sid,
+                              const std::string& topic_filter, uint8_t qos) {
+    std::vector<std::string_view> levels;
+    utils::split_topic_levels(topic_filter, levels);
+
+    node_t* node = &root_;
+    for (auto level : levels) {
+        std::unique_ptr<node_t>* next = nullptr;
+
+        if (level == "+") {
+            next = &node->plus_child;
+        } else if (level == "#") {
+            next = &node->hash_child;
+        } else {
+            auto iter = node->children.find(level);
+            if (iter == node->children.end()) {
+                iter = node->children.emplace(std::string(level), nullptr)
+                           .first;
+            }
+            next = &iter->second;
+        }
+
+        if (*next == nullptr) {
+            *next = std::make_unique<node_t>();
+        }
+
+        node = next->get();
+    }
+
+    // 重复订阅只更新 Qos 等级
+    if (node->subscribers.insert_or_assign(sid, qos).second) {
+        subscription_count_++;
+    }
+}
+
+void MqttTopicTree::unsubscribe(const std::string& sid,
+                                const std::string& topic_filter) {
+    std::vector<std::string_view> levels;
+    utils::split_topic_levels(topic_filter, levels);
+
+    remove(&root_, levels, 0, sid);
+}
+
+void MqttTopicTree::match(
+    std::string_view topic_name,
+    std::unordered_map<std::string, uint8_t>& result) const {
+    std::vector<std::string_view> levels;
+    utils::split_topic_levels(topic_name, levels);
+
+    match_levels(&root_, levels, 0, result);
+}
+
+void MqttTopicTree::collect(const node_t* node,
+                            std::unordered_map<std::string, uint8_t>& result) {
+    for (const auto& [sid, qos] : node->subscribers) {
+        auto [iter, inserted] = result.emplace(sid, qos);
+        if (!inserted && iter->second < qos) {
+            iter->second = qos;
+        }
+    }
+}
+
+void MqttTopicTree::match_levels(
+    const node_t* node, const std::vector<std::string_view>& levels,
+    std::size_t depth, std::unordered_map<std::string, uint8_t>& result) const {
+    // '#' 匹配剩余的所有层级, 包括父级本身, 例如 "a/#" 可以匹配 "a"
+    if (node->hash_child) {
+        collect(node->hash_child.get(), result);
+    }
+
+    if (depth == levels.size()) {
+        collect(node, result);
+        return;
+    }
+
+    auto iter = node->children.find(levels[depth]);
+    if (iter != node->children.end()) {
+        match_levels(iter->second.get(), levels, depth + 1, result);
+    }
+
+    // '+' 匹配当前的一个层级
+    if (node->plus_child) {
+        match_levels(node->plus_child.get(), levels, depth + 1, result);
+    }
+}
+
+bool MqttTopicTree::remove(node_t* node,
+                           const std::vector<std::string_view>& levels,
+                           std::size_t depth, const std::string& sid) {
+    if (depth == levels.size()) {
+        if (node->subscribers.erase(sid)) {
+            subscription_count_--;
+        }
+        return node->empty();
+    }
+
+    auto level = levels[depth];
+
+    // 子节点为空时回收, 避免大量临时主题导致订阅树只增不减
+    if (level == "+" || level == "#") {
+        auto& child = (level == "+") ? node->plus_child : node->hash_child;
+        if (child && remove(child.get(), levels, depth + 1, sid)) {
+            child.reset();
+        }
+    } else {
+        auto iter = node->children.find(level);
+        if (iter != node->children.end() &&
+            remove(iter->second.get(), levels, depth + 1, sid)) {
+            node->children.erase(iter);
+        }
+    }
+
+    return node->empty();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "MqttCommon.h"
+#include "MqttUtils.h"
+
+// 订阅树, 每一层对应主题的一个层级, 通配符 '+' 和 '#' 单独作为节点保存
+// 发布消息时只需沿着主题层级向下查找, 时间复杂度与主题深度相关而与订阅数无关
+class MqttTopicTree {
+public:
+    MqttTopicTree() = default;
+
+    ~MqttTopicTree() = default;
+
+    void subscribe(const std::string& sid, const std::string& topic_filter, uint8_t qos);
+
+    void unsubscribe(const std::string& sid, const std::string& topic_filter);
+
+    // 查找匹配的会话, 同一个会话存在多个订阅匹配时取最大的 Qos 等级
+    void match(std::string_view topic_name, std::unordered_map<std::string, uint8_t>& result) const;
+
+    inline std::size_t size() const noexcept { return subscription_count_; }
+
+private:
+    struct node_t {
+        std::unordered_map<std::string, std::unique_ptr<node_t>,
+                           utils::string_hash, std::equal_to<>>
+            children;
+        std::unique_ptr<node_t> plus_child;
+        std::unique_ptr<node_t> hash_child;
+        std::unordered_map<std::string, uint8_t> subscribers;
+
+        inline bool empty() const noexcept {
+            return children.empty() && !plus_child && !hash_child &&
+                   subscribers.empty();
+        }
+    };
+
+    static void collect(const node_t* node, std::unordered_map<std::string, uint8_t>& result);
+
+    void match_levels(const node_t* node, const std::vector<std::string_view>& levels, std::size_t depth, std::unordered_map<std::string, uint8_t>& result) const;
+
+    bool remove(node_t* node, const std::vector<std::string_view>& levels, std::size_t depth, const std::string& sid);
+
+private:
+    node_t root_;
+    std::size_t subscription_count_ = 0;
+};
@@ -1,7 +1,12 @@
 #pragma once
 
 #include <cctype>
+#include <cstdint>
+#include <cstdlib>
 #include <string>
+#include <string_view>
+#include <functional>
+#include <vector>
 
 namespace utils {
 
@@ -180,6 +185,49 @@ inline bool tolower_equal(std::string_view a, std::string_view b) {
                       [](char a, char b) { return tolower(a) == tolower(b); });
 }
 
+// 解析带 KB 和 MB 后缀的大小配置, 没有后缀时单位为字节
+inline uint32_t parse_size(const std::string& str_size) {
+    std::string_view sv_size = str_size;
+
+    auto slen = sv_size.length();
+
+    if (slen > 2 && tolower_equal(sv_size.substr(slen - 2, 2), "KB")) {
+        return atoi(str_size.substr(0, slen - 2).c_str()) * 1024;
+    }
+
+    if (slen > 2 && tolower_equal(sv_size.substr(slen - 2, 2), "MB")) {
+        return atoi(str_size.substr(0, slen - 2).c_str()) * 1024 * 1024;
+    }
+
+    return atoi(str_size.c_str());
+}
+
+// 按 '/' 切分主题层级, 空层级也是合法的层级, 例如 "/a" 包含 "" 和 "a" 两个层级
+inline void split_topic_levels(std::string_view topic,
+                               std::vector<std::string_view>& levels) {
+    std::size_t start = 0;
+
+    for (;;) {
+        auto end = topic.find('/', start);
+        if (end == std::string_view::npos) {
+            levels.emplace_back(topic.substr(start));
+            break;
+        }
+
+        levels.emplace_back(topic.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+// 支持 std::string_view 异构查找, 避免查找时构造临时 std::string
+struct string_hash {
+    using is_transparent = void;
+
+    inline std::size_t operator()(std::string_view sv) const noexcept {
+        return std::hash<std::string_view>{}(sv);
+    }
+};
+
 inline std::string_view trim_sv(std::string_view v) {
     v.remove_prefix((std::min)(v.find_first_not_of(" "), v.size()));
     v.remove_suffix(
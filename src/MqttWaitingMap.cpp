@@ -0,0 +1,112 @@
+#include "MqttWaitingMap.h"
+
+MqttWaitingMap::MqttWaitingMap(MqttWaitingMap&& other) noexcept
+    : packets_(std::move(other.packets_)),
+      lists_(std::exchange(other.lists_, {})) {
+    other.packets_.clear();
+}
+
+MqttWaitingMap& MqttWaitingMap::operator=(MqttWaitingMap&& other) noexcept {
+    if (this != &other) {
+        packets_ = std::move(other.packets_);
+        lists_ = std::exchange(other.lists_, {});
+        other.packets_.clear();
+    }
+
+    return *this;
+}
+
+mqtt_waiting_packet_t* MqttWaitingMap::find(uint16_t packet_id) {
+    auto iter = packets_.find(packet_id);
+    if (iter == packets_.end()) {
+        return nullptr;
+    }
+
+    return &iter->second;
+}
+
+mqtt_waiting_packet_t& MqttWaitingMap::insert(uint16_t packet_id) {
+    mqtt_waiting_packet_t& packet = packets_[packet_id];
+
+    cancel(packet);
+    packet = mqtt_waiting_packet_t{};
+    packet.packet_id = packet_id;
+
+    return packet;
+}
+
+void MqttWaitingMap::erase(mqtt_waiting_packet_t& packet) {
+    cancel(packet);
+    packets_.erase(packet.packet_id);
+}
+
+void MqttWaitingMap::schedule(
+    mqtt_waiting_packet_t& packet, timeout_t timeout,
+    std::chrono::steady_clock::time_point expiry_time) {
+    cancel(packet);
+
+    packet.timeout = timeout;
+    packet.expiry_time = expiry_time;
+
+    if (timeout == timeout_t::NONE) {
+        return;
+    }
+
+    timeout_list_t& list = list_of(timeout);
+
+    packet.prev = list.tail;
+    packet.next = nullptr;
+    if (list.tail != nullptr) {
+        list.tail->next = &packet;
+    } else {
+        list.head = &packet;
+    }
+    list.tail = &packet;
+}
+
+void MqttWaitingMap::cancel(mqtt_waiting_packet_t& packet) noexcept {
+    if (packet.timeout == timeout_t::NONE) {
+        return;
+    }
+
+    timeout_list_t& list = list_of(packet.timeout);
+
+    if (packet.prev != nullptr) {
+        packet.prev->next = packet.next;
+    } else {
+        list.head = packet.next;
+    }
+
+    if (packet.next != nullptr) {
+        packet.next->prev = packet.prev;
+    } else {
+        list.tail = packet.prev;
+    }
+
+    packet.timeout = timeout_t::NONE;
+    packet.expiry_time = std::chrono::steady_clock::time_point::max();
+    packet.prev = nullptr;
+    packet.next = nullptr;
+}
+
+void MqttWaitingMap::expire_resend(
+    std::chrono::steady_clock::time_point now) noexcept {
+    // 链表上的到期时间本来就是递增的, 截断到 now 之后仍然保持有序
+    for (mqtt_waiting_packet_t* packet = list_of(timeout_t::RESEND).head;
+         packet != nullptr; packet = packet->next) {
+        packet->expiry_time = std::min(packet->expiry_time, now);
+    }
+}
+
+mqtt_waiting_packet_t* MqttWaitingMap::front() const noexcept {
+    mqtt_waiting_packet_t* result = nullptr;
+
+    for (const auto& list : lists_) {
+        if (list.head != nullptr &&
+            (result == nullptr || list.head->expiry_time < result->expiry_time)) {
+            result = list.head;
+        }
+    }
+
+    return result;
+}
\ No newline at end of file
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "MqttCommon.h"
+
+// 等待确认的报文, 重发相关的状态只在这里记录
+struct mqtt_waiting_packet_t {
+    // 超时的类型, 决定报文串在哪一条到期链表上
+    enum class timeout_t : uint8_t {
+        NONE,       // 不会超时, 例如收到 PUBREC 后等待发送 PUBREL 的间隙
+        RESEND,     // 到期后重发, 时长为 resend_duration
+        WAITING,    // 到期后放弃等待, 时长为 max_waiting_time
+    };
+
+    mqtt_packet_t packet;    // 服务端接收的 Qos2 报文只记录状态, 不保存消息
+    MQTT_MSG_STATE state;
+    timeout_t timeout;
+    uint16_t packet_id;
+    uint32_t max_resend_count;
+    std::chrono::time_point<std::chrono::steady_clock> expiry_time;
+
+    // 由 MqttWaitingMap 维护的到期链表
+    mqtt_waiting_packet_t* prev;
+    mqtt_waiting_packet_t* next;
+
+    mqtt_waiting_packet_t() :
+        state(MQTT_MSG_STATE::INVALID),
+        timeout(timeout_t::NONE),
+        packet_id(0U),
+        max_resend_count(0U),
+        prev(nullptr),
+        next(nullptr)
+        {}
+};
+
+// 等待确认的报文表, 以报文标识符为键存放
+// 需要定时处理的报文按超时类型串在各自的到期链表上, 同一条链表上的报文
+// 超时时长相同, 加入的顺序就是到期的顺序, 因此检查到期时只需要看链表头部,
+// 确认和重发都是 O(1) 的链表操作, 不需要扫描整张表
+class MqttWaitingMap {
+public:
+    using timeout_t = mqtt_waiting_packet_t::timeout_t;
+
+    MqttWaitingMap() = default;
+
+    MqttWaitingMap(MqttWaitingMap&& other) noexcept;
+
+    MqttWaitingMap& operator=(MqttWaitingMap&& other) noexcept;
+
+    ~MqttWaitingMap() = default;
+
+    inline bool contains(uint16_t packet_id) const {
+        return packets_.contains(packet_id);
+    }
+
+    inline std::size_t size() const noexcept { return packets_.size(); }
+
+    mqtt_waiting_packet_t* find(uint16_t packet_id);
+
+    // 报文标识符已经存在时重置原来的报文
+    mqtt_waiting_packet_t& insert(uint16_t packet_id);
+
+    void erase(mqtt_waiting_packet_t& packet);
+
+    // 将报文移到对应到期链表的尾部, 同一类型的到期时间必须按调用顺序递增
+    void schedule(mqtt_waiting_packet_t& packet, timeout_t timeout,
+                  std::chrono::steady_clock::time_point expiry_time);
+
+    void cancel(mqtt_waiting_packet_t& packet) noexcept;
+
+    // 重发链表上还没到期的报文全部提前到 now 到期, 用于持久会话重连后立即重发
+    void expire_resend(std::chrono::steady_clock::time_point now) noexcept;
+
+    // 最早到期的报文, 没有需要定时处理的报文时返回空
+    mqtt_waiting_packet_t* front() const noexcept;
+
+    template <typename Func>
+    void for_each(Func&& func) const {
+        for (const auto& [_, packet] : packets_) {
+            func(packet);
+        }
+    }
+
+private:
+    struct timeout_list_t {
+        mqtt_waiting_packet_t* head = nullptr;
+        mqtt_waiting_packet_t* tail = nullptr;
+    };
+
+    inline timeout_list_t& list_of(timeout_t timeout) noexcept {
+        return lists_[static_cast<uint8_t>(timeout) - 1];
+    }
+
+private:
+    // unordered_map 的节点地址在插入和扩容时保持不变, 可以直接串成链表
+    std::unordered_map<uint16_t, mqtt_waiting_packet_t> packets_;
+    std::array<timeout_list_t, 2> lists_;
+};
\ No newline at end of file
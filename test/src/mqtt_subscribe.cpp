@@ -5,10 +5,16 @@
 
 bool message_subscribed;
 
+int message_received_count;
+
 void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos) {
     message_subscribed = true;
 }
 
+void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg) {
+    message_received_count++;
+}
+
 // 测试 Qos0 级别主题订阅
 TEST(MQTT_SUBSCRIBE_TEST, subscribe_qos0_topic) {
     mosquitto_lib_init();
@@ -117,6 +123,68 @@ TEST(MQTT_SUBSCRIBE_TEST, subscribe_qos2_topic) {
     mosquitto_lib_cleanup();
 }
 
+// 测试通配符订阅只收到匹配的消息
+TEST(MQTT_SUBSCRIBE_TEST, subscribe_wildcard_topic) {
+    mosquitto_lib_init();
+
+    message_subscribed = false;
+    message_received_count = 0;
+
+    struct mosquitto *sub = mosquitto_new(NULL, true, NULL);
+    struct mosquitto *pub = mosquitto_new(NULL, true, NULL);
+    if (!sub || !pub) {
+        ASSERT_TRUE(false) << "创建 mosquitto 示例失败";
+    }
+
+    mosquitto_subscribe_callback_set(sub, on_subscribe);
+    mosquitto_message_callback_set(sub, on_message);
+
+    int rc = mosquitto_connect(sub, "localhost", 1883, 60);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        mosquitto_destroy(sub);
+        mosquitto_destroy(pub);
+        mosquitto_lib_cleanup();
+        ASSERT_TRUE(false) << "连接 MQTT broker 失败";
+    }
+
+    rc = mosquitto_connect(pub, "localhost", 1883, 60);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        mosquitto_destroy(sub);
+        mosquitto_destroy(pub);
+        mosquitto_lib_cleanup();
+        ASSERT_TRUE(false) << "连接 MQTT broker 失败";
+    }
+
+    rc = mosquitto_subscribe(sub, NULL, "sport/+/player", 0);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        ASSERT_TRUE(false) << "主题订阅失败";
+    }
+
+    // 等待订阅完成
+    while (!message_subscribed) {
+        mosquitto_loop(sub, 0, 1);
+    }
+
+    // 只有第一条和第三条消息匹配订阅
+    mosquitto_publish(pub, NULL, "sport/tennis/player", 5, "hello", 0, false);
+    mosquitto_publish(pub, NULL, "sport/tennis/coach", 5, "hello", 0, false);
+    mosquitto_publish(pub, NULL, "sport/golf/player", 5, "hello", 0, false);
+    mosquitto_loop(pub, 10, 1);
+
+    for (int i = 0; i < 100; i++) {
+        mosquitto_loop(sub, 10, 1);
+    }
+
+    EXPECT_EQ(message_received_count, 2);
+
+    // 断开连接并清理资源
+    mosquitto_disconnect(pub);
+    mosquitto_disconnect(sub);
+    mosquitto_destroy(pub);
+    mosquitto_destroy(sub);
+    mosquitto_lib_cleanup();
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();